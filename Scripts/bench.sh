@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Gera um corpus sintético, arranca o servidor sobre ele, indexa-o e corre
+# o gerador de carga. Cada execução acrescenta uma linha JSON a $OUT.
+# Parâmetros por variáveis de ambiente, p.ex.:
+#   DOCS=5000 CLIENTS=8 MIX=a:0,c:80,s:20 make bench-run
+
+DOCS=${DOCS:-1000}              # documentos do corpus
+WORDS=${WORDS:-500}             # palavras por documento
+VOCAB=${VOCAB:-5000}            # tamanho do vocabulário
+CLIENTS=${CLIENTS:-4}           # processos cliente
+REQUESTS=${REQUESTS:-1000}      # pedidos por cliente
+MIX=${MIX:-a:5,c:50,l:20,s:25}  # pesos de -a, -c, -l e -s
+CACHE=${CACHE:-100}             # tamanho da cache LRU do servidor
+PERSIST=${PERSIST:-snapshot}    # snapshot: cada -a reescreve o índice (index_save)
+SERVER_OPTS=${SERVER_OPTS:-}    # opções extra do dserver
+LABEL=${LABEL:-$(git rev-parse --short HEAD 2>/dev/null)}
+OUT=${OUT:-bench_results.jsonl}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$ROOT/tmp/bench
+case "$OUT" in /*) ;; *) OUT=$ROOT/$OUT ;; esac
+
+# Parar servidor anterior
+pkill dserver 2>/dev/null
+sleep 0.5
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+"$ROOT/bin/bench_corpus" "$WORK/docs" "$DOCS" "$WORDS" "$VOCAB" || exit 1
+
+# O servidor corre em $WORK para que o seu data/ não toque no do projeto
+(cd "$WORK" && exec "$ROOT/bin/dserver" docs "$CACHE" --persist="$PERSIST" $SERVER_OPTS > server.log 2>&1) &
+SERVER_PID=$!
+for _ in $(seq 50); do [ -p /tmp/docindex_server_fifo ] && break; sleep 0.1; done
+
+echo "### Indexar $DOCS documentos"
+"$ROOT/bin/dclient" -A "$WORK/docs/manifest.txt" | tail -n 1
+
+echo "### Carga: $CLIENTS clientes x $REQUESTS pedidos ($MIX)"
+"$ROOT/bin/bench_load" --clients="$CLIENTS" --requests="$REQUESTS" --mix="$MIX" \
+    --docs="$DOCS" --vocabulary="$VOCAB" --label="$LABEL" --out="$OUT"
+STATUS=$?
+
+echo "### Estatísticas do servidor"
+"$ROOT/bin/dclient" --stats
+
+"$ROOT/bin/dclient" -f > /dev/null
+wait $SERVER_PID
+echo "### Resultados acrescentados a $OUT"
+exit $STATUS
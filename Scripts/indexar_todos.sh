@@ -1,10 +1,11 @@
 #!/bin/bash
 
+# Indexa todo o Gdataset com um único pedido em lote (-A)
 for file in Gdataset/*.txt; do
     title=$(basename "$file" .txt)
     authors="Desconhecido"
     year="2000"
     path=$(basename "$file")
 
-    ./bin/dclient -a "$title" "$authors" "$year" "$path"
-done
+    echo "$title|$authors|$year|$path"
+done | ./bin/dclient -A
@@ -0,0 +1,76 @@
+#include "common.h"
+#include "metacache.h"
+
+// Replays a lookup trace recorded with "dserver --cache-trace=PATH" through
+// each eviction policy of the -c cache and prints the hit ratio of every
+// policy at every cache size. Misses are inserted exactly as index_query()
+// does, so the numbers match what the server would have seen.
+
+static int *load_trace(const char *path, int *count) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return NULL;
+
+    int *ids = NULL, capacity = 0, n = 0;
+    char line[64];
+    while (fgets(line, sizeof(line), fp)) {
+        int id = atoi(line);
+        if (id <= 0) continue;
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            int *grown = realloc(ids, capacity * sizeof(int));
+            if (!grown) break;
+            ids = grown;
+        }
+        ids[n++] = id;
+    }
+    fclose(fp);
+    *count = n;
+    return ids;
+}
+
+static void replay(const int *ids, int count, int size, int policy, long *hits, long *rejected) {
+    static const DocumentMeta empty = { 0, "", "", "", "" };
+    metacache_init(size, policy);
+    DocumentMeta meta;
+    for (int i = 0; i < count; i++) {
+        if (!metacache_get(ids[i], &meta)) metacache_put(ids[i], &empty);
+    }
+    long misses;
+    metacache_counts(hits, &misses, rejected);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace> [cache_size ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int count = 0;
+    int *ids = load_trace(argv[1], &count);
+    if (!ids || !count) {
+        fprintf(stderr, "Error: no lookups in %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    static const int default_sizes[] = { 10, 50, 100, 500 };
+    int nsizes = argc > 2 ? argc - 2 : 4;
+
+    printf("%d lookups\n", count);
+    printf("%-6s %10s %10s %12s\n", "size", "lru", "tinylfu", "not admitted");
+    for (int s = 0; s < nsizes; s++) {
+        int size = argc > 2 ? atoi(argv[s + 2]) : default_sizes[s];
+        if (size < 1 || size > MAX_CACHE) {
+            fprintf(stderr, "Skipping cache size %d (1..%d)\n", size, MAX_CACHE);
+            continue;
+        }
+
+        long lru_hits, tinylfu_hits, rejected;
+        replay(ids, count, size, METACACHE_LRU, &lru_hits, NULL);
+        replay(ids, count, size, METACACHE_TINYLFU, &tinylfu_hits, &rejected);
+        printf("%-6d %9.2f%% %9.2f%% %12ld\n", size,
+               100.0 * lru_hits / count, 100.0 * tinylfu_hits / count, rejected);
+    }
+
+    free(ids);
+    return EXIT_SUCCESS;
+}
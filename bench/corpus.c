@@ -0,0 +1,65 @@
+#include "common.h"
+#include "vocab.h"
+
+// Writes a synthetic corpus for the load generator: <docs> files of <words>
+// Zipf-distributed words each, plus manifest.txt for "dclient -A".
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <folder> [docs] [words_per_doc] [vocabulary] [seed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *folder = argv[1];
+    int docs = argc > 2 ? atoi(argv[2]) : 1000;
+    int words = argc > 3 ? atoi(argv[3]) : 500;
+    int vocabulary = argc > 4 ? atoi(argv[4]) : 5000;
+    uint64_t seed = argc > 5 ? strtoull(argv[5], NULL, 10) : 1;
+    if (docs < 1 || words < 1 || vocabulary < 1) {
+        fprintf(stderr, "Error: docs, words_per_doc and vocabulary must be positive\n");
+        return EXIT_FAILURE;
+    }
+    if (seed == 0) seed = 1;    // xorshift never leaves 0
+
+    if (mkdir(folder, 0777) == -1 && errno != EEXIST) {
+        perror("mkdir");
+        return EXIT_FAILURE;
+    }
+    double *cdf = vocab_zipf(vocabulary);
+    if (!cdf) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/manifest.txt", folder);
+    FILE *manifest = fopen(path, "w");
+    if (!manifest) {
+        perror("open manifest");
+        return EXIT_FAILURE;
+    }
+
+    size_t bytes = 0;
+    for (int d = 1; d <= docs; d++) {
+        snprintf(path, sizeof(path), "%s/bench_%d.txt", folder, d);
+        FILE *f = fopen(path, "w");
+        if (!f) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        fprintf(f, "Title: Bench document %d\nAuthor: Bench\n\n", d);
+        char word[16];
+        for (int w = 0; w < words; w++) {
+            vocab_word(vocab_pick(cdf, vocabulary, &seed), word);
+            fputs(word, f);
+            fputc(w % 12 == 11 || w == words - 1 ? '\n' : ' ', f);
+        }
+        bytes += ftell(f);
+        fclose(f);
+        fprintf(manifest, "Bench document %d|Bench|%d|bench_%d.txt\n", d, 1900 + d % 125, d);
+    }
+    fclose(manifest);
+    free(cdf);
+
+    fprintf(stderr, "%d documents, %zu bytes, %d-word vocabulary in %s\n", docs, bytes, vocabulary, folder);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#include "common.h"
+#include "scan.h"
+#include <sys/wait.h>
+#include <time.h>
+
+// Compares "grep -c" (fork + exec, as -l used to do) with the in-process
+// counter at each SIMD level, and checks that every count agrees.
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int grep_count(const char *file, const char *keyword) {
+    int pipefd[2];
+    if (pipe(pipefd) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        execlp("grep", "grep", "-c", keyword, file, (char *)NULL);
+        _exit(1);
+    }
+
+    close(pipefd[1]);
+    char buf[64] = {0};
+    ssize_t n = read(pipefd[0], buf, sizeof(buf) - 1);
+    close(pipefd[0]);
+    waitpid(pid, NULL, 0);
+    return n > 0 ? atoi(buf) : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <file> <keyword> [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *file = argv[1], *keyword = argv[2];
+    int iterations = argc > 3 ? atoi(argv[3]) : 200;
+    if (iterations < 1) iterations = 1;
+
+    int best = scan_simd_level();
+    const char *names[] = { "scalar", "sse2", "avx2" };
+
+    double start = now_us();
+    int expected = 0;
+    for (int i = 0; i < iterations; i++) expected = grep_count(file, keyword);
+    printf("%-8s %8d lines %10.1f us/call\n", "grep -c", expected, (now_us() - start) / iterations);
+
+    int mismatches = 0;
+    for (int level = SCAN_SIMD_SCALAR; level <= best; level++) {
+        scan_set_simd_level(level);
+        int count = 0;
+        start = now_us();
+        for (int i = 0; i < iterations; i++) count = scan_count_lines(file, keyword);
+        printf("%-8s %8d lines %10.1f us/call%s\n", names[level], count,
+               (now_us() - start) / iterations, count == expected ? "" : "  MISMATCH");
+        if (count != expected) mismatches++;
+    }
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#include "common.h"
+#include "vocab.h"
+#include <sys/mman.h>
+
+// Drives a running dserver with a mix of -a, -c, -l and -s requests from
+// several client processes, each speaking the FIFO protocol directly (one
+// response FIFO per request, like dclient, but without its fork + exec).
+// Prints throughput and latency percentiles per command and can append
+// the same numbers as one JSON line per run for tracking over time.
+
+enum { OP_ADD, OP_QUERY, OP_LINES, OP_SEARCH, OPS };
+static const char *op_names[OPS] = { "add", "query", "lines", "search" };
+static const char op_flags[] = "acls";    // option letter of each op
+
+typedef struct {
+    uint32_t usec;
+    uint8_t op;
+    uint8_t error;      // error reply or incomplete response
+} Sample;
+
+typedef struct {
+    int clients, requests;
+    int weights[OPS];
+    int docs, vocabulary, nproc;
+    uint64_t seed;
+} Config;
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// "a:5,c:50,l:20,s:25" -> weights; commands left out get 0
+static int parse_mix(const char *mix, int weights[OPS]) {
+    memset(weights, 0, OPS * sizeof(int));
+    int total = 0;
+    for (const char *p = mix; *p; ) {
+        const char *flag = strchr(op_flags, *p);
+        if (!flag || !*flag || p[1] != ':') return -1;
+        char *end;
+        long w = strtol(p + 2, &end, 10);
+        if (end == p + 2 || w < 0) return -1;
+        if (*end && *end != ',') return -1;
+        weights[flag - op_flags] = w;
+        total += w;
+        p = *end ? end + 1 : end;
+    }
+    return total > 0 ? 0 : -1;
+}
+
+// Sends one request and reads its whole response; returns 1 on an error
+// reply, -1 if the exchange itself failed
+static int request(int server, const char *fifo, CommandType command, const char *args) {
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = command;
+    snprintf(msg.client_fifo, sizeof(msg.client_fifo), "%s", fifo);
+    snprintf(msg.args, sizeof(msg.args), "%s", args);
+
+    if (mkfifo(fifo, 0666) == -1 && errno != EEXIST) return -1;
+    if (write(server, &msg, sizeof(msg)) != sizeof(msg)) {
+        unlink(fifo);
+        return -1;
+    }
+    int fd = open(fifo, O_RDONLY);
+    unlink(fifo);
+    if (fd == -1) return -1;
+
+    FrameHeader header;
+    char head[8] = {0}, buf[4096];
+    size_t seen = 0;
+    int complete = 0;
+    while (read_all(fd, &header, sizeof(header)) == 0) {
+        if (header.type == FRAME_END) {
+            complete = 1;
+            break;
+        }
+        for (uint32_t left = header.length; left > 0; ) {
+            size_t chunk = left < sizeof(buf) ? left : sizeof(buf);
+            if (read_all(fd, buf, chunk) == -1) break;
+            if (seen < 5) memcpy(head + seen, buf, chunk < 5 - seen ? chunk : 5 - seen);
+            seen += chunk;
+            left -= chunk;
+        }
+    }
+    close(fd);
+    if (!complete) return -1;
+    return strncmp(head, "Error", 5) == 0;
+}
+
+static void client_main(const Config *cfg, int client, Sample *samples) {
+    uint64_t state = cfg->seed * 0x9E3779B97F4A7C15ULL + client + 1;
+    double *cdf = vocab_zipf(cfg->vocabulary);
+    int server = open(FIFO_SERVER, O_WRONLY);
+    if (!cdf || server == -1) {
+        perror("bench_load client");
+        _exit(1);
+    }
+
+    int total = 0;
+    for (int op = 0; op < OPS; op++) total += cfg->weights[op];
+
+    char fifo[256], args[512], word[16];
+    for (int r = 0; r < cfg->requests; r++) {
+        int pick = vocab_rand(&state) % total, op = 0;
+        while (pick >= cfg->weights[op]) pick -= cfg->weights[op++];
+        int id = 1 + vocab_rand(&state) % cfg->docs;
+        vocab_word(vocab_pick(cdf, cfg->vocabulary, &state), word);
+
+        CommandType command;
+        switch (op) {
+            case OP_ADD:
+                command = CMD_ADD;
+                snprintf(args, sizeof(args), "Bench document %d|Bench|2025|bench_%d.txt", id, id);
+                break;
+            case OP_QUERY:
+                command = CMD_QUERY;
+                snprintf(args, sizeof(args), "%d", id);
+                break;
+            case OP_LINES:
+                command = CMD_LINE_COUNT;
+                snprintf(args, sizeof(args), "%d|%s", id, word);
+                break;
+            default:
+                command = CMD_SEARCH;
+                if (cfg->nproc > 0) snprintf(args, sizeof(args), "%s|%d", word, cfg->nproc);
+                else snprintf(args, sizeof(args), "%s", word);
+                break;
+        }
+
+        snprintf(fifo, sizeof(fifo), "/tmp/docindex_bench_%d_%d", getpid(), r);
+        double start = now_us();
+        int rc = request(server, fifo, command, args);
+        double usec = now_us() - start;
+        samples[r].usec = usec > UINT32_MAX ? UINT32_MAX : (uint32_t)usec;
+        samples[r].op = op;
+        samples[r].error = rc != 0;
+    }
+    close(server);
+    _exit(0);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint32_t *sorted, int n, double p) {
+    if (n == 0) return 0;
+    int rank = (int)(p * n + 0.999999);
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1] / 1e3;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]   (dserver must be running)\n", prog);
+    fprintf(stderr, "  --clients=N      client processes (default: 4)\n");
+    fprintf(stderr, "  --requests=N     requests per client (default: 1000)\n");
+    fprintf(stderr, "  --mix=SPEC       command weights, e.g. a:5,c:50,l:20,s:25 (default)\n");
+    fprintf(stderr, "  --docs=N         ids used by -c/-l and corpus files re-added by -a (default: 1000)\n");
+    fprintf(stderr, "  --vocabulary=N   corpus vocabulary, for -l/-s keywords (default: 5000)\n");
+    fprintf(stderr, "  --nproc=N        processes per -s (default: server's)\n");
+    fprintf(stderr, "  --seed=N         random seed (default: 1)\n");
+    fprintf(stderr, "  --label=TEXT     run name stored in the JSON line\n");
+    fprintf(stderr, "  --out=FILE       append the results to FILE as one JSON line\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    Config cfg = { 4, 1000, { 0 }, 1000, 5000, 0, 1 };
+    const char *mix = "a:5,c:50,l:20,s:25", *label = "", *out = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--clients=", 10) == 0) cfg.clients = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--requests=", 11) == 0) cfg.requests = atoi(argv[i] + 11);
+        else if (strncmp(argv[i], "--mix=", 6) == 0) mix = argv[i] + 6;
+        else if (strncmp(argv[i], "--docs=", 7) == 0) cfg.docs = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--vocabulary=", 13) == 0) cfg.vocabulary = atoi(argv[i] + 13);
+        else if (strncmp(argv[i], "--nproc=", 8) == 0) cfg.nproc = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--seed=", 7) == 0) cfg.seed = strtoull(argv[i] + 7, NULL, 10);
+        else if (strncmp(argv[i], "--label=", 8) == 0) label = argv[i] + 8;
+        else if (strncmp(argv[i], "--out=", 6) == 0) out = argv[i] + 6;
+        else usage(argv[0]);
+    }
+    if (cfg.clients < 1 || cfg.requests < 1 || cfg.docs < 1 || cfg.vocabulary < 1 ||
+        parse_mix(mix, cfg.weights) == -1) {
+        usage(argv[0]);
+    }
+
+    // Each client fills its own slice; the parent reads them after waitpid
+    size_t n = (size_t)cfg.clients * cfg.requests;
+    Sample *samples = mmap(NULL, n * sizeof(Sample), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    double start = now_us();
+    for (int c = 0; c < cfg.clients; c++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) client_main(&cfg, c, samples + (size_t)c * cfg.requests);
+    }
+    int failed = 0, status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    double seconds = (now_us() - start) / 1e6;
+    if (failed) {
+        fprintf(stderr, "Error: %d client(s) failed; is dserver running?\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t *lat = malloc(n * sizeof(uint32_t));
+    if (!lat) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    FILE *json = NULL;
+    if (out && !(json = fopen(out, "a"))) perror(out);
+    if (json) {
+        fprintf(json, "{\"label\":\"%s\",\"time\":%ld,\"clients\":%d,\"requests\":%d,\"mix\":\"%s\","
+                "\"docs\":%d,\"vocabulary\":%d,\"seconds\":%.3f,\"throughput\":%.1f,\"ops\":{",
+                label, (long)time(NULL), cfg.clients, cfg.requests, mix, cfg.docs, cfg.vocabulary,
+                seconds, n / seconds);
+    }
+
+    printf("%d clients x %d requests in %.2f s: %.1f requests/s\n", cfg.clients, cfg.requests, seconds, n / seconds);
+    printf("%-8s %8s %7s %10s %10s %10s %10s %10s %10s\n",
+           "Command", "Count", "Errors", "req/s", "Mean(ms)", "p50", "p95", "p99", "Max");
+    for (int op = 0, first = 1; op < OPS; op++) {
+        int count = 0, errors = 0;
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (samples[i].op != op) continue;
+            lat[count++] = samples[i].usec;
+            errors += samples[i].error;
+            sum += samples[i].usec;
+        }
+        if (count == 0) continue;
+        qsort(lat, count, sizeof(uint32_t), compare_u32);
+
+        double mean = sum / count / 1e3, p50 = percentile(lat, count, 0.50),
+               p95 = percentile(lat, count, 0.95), p99 = percentile(lat, count, 0.99),
+               max = lat[count - 1] / 1e3;
+        printf("%-8s %8d %7d %10.1f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+               op_names[op], count, errors, count / seconds, mean, p50, p95, p99, max);
+        if (json) {
+            fprintf(json, "%s\"%s\":{\"count\":%d,\"errors\":%d,\"mean_ms\":%.3f,\"p50_ms\":%.3f,"
+                    "\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+                    first ? "" : ",", op_names[op], count, errors, mean, p50, p95, p99, max);
+            first = 0;
+        }
+    }
+    if (json) {
+        fprintf(json, "}}\n");
+        fclose(json);
+    }
+
+    free(lat);
+    munmap(samples, n * sizeof(Sample));
+    return EXIT_SUCCESS;
+}
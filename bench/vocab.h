@@ -0,0 +1,60 @@
+#ifndef BENCH_VOCAB_H
+#define BENCH_VOCAB_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Synthetic vocabulary shared by the corpus and load generators, so the
+// load generator searches for words that the corpus actually contains.
+// Word ranks follow a Zipf distribution (s = 1), like natural text: a few
+// words are in nearly every document, most are rare.
+
+// Word i: two-letter syllables spelling i + 100 in base 100, so every rank
+// gets a distinct lowercase word of at least two syllables
+static inline void vocab_word(unsigned i, char out[16]) {
+    static const char consonants[] = "bcdfghjklmnpqrstvwxz";
+    static const char vowels[] = "aeiou";
+    char rev[16];
+    int n = 0;
+    for (unsigned v = i + 100; v > 0; v /= 100) {
+        rev[n++] = vowels[v % 100 % 5];
+        rev[n++] = consonants[v % 100 / 5];
+    }
+    for (int k = 0; k < n; k++) out[k] = rev[n - 1 - k];
+    out[n] = '\0';
+}
+
+// xorshift64*: cheap and good enough for picking words and commands
+static inline uint64_t vocab_rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static inline double vocab_uniform(uint64_t *state) {
+    return (vocab_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Cumulative Zipf weights over `size` ranks; NULL on allocation failure
+static inline double *vocab_zipf(int size) {
+    double *cdf = malloc(size * sizeof(double));
+    if (!cdf) return NULL;
+    double sum = 0;
+    for (int r = 0; r < size; r++) cdf[r] = sum += 1.0 / (r + 1);
+    for (int r = 0; r < size; r++) cdf[r] /= sum;
+    return cdf;
+}
+
+static inline int vocab_pick(const double *cdf, int size, uint64_t *state) {
+    double u = vocab_uniform(state);
+    int lo = 0, hi = size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+#endif
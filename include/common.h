@@ -12,9 +12,16 @@
 #include <time.h>
 #include <errno.h>
 #include <dirent.h>
+#include <stdint.h>
 
 #define FIFO_SERVER "/tmp/docindex_server_fifo"
-#define MAX_DOCUMENTS 2500
+#define INDEX_FILE_BIN "data/index.bin"
+#define INDEX_FILE_TEXT "data/index.txt"
+#define POSTINGS_FILE "data/postings.txt"
+#define JOURNAL_FILE "data/index.log"
+#define CACHE_SNAPSHOT_FILE "data/cache_snapshot.txt"
+#define CACHE_SNAPSHOT_VERSION 2
+#define JOURNAL_COMPACT_MIN 1024
 #define MAX_TITLE 200
 #define MAX_AUTHORS 200
 #define MAX_YEAR 4
@@ -29,26 +36,45 @@ typedef enum {
     CMD_REMOVE,
     CMD_LINE_COUNT,
     CMD_SEARCH,
-    CMD_SHUTDOWN
+    CMD_SHUTDOWN,
+    CMD_ADD_BATCH,
+    CMD_SESSION,
+    CMD_STATS,
+    CMD_STATUS
 } CommandType;
 
+// Strings live in the mapped index file or in the document table's string
+// pool, and stay valid until the document is removed
 typedef struct {
     int id;
-    char title[MAX_TITLE+1];
-    char authors[MAX_AUTHORS+1];
-    char year[MAX_YEAR+1];
-    char path[MAX_PATH+1];
+    const char *title;
+    const char *authors;
+    const char *year;
+    const char *path;
 } DocumentMeta;
 
 typedef struct {
     CommandType command;
     char client_fifo[256];
     char args[512];
+    uint32_t seq;       // request number within a session, echoed in its frames
+    int session;        // set by the server: 0 = one-shot request
+    int shm_slot;       // set by the server: shared-memory slot + 1, 0 = FIFO
 } Message;
 
+// Responses are streamed as frames: any number of FRAME_DATA frames, each
+// followed by `length` payload bytes, then one FRAME_END frame. In a session
+// frames of different requests interleave and are told apart by seq.
+#define FRAME_DATA 1
+#define FRAME_END 2
+
 typedef struct {
-    int id;
-    DocumentMeta meta;
-} CacheEntry;
+    uint32_t type;
+    uint32_t length;
+    uint32_t seq;
+} FrameHeader;
+
+int write_all(int fd, const void *buf, size_t len);
+int read_all(int fd, void *buf, size_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef DOCCACHE_H
+#define DOCCACHE_H
+
+#include <stdio.h>
+
+// Document contents kept mapped between scans, keyed by path, up to a byte
+// budget. An entry is reused only while the file's size, mtime and inode
+// match what was mapped.
+
+#define DOCCACHE_DEFAULT_MB 64
+
+typedef struct DocCacheEntry DocCacheEntry;
+
+void doccache_init(size_t budget_bytes);
+DocCacheEntry *doccache_open(const char *path, const char **data, size_t *size);
+void doccache_close(DocCacheEntry *entry);
+void doccache_print_stats(FILE *out, const char *scope);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef DOCSET_H
+#define DOCSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A sorted set of document IDs, stored compressed in whichever of two
+// encodings is smaller:
+//   delta   blocks of up to DOCSET_BLOCK IDs: the first ID of each block,
+//           its byte offset and its index form a skip table, the rest are
+//           varint gaps. Inserting or removing an ID re-encodes only its
+//           block (splitting it when full); the bytes after it shift.
+//   bitmap  one bit per ID from a 64-aligned base, for dense sets
+// IDs are addressed by their index in the set (the posting number), so
+// data kept alongside in parallel arrays stays aligned with them.
+
+#define DOCSET_BLOCK 128
+#define DOCSET_DELTA 0
+#define DOCSET_BITMAP 1
+
+typedef struct {
+    int first;          // first ID of the block
+    uint32_t offset;    // its gaps start at bytes[offset]
+    int start;          // index of its first ID in the set
+} DocSetBlock;
+
+typedef struct {
+    int count;
+    int last;           // highest ID, 0 when empty
+    int type;
+    // delta
+    DocSetBlock *blocks;
+    int block_count, block_cap;
+    unsigned char *bytes;
+    uint32_t used, cap;
+    // bitmap
+    int base;           // ID of bit 0 of words[0]
+    uint64_t *words;
+    int word_count, word_cap;
+} DocSet;
+
+// Walks a set in ascending order; id is INT_MAX once index reaches count
+typedef struct {
+    const DocSet *set;
+    int index;
+    int id;
+    int block;                  // delta: current block
+    int block_end;              // delta: index where the next block starts
+    const unsigned char *p;     // delta: next gap
+    int word;                   // bitmap: current word
+    uint64_t bits;              // bitmap: its bits from the current ID up
+} DocSetCursor;
+
+void docset_init(DocSet *s);
+void docset_free(DocSet *s);
+int docset_insert(DocSet *s, int id);       // index of id, -1 if present, -2 out of memory
+int docset_remove(DocSet *s, int id);       // index id had, -1 if absent
+int docset_find(const DocSet *s, int id);   // index of id, -1 if absent
+void docset_cursor(DocSetCursor *c, const DocSet *s);
+void docset_next(DocSetCursor *c);
+void docset_seek(DocSetCursor *c, int id);  // first ID >= id, never moving back
+int docset_decode(const DocSet *s, int *out);
+void docset_or(const DocSet *s, uint64_t *bits);   // bits has room for last
+// Keep the IDs of the ascending list ids[0..n) that are (intersect) or are
+// not (difference) in s; out may alias ids. Returns how many.
+int docset_intersect(const DocSet *s, const int *ids, int n, int *out);
+int docset_difference(const DocSet *s, const int *ids, int n, int *out);
+size_t docset_bytes(const DocSet *s);
+
+#endif
@@ -1,18 +1,42 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include "postings.h"
+
 extern char document_folder[256];
 
+// A document read and tokenized ahead of insertion
+typedef struct {
+    char title[MAX_TITLE + 1];
+    char authors[MAX_AUTHORS + 1];
+    char year[MAX_YEAR + 1];
+    char path[MAX_PATH + 1];
+    PostingsTerms terms;
+} PreparedDocument;
+
 int index_add(const char *title, const char *authors, const char *year, const char *path);
-DocumentMeta* index_query(int id);
+int index_prepare(PreparedDocument *doc, const char *year, const char *path);
+int index_add_prepared(PreparedDocument *doc);
+int index_reserve_id();
+int index_add_prepared_as(PreparedDocument *doc, int id);
+DocumentMeta* index_query(int id, DocumentMeta *out);
 int index_remove(int id);
 int index_load(const char *filename);
 int index_save(const char *filename);
 int index_total();
-DocumentMeta* index_get(int i);
+DocumentMeta* index_get(int i, DocumentMeta *out);
 int index_save(const char *filename);
 int index_load(const char *filename);
 int index_get_count();
+int index_contains(int id);
+void cache_export_snapshot(const char *filename);
+int cache_import_snapshot(const char *filename);
+void index_compact();
+void index_maintenance();
+int index_persist(const char *filename, int mutations);
+void index_read_lock();
+void index_write_lock();
+void index_unlock();
 int extract_metadata(const char *filepath, char *title, size_t max_title, char *author, size_t max_author);
 
 #endif
\ No newline at end of file
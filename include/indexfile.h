@@ -0,0 +1,47 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include <stdint.h>
+
+// Binary index file: header, fixed-stride records, then a heap of
+// NUL-terminated strings referenced by offset; records with equal strings
+// share one copy. Mapped read-only at startup.
+
+#define INDEXFILE_MAGIC "DIDX"
+#define INDEXFILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t record_size;
+    uint32_t next_id;
+    uint32_t heap_offset;
+    uint32_t heap_size;
+    uint32_t reserved;
+} IndexFileHeader;
+
+typedef struct {
+    int32_t id;
+    uint32_t title;         // heap offsets
+    uint32_t authors;
+    uint32_t path;
+    char year[8];
+} IndexRecord;
+
+typedef struct {
+    void *base;
+    size_t size;
+    const IndexFileHeader *header;
+    const IndexRecord *records;
+    const char *heap;
+} IndexFile;
+
+int indexfile_open(const char *filename, IndexFile *file);
+void indexfile_close(IndexFile *file);
+// Entry i of the table being written, or NULL for a removed slot
+typedef DocumentMeta *(*indexfile_get_fn)(int i, DocumentMeta *out);
+
+int indexfile_write(const char *filename, indexfile_get_fn get, int count, int next_id);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+// Asynchronous adds (--ingest=async). An add only reserves its ID and joins
+// a queue, and is answered at once. A background thread reads and tokenizes
+// the queued files, then inserts a batch of them under one write lock and
+// persists once per batch. Reserved IDs are queued and inserted in order,
+// so the document table stays in ID order.
+
+#define INGEST_QUEUE_SIZE 1024
+#define INGEST_BATCH 64
+
+#define INGEST_UNKNOWN 0        // never queued, or removed since
+#define INGEST_PENDING 1
+#define INGEST_INDEXED 2
+#define INGEST_FAILED 3         // the file could not be read or inserted
+
+int ingest_start(const char *index_file);
+int ingest_enabled();
+int ingest_submit(const char *year, const char *path);
+int ingest_cancel(int id);
+int ingest_status(int id);
+int ingest_pending();
+void ingest_drain();
+void ingest_stop();
+
+#endif
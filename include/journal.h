@@ -0,0 +1,23 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// Append-only write-ahead log of index mutations.
+// Each record is one line: "<crc32 hex>|<payload>\n".
+
+#define JOURNAL_SYNC_NONE 0     // leave flushing to the kernel
+#define JOURNAL_SYNC_GROUP 1    // fsync every group_size records (or when idle)
+#define JOURNAL_SYNC_ALWAYS 2   // fsync after every record
+
+typedef void (*journal_apply_fn)(const char *payload);
+
+int journal_open(const char *filename, int sync_policy, int group_size);
+void journal_close();
+int journal_enabled();
+int journal_append(const char *payload);
+int journal_commit();
+int journal_flush();
+int journal_replay(const char *filename, journal_apply_fn apply);
+int journal_reset();
+int journal_records();
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef METACACHE_H
+#define METACACHE_H
+
+#include "common.h"
+
+// Metadata of recently queried documents (id -> DocumentMeta), up to a fixed
+// number of entries. The strings are the index's own: entries stay valid for
+// as long as the document is in the index, and removal drops them.
+//
+// Two eviction policies:
+//   lru      every miss is inserted, the least recently used entry leaves
+//   tinylfu  W-TinyLFU: misses enter a small LRU window; an entry leaving
+//            the window only replaces the main LRU victim if a frequency
+//            sketch has seen it more often, so a sweep of one-off lookups
+//            cannot flush the hot set
+
+#define METACACHE_LRU 0
+#define METACACHE_TINYLFU 1
+
+void metacache_init(int capacity, int policy);
+int metacache_policy(const char *name);         // -1 if unknown
+const char *metacache_policy_name();
+int metacache_capacity();
+int metacache_get(int id, DocumentMeta *out);   // 1 on hit
+void metacache_put(int id, const DocumentMeta *meta);
+void metacache_remove(int id);
+// Entries from most to least recently used, window first
+void metacache_foreach(void (*visit)(int id, const DocumentMeta *meta, void *arg), void *arg);
+void metacache_counts(long *hits, long *misses, long *rejected);
+// Appends the ID of every lookup to path, for bench_cache_replay
+int metacache_trace(const char *path);
+void metacache_print_stats(FILE *out);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stdint.h>
+
+// Inverted index: term -> sorted set of document IDs, each with the token
+// positions of the term in that document (delta-encoded varints). The ID
+// sets are stored compressed (see docset.h).
+// Terms are maximal runs of alphanumeric (or non-ASCII) bytes, case-sensitive.
+// Documents with identical content (same 64-bit hash and length) are
+// indexed once, under the lowest of their IDs; every result that includes
+// that ID also lists the others.
+
+// Positions of one term in one document, delta/varint encoded
+typedef struct {
+    unsigned char *data;
+    int len, cap;
+    int last;           // last position added
+} PostingsPositions;
+
+// Distinct terms of one document, NUL-separated in text in first-seen order
+typedef struct {
+    char *text;
+    int len, cap;
+    int count;
+    int *set;           // dedup hash: term number + 1, 0 = empty
+    int set_size;
+    int *offsets;       // term number -> offset in text
+    PostingsPositions *positions;   // term number -> its token positions
+    int terms_cap;
+    int tokens;         // tokens in the document
+    uint64_t hash;      // content fingerprint, with size
+    uint64_t size;
+    int twin;           // content already indexed under this ID: not tokenized
+} PostingsTerms;
+
+// Phrases and NEAR operands of up to this many tokens
+#define POSTINGS_PHRASE_MAX 32
+
+typedef struct {
+    int id;
+    double score;
+} PostingsHit;
+
+typedef struct PostingsMatch PostingsMatch;
+
+int postings_tokenize(const char *fullpath, PostingsTerms *dt);
+int postings_add_terms(int id, const PostingsTerms *dt);
+void postings_terms_free(PostingsTerms *dt);
+int postings_add_document(int id, const char *fullpath);
+void postings_remove_document(int id);
+int postings_is_indexable(const char *keyword);
+int postings_is_phrase(const char *keyword);
+int postings_search(const char *keyword, int **ids, int *count);
+// Tests ascending IDs against a keyword without listing its documents
+PostingsMatch *postings_match_open(const char *keyword, long *cost);
+int postings_match_filter(PostingsMatch *m, int *ids, int n, int keep);
+void postings_match_close(PostingsMatch *m);
+int postings_phrase_search(const char *phrase, int **ids, int *count);
+int postings_near_search(const char *left, const char *right, int distance, int **ids, int *count);
+int postings_rank(const char *keyword, int k, PostingsHit *hits);
+int postings_expand(int **ids, int *count);
+int postings_is_twin(int id);
+int postings_twin_count();
+int postings_find_content(uint64_t hash, uint64_t size);
+int postings_body_count();
+int postings_save(const char *filename, int doc_count, int next_id);
+int postings_load(const char *filename, int doc_count, int next_id);
+void postings_clear();
+int postings_term_count();
+// Postings held and bytes their compressed ID sets take; bitmaps is the
+// number of terms whose set is a bitmap
+void postings_id_usage(long *postings, long *bytes, int *bitmaps);
+
+#endif
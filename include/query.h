@@ -0,0 +1,43 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+
+// Boolean search queries: terms combined with AND, OR, NOT and parentheses,
+// e.g. "Romeo AND (Juliet OR Tybalt) AND NOT Paris". Adjacent terms are
+// ANDed. Each term has the same meaning as a single -s keyword; the
+// operators work on the sorted id lists of the terms. A term may also be a
+// "quoted phrase", and `a NEAR/k b` (a and b words or phrases) matches
+// documents where the two occur within k tokens of each other.
+
+// Sorted ids of the documents matching one term; 0 on success
+typedef int (*query_term_fn)(const char *term, void *ctx, int **ids, int *count);
+// Sorted ids of the documents where left and right are at most distance tokens apart
+typedef int (*query_near_fn)(const char *left, const char *right, int distance, void *ctx,
+                             int **ids, int *count);
+// Sorted ids of every live document, the universe NOT complements against
+typedef int (*query_all_fn)(void *ctx, int **ids, int *count);
+
+// A term the caller can test ids against without listing its documents,
+// so that an AND lists only its cheapest operand
+typedef struct {
+    long cost;              // documents the term would list, about
+    void *state;
+    // Keeps the ascending ids that match (keep = 1) or those that do not
+    // (keep = 0); returns how many are left
+    int (*filter)(void *state, int *ids, int n, int keep);
+    void (*close)(void *state);
+} QueryFilter;
+// 0 with f filled in, -1 if the term has to be listed with query_term_fn
+typedef int (*query_filter_fn)(const char *term, void *ctx, QueryFilter *f);
+
+int query_is_boolean(const char *text);
+// filter may be NULL
+int query_evaluate(const char *text, query_term_fn term, query_near_fn near, query_all_fn all,
+                   query_filter_fn filter, void *ctx, int **ids, int *count, char *error, size_t error_size);
+
+int ids_intersect(const int *a, int na, const int *b, int nb, int *out);
+int ids_union(const int *a, int na, const int *b, int nb, int *out);
+int ids_difference(const int *a, int na, const int *b, int nb, int *out);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <stdio.h>
+
+// Search results (keyword -> matching ids) kept up to a byte budget.
+// Every add/remove advances the index generation and is logged; a cached
+// result from an older generation is brought up to date by replaying the
+// log against it, testing only the documents added since.
+
+#define RESULTCACHE_DEFAULT_KB 4096
+
+// 1 if the document at path (relative to the document folder) matches
+typedef int (*resultcache_match_fn)(const char *path, const char *keyword);
+
+void resultcache_init(size_t budget_bytes, resultcache_match_fn match);
+void resultcache_note_add(int id, const char *path);
+void resultcache_note_remove(int id);
+int resultcache_get(const char *keyword, int **ids, int *count);
+void resultcache_put(const char *keyword, const int *ids, int count);
+void resultcache_counts(long *hits, long *misses);
+void resultcache_print_stats(FILE *out);
+
+#endif
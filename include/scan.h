@@ -0,0 +1,19 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+// In-process equivalents of the grep invocations used by the server.
+// Keywords are basic regular expressions, as with grep; keywords without
+// regex metacharacters take a plain substring search.
+
+// Substring search for -l: SSE2/AVX2 on x86 when the CPU has them
+#define SCAN_SIMD_SCALAR 0
+#define SCAN_SIMD_SSE2 1
+#define SCAN_SIMD_AVX2 2
+
+int scan_is_fixed(const char *keyword);
+int scan_file_contains(const char *fullpath, const char *keyword);
+int scan_count_lines(const char *fullpath, const char *keyword);
+int scan_simd_level();
+void scan_set_simd_level(int level);
+
+#endif
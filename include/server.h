@@ -1,12 +1,30 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-void send_response(const char *client_fifo, const char *response);
+typedef struct Session Session;
+
+#define SHM_RESPONSE -2
+
+typedef struct {
+    int fd;             // -1 once closed, SHM_RESPONSE on shared memory
+    Session *session;   // NULL for one-shot requests
+    int shm_slot;       // shared-memory slot + 1, 0 = FIFO
+    uint32_t seq;
+} Response;
+
+int response_open(Response *r, const Message *msg);
+int response_write(Response *r, const char *data, size_t len);
+void response_close(Response *r);
+void send_response(const Message *msg, const char *response);
 void handle_add(Message *msg);
 void handle_query(Message *msg);
 void handle_remove(Message *msg);
 void handle_line_count(Message *msg);
 void handle_search(Message *msg);
 void handle_shutdown(Message *msg);
+void handle_add_batch(Message *msg);
+void handle_session(Message *msg);
+void handle_stats(Message *msg);
+void handle_status(Message *msg);
 
 #endif
\ No newline at end of file
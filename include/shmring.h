@@ -0,0 +1,45 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include "common.h"
+
+// Optional shared-memory transport for one-shot requests (dserver --shm).
+// The server maps one POSIX shared-memory segment split into slots; a
+// client claims a free slot, leaves its Message in the slot's request
+// mailbox and rings the segment's doorbell. The response frames (the same
+// FrameHeader + payload stream as on a FIFO) are written once into the
+// slot's single-producer/single-consumer byte ring and read in place.
+// Both sides sleep on futexes in the segment and only make a system call
+// to wake the other when it is actually waiting.
+// The segment is private to the server's user (mode 0600); other clients,
+// and any client when there is no segment or no free slot, use the FIFOs.
+
+#define SHM_NAME "/docindex_shm"
+#define SHM_SLOTS 64
+#define SHM_RING (256 * 1024)   // response bytes in flight per client
+
+typedef struct ShmSegment ShmSegment;
+typedef struct ShmSlot ShmSlot;
+
+typedef struct {
+    ShmSegment *segment;
+    ShmSlot *slot;
+} ShmClient;
+
+// Client side
+int shm_client_open(ShmClient *c);                      // 0, or -1: use the FIFOs
+int shm_client_send(ShmClient *c, const Message *msg);
+int shm_client_read(ShmClient *c, void *buf, size_t len);
+// Waits for response bytes and points data at up to max of them inside the
+// ring; 0 if the server went away. Release them with shm_client_consume().
+size_t shm_client_peek(ShmClient *c, const char **data, size_t max);
+void shm_client_consume(ShmClient *c, size_t len);
+void shm_client_close(ShmClient *c);
+
+// Server side: requests are handed to deliver() with msg->shm_slot set
+int shm_server_start(void (*deliver)(const Message *msg));
+int shm_server_write(int slot, const void *data, size_t len);   // -1 if the client is gone
+void shm_server_done(int slot);
+void shm_server_stop();
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Live server counters and per-command latency histograms. Every update is
+// a relaxed atomic add, so they are kept on the request path at all times.
+// Latencies fall into fixed log-linear buckets (8 per power of two, exact
+// below 16 us): percentiles are reported within 12.5%.
+
+typedef enum {
+    STAT_BYTES_SCANNED,     // document bytes read by -l and -s scans
+    STAT_FORKS,             // search worker processes started
+    STAT_COUNTERS
+} StatCounter;
+
+void stats_init();
+uint64_t stats_now_us();
+void stats_count(StatCounter counter, uint64_t n);
+uint64_t stats_get(StatCounter counter);
+void stats_record(CommandType command, uint64_t usec);
+int stats_format(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Interned strings for the document table: each distinct string is stored
+// once, reference counted, in chunks that never move, so a pointer from
+// strpool_get() stays valid while a reference is held. Handles are 32 bits;
+// 0 is never a valid handle. The space of a released string is reused by
+// the next string of the same size class.
+
+#define STRPOOL_MAX_LEN 511
+
+uint32_t strpool_intern(const char *s, size_t len);
+void strpool_release(uint32_t handle);
+const char *strpool_get(uint32_t handle);
+void strpool_print_stats(FILE *out);
+
+#endif
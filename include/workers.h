@@ -0,0 +1,20 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+// Pool of long-lived search processes started at boot. Requests and replies
+// travel over one pipe pair per worker; no process is created per search.
+
+typedef struct {
+    int id;
+    char fullpath[MAX_PATH + 256];
+} SearchItem;
+
+int workers_start(int count);
+void workers_stop();
+int workers_count();
+typedef void (*workers_emit_fn)(const int *ids, int count, void *ctx);
+
+int workers_search(const char *keyword, const SearchItem *items, int n, int batches,
+                   workers_emit_fn emit, void *ctx);
+
+#endif
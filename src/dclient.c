@@ -1,19 +1,318 @@
 #include "common.h"
 #include "client.h"
+#include "shmring.h"
+#include <pthread.h>
 
 void usage(const char *prog) {
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "  %s -a \"title\" \"authors\" \"year\" \"path\"\n", prog);
+    fprintf(stderr, "  %s -A [manifest|-]   (lines: title|authors|year|path, default stdin)\n", prog);
     fprintf(stderr, "  %s -c \"key\"\n", prog);
     fprintf(stderr, "  %s -d \"key\"\n", prog);
     fprintf(stderr, "  %s -l \"key\" \"keyword\"\n", prog);
     fprintf(stderr, "  %s -s \"keyword\" [nr_processes]\n", prog);
+    fprintf(stderr, "  %s -s \"words\" --top K          (K best documents by BM25, with scores)\n", prog);
+    fprintf(stderr, "  %s -s \"term AND (term OR term) AND NOT term\" [nr_processes]\n", prog);
+    fprintf(stderr, "  %s -s '\"a phrase\"' | -s \"term NEAR/k term\" [nr_processes]\n", prog);
     fprintf(stderr, "  %s -f\n", prog);
+    fprintf(stderr, "  %s --status \"key\"     (pending, indexed or failed, for adds with --ingest=async)\n", prog);
+    fprintf(stderr, "  %s --stats            (request counts, latency percentiles, cache hit ratios)\n", prog);
+    fprintf(stderr, "  %s --session          (one command per stdin line, e.g. -c 3)\n", prog);
     exit(EXIT_FAILURE);
 }
 
+// Fills msg from a one-shot command line (argv[1] is the option)
+static int build_message(int argc, char *argv[], Message *msg) {
+    if (strcmp(argv[1], "-a") == 0 && argc == 6) {
+        msg->command = CMD_ADD;
+        if (snprintf(msg->args, sizeof(msg->args), "%s|%s|%s|%s", 
+                argv[2], argv[3], argv[4], argv[5]) >= sizeof(msg->args)) {
+            fprintf(stderr, "Error: Arguments too long\n");
+            return -1;
+        }
+    } else if (strcmp(argv[1], "-c") == 0 && argc == 3) {
+        msg->command = CMD_QUERY;
+        if (snprintf(msg->args, sizeof(msg->args), "%s", argv[2]) >= sizeof(msg->args)) {
+            fprintf(stderr, "Error: Key too long\n");
+            return -1;
+        }
+    } else if (strcmp(argv[1], "-d") == 0 && argc == 3) {
+        msg->command = CMD_REMOVE;
+        if (snprintf(msg->args, sizeof(msg->args), "%s", argv[2]) >= sizeof(msg->args)) {
+            fprintf(stderr, "Error: Key too long\n");
+            return -1;
+        }
+    } else if (strcmp(argv[1], "-l") == 0 && argc == 4) {
+        msg->command = CMD_LINE_COUNT;
+        if (snprintf(msg->args, sizeof(msg->args), "%s|%s", argv[2], argv[3]) >= sizeof(msg->args)) {
+            fprintf(stderr, "Error: Arguments too long\n");
+            return -1;
+        }
+    } else if (strcmp(argv[1], "-s") == 0 && argc >= 3 && argc <= 6) {
+        msg->command = CMD_SEARCH;
+        const char *nproc = NULL, *top = NULL;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--top") == 0 && i + 1 < argc && !top) top = argv[++i];
+            else if (!nproc) nproc = argv[i];
+            else return -2;
+        }
+        if (top && atoi(top) <= 0) {
+            fprintf(stderr, "Error: --top needs a positive count\n");
+            return -1;
+        }
+        // "keyword|nproc|K"; 0 processes means the default
+        int len = top ? snprintf(msg->args, sizeof(msg->args), "%s|%s|%d", argv[2], nproc ? nproc : "0", atoi(top))
+                : nproc ? snprintf(msg->args, sizeof(msg->args), "%s|%s", argv[2], nproc)
+                : snprintf(msg->args, sizeof(msg->args), "%s", argv[2]);
+        if (len >= (int)sizeof(msg->args)) {
+            fprintf(stderr, "Error: Arguments too long\n");
+            return -1;
+        }
+    } else if (strcmp(argv[1], "-f") == 0 && argc == 2) {
+        msg->command = CMD_SHUTDOWN;
+    } else if (strcmp(argv[1], "--stats") == 0 && argc == 2) {
+        msg->command = CMD_STATS;
+    } else if (strcmp(argv[1], "--status") == 0 && argc == 3) {
+        msg->command = CMD_STATUS;
+        if (snprintf(msg->args, sizeof(msg->args), "%s", argv[2]) >= (int)sizeof(msg->args)) {
+            fprintf(stderr, "Error: Key too long\n");
+            return -1;
+        }
+    } else {
+        return -2;
+    }
+    return 0;
+}
+
+// Splits a session line into words; double quotes group words with spaces
+static int split_line(char *line, char *argv[], int max) {
+    int argc = 0;
+    char *p = line;
+    while (*p && argc < max) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        if (*p == '"') {
+            argv[argc++] = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            argv[argc++] = p;
+            while (*p && *p != ' ' && *p != '\t') p++;
+        }
+        if (*p) *p++ = '\0';
+    }
+    return argc;
+}
+
+// Response of a request that finished (or started) ahead of its turn
+typedef struct {
+    uint32_t seq;
+    char *data;
+    size_t len, cap;
+    int done;
+} PendingResponse;
+
+typedef struct {
+    int fd;
+    PendingResponse *pending;
+    int count, cap;
+} SessionReader;
+
+static PendingResponse *pending_find(SessionReader *r, uint32_t seq, int create) {
+    for (int i = 0; i < r->count; i++) {
+        if (r->pending[i].seq == seq) return &r->pending[i];
+    }
+    if (!create) return NULL;
+    if (r->count == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 16;
+        PendingResponse *grown = realloc(r->pending, cap * sizeof(PendingResponse));
+        if (!grown) return NULL;
+        r->pending = grown;
+        r->cap = cap;
+    }
+    PendingResponse *p = &r->pending[r->count++];
+    memset(p, 0, sizeof(*p));
+    p->seq = seq;
+    return p;
+}
+
+static void pending_drop(SessionReader *r, PendingResponse *p) {
+    free(p->data);
+    *p = r->pending[--r->count];
+}
+
+// Prints responses in request order. Frames of the request whose turn it is
+// go straight to stdout; others are held until every earlier one is done.
+static void *session_reader(void *arg) {
+    SessionReader *r = arg;
+    uint32_t next = 1;
+    int got_data = 0;
+    FrameHeader header;
+    char buf[RESPONSE_SIZE];
+
+    while (read_all(r->fd, &header, sizeof(header)) == 0) {
+        PendingResponse *p = header.seq == next ? NULL : pending_find(r, header.seq, 1);
+        for (uint32_t left = header.length; left > 0; ) {
+            size_t chunk = left < sizeof(buf) ? left : sizeof(buf);
+            if (read_all(r->fd, buf, chunk) == -1) return NULL;
+            left -= chunk;
+            if (!p) {
+                fwrite(buf, 1, chunk, stdout);
+                got_data = 1;
+                continue;
+            }
+            if (p->len + chunk > p->cap) {
+                size_t cap = p->cap ? p->cap * 2 : 4096;
+                while (cap < p->len + chunk) cap *= 2;
+                char *grown = realloc(p->data, cap);
+                if (!grown) return NULL;
+                p->data = grown;
+                p->cap = cap;
+            }
+            memcpy(p->data + p->len, buf, chunk);
+            p->len += chunk;
+        }
+
+        if (header.type == FRAME_END) {
+            if (p) {
+                p->done = 1;
+            } else {
+                if (got_data) printf("\n");
+                got_data = 0;
+                // Catch up on requests that were waiting for this one
+                while ((p = pending_find(r, ++next, 0)) != NULL) {
+                    fwrite(p->data, 1, p->len, stdout);
+                    got_data = p->len > 0;
+                    int done = p->done;
+                    pending_drop(r, p);
+                    if (!done) break;
+                    if (got_data) printf("\n");
+                    got_data = 0;
+                }
+            }
+        }
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+// Opens one request/response FIFO pair and sends every stdin line through
+// it without waiting for replies
+static int run_session(const char *prog) {
+    char client_fifo[256], request_fifo[256];
+    snprintf(client_fifo, sizeof(client_fifo), "/tmp/docindex_%d_fifo", getpid());
+    snprintf(request_fifo, sizeof(request_fifo), "/tmp/docindex_%d_req", getpid());
+    if ((mkfifo(client_fifo, 0666) == -1 && errno != EEXIST) ||
+        (mkfifo(request_fifo, 0666) == -1 && errno != EEXIST)) {
+        perror("mkfifo");
+        unlink(client_fifo);
+        exit(EXIT_FAILURE);
+    }
+
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_SESSION;
+    strncpy(msg.client_fifo, client_fifo, sizeof(msg.client_fifo) - 1);
+    strncpy(msg.args, request_fifo, sizeof(msg.args) - 1);
+
+    int fd = open(FIFO_SERVER, O_WRONLY);
+    if (fd == -1 || write(fd, &msg, sizeof(msg)) != sizeof(msg)) {
+        perror("write to server FIFO");
+        unlink(client_fifo);
+        unlink(request_fifo);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    // Same open order as the server: response FIFO first
+    SessionReader reader = { -1, NULL, 0, 0 };
+    reader.fd = open(client_fifo, O_RDONLY);
+    int out = reader.fd == -1 ? -1 : open(request_fifo, O_WRONLY);
+    unlink(client_fifo);
+    unlink(request_fifo);
+    if (out == -1) {
+        perror("open session FIFO");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, session_reader, &reader) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+
+    char line[1024];
+    uint32_t seq = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *argv[8] = { (char *)prog };
+        int argc = 1 + split_line(line, argv + 1, 7);
+        if (argc == 1) continue;
+
+        memset(&msg, 0, sizeof(msg));
+        int rc = build_message(argc, argv, &msg);
+        if (rc == -2) fprintf(stderr, "Error: Invalid session command: %s\n", argv[1]);
+        if (rc != 0) continue;
+
+        msg.seq = ++seq;
+        if (write(out, &msg, sizeof(msg)) != sizeof(msg)) {
+            perror("write to session FIFO");
+            break;
+        }
+        if (msg.command == CMD_SHUTDOWN) break;
+    }
+
+    // The server answers what is in flight, then closes the response FIFO
+    close(out);
+    pthread_join(thread, NULL);
+    close(reader.fd);
+    for (int i = 0; i < reader.count; i++) free(reader.pending[i].data);
+    free(reader.pending);
+    return 0;
+}
+
+// Print DATA frames as they arrive until the END frame; 1 once it came
+static int print_fifo_response(int fd, int *got_data) {
+    char response[RESPONSE_SIZE];
+    FrameHeader header;
+    while (read_all(fd, &header, sizeof(header)) == 0) {
+        if (header.type == FRAME_END) return 1;
+        for (uint32_t left = header.length; left > 0; ) {
+            size_t chunk = left < sizeof(response) ? left : sizeof(response);
+            if (read_all(fd, response, chunk) == -1) {
+                left = 0;
+                break;
+            }
+            fwrite(response, 1, chunk, stdout);
+            left -= chunk;
+        }
+        fflush(stdout);
+        *got_data = 1;
+    }
+    return 0;
+}
+
+// Same, printing the payload straight out of the shared ring
+static int print_shm_response(ShmClient *shm, int *got_data) {
+    FrameHeader header;
+    while (shm_client_read(shm, &header, sizeof(header)) == 0) {
+        if (header.type == FRAME_END) return 1;
+        for (uint32_t left = header.length; left > 0; ) {
+            const char *data;
+            size_t chunk = shm_client_peek(shm, &data, left);
+            if (chunk == 0) return 0;
+            fwrite(data, 1, chunk, stdout);
+            shm_client_consume(shm, chunk);
+            left -= chunk;
+        }
+        fflush(stdout);
+        *got_data = 1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) usage(argv[0]);
+    if (strcmp(argv[1], "--session") == 0 && argc == 2) return run_session(argv[0]);
 
     Message msg;
     memset(&msg, 0, sizeof(msg));
@@ -26,93 +325,110 @@ int main(int argc, char *argv[]) {
     }
     strncpy(msg.client_fifo, client_fifo, sizeof(msg.client_fifo) - 1);
     msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
-    
-    if (mkfifo(client_fifo, 0666) == -1 && errno != EEXIST) {
+
+    // Shared memory when the server offers it and has a free slot
+    ShmClient shm;
+    int use_shm = shm_client_open(&shm) == 0;
+
+    if (!use_shm && mkfifo(client_fifo, 0666) == -1 && errno != EEXIST) {
         perror("mkfifo");
         exit(EXIT_FAILURE);
     }
 
+    FILE *batch_input = NULL;
+    char batch_fifo[256] = {0};
+
     // Parse command
-    if (strcmp(argv[1], "-a") == 0 && argc == 6) {
-        msg.command = CMD_ADD;
-        if (snprintf(msg.args, sizeof(msg.args), "%s|%s|%s|%s", 
-                argv[2], argv[3], argv[4], argv[5]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
+    if (strcmp(argv[1], "-A") == 0 && (argc == 2 || argc == 3)) {
+        msg.command = CMD_ADD_BATCH;
+        batch_input = (argc == 3 && strcmp(argv[2], "-") != 0) ? fopen(argv[2], "r") : stdin;
+        if (!batch_input) {
+            perror("open manifest");
             unlink(client_fifo);
             exit(EXIT_FAILURE);
         }
-    } else if (strcmp(argv[1], "-c") == 0 && argc == 3) {
-        msg.command = CMD_QUERY;
-        if (snprintf(msg.args, sizeof(msg.args), "%s", argv[2]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Key too long\n");
+        // The manifest is streamed through its own FIFO, so its size is not
+        // bounded by the fixed-size request message
+        snprintf(batch_fifo, sizeof(batch_fifo), "/tmp/docindex_%d_batch", getpid());
+        if (mkfifo(batch_fifo, 0666) == -1 && errno != EEXIST) {
+            perror("mkfifo");
             unlink(client_fifo);
             exit(EXIT_FAILURE);
         }
-    } else if (strcmp(argv[1], "-d") == 0 && argc == 3) {
-        msg.command = CMD_REMOVE;
-        if (snprintf(msg.args, sizeof(msg.args), "%s", argv[2]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Key too long\n");
+        strncpy(msg.args, batch_fifo, sizeof(msg.args) - 1);
+    } else {
+        int rc = build_message(argc, argv, &msg);
+        if (rc != 0) {
             unlink(client_fifo);
+            if (rc == -2) usage(argv[0]);
             exit(EXIT_FAILURE);
         }
-    } else if (strcmp(argv[1], "-l") == 0 && argc == 4) {
-        msg.command = CMD_LINE_COUNT;
-        if (snprintf(msg.args, sizeof(msg.args), "%s|%s", argv[2], argv[3]) >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
+    }
+
+    // Send request
+    int fd;
+    if (use_shm) {
+        shm_client_send(&shm, &msg);
+    } else {
+        fd = open(FIFO_SERVER, O_WRONLY);
+        if (fd == -1) {
+            perror("open server FIFO");
             unlink(client_fifo);
             exit(EXIT_FAILURE);
         }
-    } else if (strcmp(argv[1], "-s") == 0 && (argc == 3 || argc == 4)) {
-        msg.command = CMD_SEARCH;
-        if (snprintf(msg.args, sizeof(msg.args), argc == 4 ? "%s|%s" : "%s", 
-                argv[2], argc == 4 ? argv[3] : "") >= sizeof(msg.args)) {
-            fprintf(stderr, "Error: Arguments too long\n");
+
+        ssize_t bytes_written = write(fd, &msg, sizeof(msg));
+        if (bytes_written != sizeof(msg)) {
+            perror("write to server FIFO");
+            close(fd);
             unlink(client_fifo);
             exit(EXIT_FAILURE);
         }
-    } else if (strcmp(argv[1], "-f") == 0 && argc == 2) {
-        msg.command = CMD_SHUTDOWN;
-    } else {
-        usage(argv[0]);
+        close(fd);
     }
 
-    // Send request
-    int fd = open(FIFO_SERVER, O_WRONLY);
-    if (fd == -1) {
-        perror("open server FIFO");
-        unlink(client_fifo);
-        exit(EXIT_FAILURE);
-    }
-    
-    ssize_t bytes_written = write(fd, &msg, sizeof(msg));
-    if (bytes_written != sizeof(msg)) {
-        perror("write to server FIFO");
+    if (batch_input) {
+        fd = open(batch_fifo, O_WRONLY);
+        if (fd == -1) {
+            perror("open batch FIFO");
+            unlink(batch_fifo);
+            unlink(client_fifo);
+            exit(EXIT_FAILURE);
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), batch_input)) {
+            if (write(fd, line, strlen(line)) == -1) {
+                perror("write to batch FIFO");
+                break;
+            }
+        }
         close(fd);
-        unlink(client_fifo);
-        exit(EXIT_FAILURE);
+        unlink(batch_fifo);
+        if (batch_input != stdin) fclose(batch_input);
     }
-    close(fd);
 
     // Get response
-    fd = open(client_fifo, O_RDONLY);
-    if (fd == -1) {
-        perror("open client FIFO");
-        unlink(client_fifo);
-        exit(EXIT_FAILURE);
+    int got_data = 0, complete = 0;
+    if (use_shm) {
+        complete = print_shm_response(&shm, &got_data);
+        shm_client_close(&shm);
+    } else {
+        fd = open(client_fifo, O_RDONLY);
+        if (fd == -1) {
+            perror("open client FIFO");
+            unlink(client_fifo);
+            exit(EXIT_FAILURE);
+        }
+        complete = print_fifo_response(fd, &got_data);
+        close(fd);
     }
 
-    char response[RESPONSE_SIZE];
-    ssize_t n = read(fd, response, sizeof(response) - 1);
-    if (n > 0) {
-        response[n] = '\0';
-        printf("%s\n", response);
-    } else if (n == 0) {
-        fprintf(stderr, "Error: Empty response from server\n");
-    } else {
-        perror("read from client FIFO");
+    if (got_data) printf("\n");
+    if (!complete) {
+        fprintf(stderr, got_data ? "Error: Incomplete response from server\n"
+                                 : "Error: Empty response from server\n");
     }
-    
-    close(fd);
+
     unlink(client_fifo);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include "common.h"
+#include "doccache.h"
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Chained hash on the path plus an intrusive LRU list (head = most recent).
+// Entries in use by a scan are pinned by refs: eviction only unlinks them
+// and the mapping is released by the last doccache_close().
+#define DOCCACHE_BUCKETS 1024
+
+struct DocCacheEntry {
+    char *path;
+    const char *data;       // NULL for empty files
+    size_t size;
+    struct timespec mtime;
+    ino_t ino;
+    int refs;
+    int cached;             // still linked in the table
+    unsigned int hash;
+    DocCacheEntry *prev, *next, *hash_next;
+};
+
+static DocCacheEntry *buckets[DOCCACHE_BUCKETS];
+static DocCacheEntry *lru_head = NULL, *lru_tail = NULL;
+static size_t budget = (size_t)DOCCACHE_DEFAULT_MB << 20;
+static size_t cached_bytes = 0;
+static int cached_count = 0;
+
+static long hits = 0, misses = 0, evictions = 0, invalidations = 0;
+
+static pthread_mutex_t doccache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Search workers are forked from dispatcher threads; the child must not
+// inherit the lock held by another thread
+static void atfork_prepare() { pthread_mutex_lock(&doccache_lock); }
+static void atfork_release() { pthread_mutex_unlock(&doccache_lock); }
+
+void doccache_init(size_t budget_bytes) {
+    pthread_mutex_lock(&doccache_lock);
+    budget = budget_bytes;
+    pthread_mutex_unlock(&doccache_lock);
+    pthread_atfork(atfork_prepare, atfork_release, atfork_release);
+}
+
+static unsigned int path_hash(const char *path) {
+    unsigned int h = 2166136261u;
+    for (; *path; path++) h = (h ^ (unsigned char)*path) * 16777619u;
+    return h;
+}
+
+static void entry_free(DocCacheEntry *e) {
+    if (e->data) munmap((void *)e->data, e->size);
+    free(e->path);
+    free(e);
+}
+
+static void lru_unlink(DocCacheEntry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_link_front(DocCacheEntry *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+// Takes e out of the table; freed now or by its last user
+static void entry_drop(DocCacheEntry *e) {
+    DocCacheEntry **p = &buckets[e->hash & (DOCCACHE_BUCKETS - 1)];
+    while (*p != e) p = &(*p)->hash_next;
+    *p = e->hash_next;
+    lru_unlink(e);
+    e->cached = 0;
+    cached_bytes -= e->size;
+    cached_count--;
+    if (e->refs == 0) entry_free(e);
+}
+
+static DocCacheEntry *entry_map(const char *path, const struct stat *st) {
+    DocCacheEntry *e = calloc(1, sizeof(DocCacheEntry));
+    if (!e) return NULL;
+    e->path = strdup(path);
+    e->size = st->st_size;
+    e->mtime = st->st_mtim;
+    e->ino = st->st_ino;
+    e->refs = 1;
+    if (!e->path) {
+        free(e);
+        return NULL;
+    }
+    if (e->size == 0) return e;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        entry_free(e);
+        return NULL;
+    }
+    // Populated up front: the whole file is read anyway, and one fault per
+    // page costs more than the search itself
+    void *data = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        e->size = 0;
+        entry_free(e);
+        return NULL;
+    }
+    e->data = data;
+    return e;
+}
+
+// Returns a handle to the file's contents (data is NULL for an empty file),
+// or NULL if it cannot be read. Every handle must be given back with
+// doccache_close().
+DocCacheEntry *doccache_open(const char *path, const char **data, size_t *size) {
+    struct stat st;
+    if (stat(path, &st) == -1) return NULL;
+
+    unsigned int hash = path_hash(path);
+    pthread_mutex_lock(&doccache_lock);
+
+    DocCacheEntry *e = buckets[hash & (DOCCACHE_BUCKETS - 1)];
+    while (e && (e->hash != hash || strcmp(e->path, path) != 0)) e = e->hash_next;
+
+    if (e && (e->size != (size_t)st.st_size || e->ino != st.st_ino ||
+              e->mtime.tv_sec != st.st_mtim.tv_sec || e->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        invalidations++;
+        entry_drop(e);
+        e = NULL;
+    }
+
+    if (e) {
+        hits++;
+        e->refs++;
+        lru_unlink(e);
+        lru_link_front(e);
+        pthread_mutex_unlock(&doccache_lock);
+        *data = e->data;
+        *size = e->size;
+        return e;
+    }
+    misses++;
+    pthread_mutex_unlock(&doccache_lock);
+
+    // Mapped outside the lock; a concurrent miss on the same path just
+    // keeps whichever copy is inserted last
+    e = entry_map(path, &st);
+    if (!e) return NULL;
+    *data = e->data;
+    *size = e->size;
+    if (e->size == 0 || e->size > budget) return e;
+
+    pthread_mutex_lock(&doccache_lock);
+    DocCacheEntry *old = buckets[hash & (DOCCACHE_BUCKETS - 1)];
+    while (old && (old->hash != hash || strcmp(old->path, path) != 0)) old = old->hash_next;
+    if (old) entry_drop(old);
+
+    while (cached_bytes + e->size > budget && lru_tail) {
+        evictions++;
+        entry_drop(lru_tail);
+    }
+    e->hash = hash;
+    e->cached = 1;
+    e->hash_next = buckets[hash & (DOCCACHE_BUCKETS - 1)];
+    buckets[hash & (DOCCACHE_BUCKETS - 1)] = e;
+    lru_link_front(e);
+    cached_bytes += e->size;
+    cached_count++;
+    pthread_mutex_unlock(&doccache_lock);
+    return e;
+}
+
+void doccache_close(DocCacheEntry *e) {
+    if (!e) return;
+    pthread_mutex_lock(&doccache_lock);
+    int release = --e->refs == 0 && !e->cached;
+    pthread_mutex_unlock(&doccache_lock);
+    if (release) entry_free(e);
+}
+
+void doccache_print_stats(FILE *out, const char *scope) {
+    pthread_mutex_lock(&doccache_lock);
+    fprintf(out, "[DOCCACHE] %s Stats → Hits: %ld, Misses: %ld, Evictions: %ld, Invalidations: %ld, Files: %d, Bytes: %zu/%zu\n",
+            scope, hits, misses, evictions, invalidations, cached_count, cached_bytes, budget);
+    pthread_mutex_unlock(&doccache_lock);
+}
@@ -0,0 +1,477 @@
+#include "docset.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int varint_len(uint32_t v) {
+    int n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static int varint_put(unsigned char *out, uint32_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+static uint32_t varint_get(const unsigned char **p) {
+    uint32_t v = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        v |= (uint32_t)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return v | (uint32_t)*(*p)++ << shift;
+}
+
+void docset_init(DocSet *s) {
+    memset(s, 0, sizeof(*s));
+    s->type = DOCSET_DELTA;
+}
+
+void docset_free(DocSet *s) {
+    free(s->blocks);
+    free(s->bytes);
+    free(s->words);
+    docset_init(s);
+}
+
+size_t docset_bytes(const DocSet *s) {
+    if (s->type == DOCSET_BITMAP) return (size_t)s->word_count * sizeof(uint64_t);
+    return (size_t)s->block_count * sizeof(DocSetBlock) + s->used;
+}
+
+static size_t bitmap_size(int first, int last) {
+    return ((size_t)(last >> 6) - (first >> 6) + 1) * sizeof(uint64_t);
+}
+
+// Delta size of count IDs spread evenly over span
+static size_t delta_estimate(int count, int span) {
+    int blocks = (count + DOCSET_BLOCK - 1) / DOCSET_BLOCK;
+    int gaps = count - blocks;
+    return (size_t)blocks * sizeof(DocSetBlock) + (size_t)gaps * varint_len(count > 1 ? span / (count - 1) : 1);
+}
+
+static int delta_append(DocSet *s, int id) {
+    if (s->block_count == 0 || s->count - s->blocks[s->block_count - 1].start == DOCSET_BLOCK) {
+        if (s->block_count == s->block_cap) {
+            int new_cap = s->block_cap ? s->block_cap * 2 : 1;
+            DocSetBlock *grown = realloc(s->blocks, new_cap * sizeof(DocSetBlock));
+            if (!grown) return -1;
+            s->blocks = grown;
+            s->block_cap = new_cap;
+        }
+        s->blocks[s->block_count++] = (DocSetBlock){ id, s->used, s->count };
+    } else {
+        if (s->used + 5 > s->cap) {
+            uint32_t new_cap = s->cap ? s->cap * 2 : 16;
+            unsigned char *grown = realloc(s->bytes, new_cap);
+            if (!grown) return -1;
+            s->bytes = grown;
+            s->cap = new_cap;
+        }
+        s->used += varint_put(s->bytes + s->used, (uint32_t)(id - s->last));
+    }
+    s->count++;
+    s->last = id;
+    return 0;
+}
+
+// Index where the block after b starts
+static int block_limit(const DocSet *s, int b) {
+    return b + 1 < s->block_count ? s->blocks[b + 1].start : s->count;
+}
+
+static uint32_t block_bytes_end(const DocSet *s, int b) {
+    return b + 1 < s->block_count ? s->blocks[b + 1].offset : s->used;
+}
+
+// Last block whose first ID is at most id, 0 if id is below them all
+static int block_find(const DocSet *s, int id) {
+    int lo = 0, hi = s->block_count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (s->blocks[mid].first <= id) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static int block_decode(const DocSet *s, int b, int *out) {
+    int n = block_limit(s, b) - s->blocks[b].start;
+    const unsigned char *p = s->bytes + s->blocks[b].offset;
+    out[0] = s->blocks[b].first;
+    for (int i = 1; i < n; i++) out[i] = out[i - 1] + varint_get(&p);
+    return n;
+}
+
+// Replaces the IDs of block b with the n sorted ids, as even blocks of at
+// most DOCSET_BLOCK (none if n is 0). Only the bytes and skip entries after
+// the block move. Leaves s as it was if memory runs out.
+static int block_replace(DocSet *s, int b, const int *ids, int n) {
+    int pieces = (n + DOCSET_BLOCK - 1) / DOCSET_BLOCK;
+    uint32_t need = 0;
+    for (int p = 0; p < pieces; p++) {
+        for (int i = p * n / pieces + 1; i < (p + 1) * n / pieces; i++) need += varint_len((uint32_t)(ids[i] - ids[i - 1]));
+    }
+
+    int old_n = block_limit(s, b) - s->blocks[b].start;
+    uint32_t old_off = s->blocks[b].offset, old_len = block_bytes_end(s, b) - old_off;
+    if (s->used - old_len + need > s->cap) {
+        uint32_t new_cap = s->cap ? s->cap * 2 : 16;
+        while (new_cap < s->used - old_len + need) new_cap *= 2;
+        unsigned char *grown = realloc(s->bytes, new_cap);
+        if (!grown) return -1;
+        s->bytes = grown;
+        s->cap = new_cap;
+    }
+    if (s->block_count - 1 + pieces > s->block_cap) {
+        int new_cap = s->block_cap * 2;
+        DocSetBlock *grown = realloc(s->blocks, new_cap * sizeof(DocSetBlock));
+        if (!grown) return -1;
+        s->blocks = grown;
+        s->block_cap = new_cap;
+    }
+
+    memmove(s->bytes + old_off + need, s->bytes + old_off + old_len, s->used - old_off - old_len);
+    memmove(&s->blocks[b + pieces], &s->blocks[b + 1], (s->block_count - b - 1) * sizeof(DocSetBlock));
+    uint32_t off = old_off;
+    for (int p = 0; p < pieces; p++) {
+        int lo = p * n / pieces, hi = (p + 1) * n / pieces;
+        s->blocks[b + p] = (DocSetBlock){ ids[lo], off, s->blocks[b].start + lo };
+        for (int i = lo + 1; i < hi; i++) off += varint_put(s->bytes + off, (uint32_t)(ids[i] - ids[i - 1]));
+    }
+    s->block_count += pieces - 1;
+    for (int j = b + pieces; j < s->block_count; j++) {
+        s->blocks[j].offset += need - old_len;
+        s->blocks[j].start += n - old_n;
+    }
+    s->used += need - old_len;
+    s->count += n - old_n;
+    return 0;
+}
+
+// Words up to the one holding id, zeroed
+static int bitmap_reserve(DocSet *s, int id) {
+    int w = (id - s->base) >> 6;
+    if (w < s->word_count) return 0;
+    if (w >= s->word_cap) {
+        int new_cap = s->word_cap ? s->word_cap * 2 : 16;
+        if (new_cap <= w) new_cap = w + 1;
+        uint64_t *grown = realloc(s->words, new_cap * sizeof(uint64_t));
+        if (!grown) return -1;
+        s->words = grown;
+        s->word_cap = new_cap;
+    }
+    memset(s->words + s->word_count, 0, (w + 1 - s->word_count) * sizeof(uint64_t));
+    s->word_count = w + 1;
+    return 0;
+}
+
+// IDs of the set below id
+static int bitmap_rank(const DocSet *s, int id) {
+    int w = (id - s->base) >> 6, rank = 0;
+    for (int i = 0; i < w; i++) rank += __builtin_popcountll(s->words[i]);
+    return rank + __builtin_popcountll(s->words[w] & ((1ULL << ((id - s->base) & 63)) - 1));
+}
+
+// Re-encodes the set from n sorted IDs, as type or (type -1) as whichever
+// encoding is smaller. Leaves s as it was if memory runs out.
+static int docset_build(DocSet *s, const int *ids, int n, int type) {
+    DocSet t;
+    docset_init(&t);
+    if (n > 0 && type < 0) {
+        size_t delta = (size_t)((n + DOCSET_BLOCK - 1) / DOCSET_BLOCK) * sizeof(DocSetBlock);
+        for (int i = 1; i < n; i++) {
+            if (i % DOCSET_BLOCK) delta += varint_len((uint32_t)(ids[i] - ids[i - 1]));
+        }
+        type = bitmap_size(ids[0], ids[n - 1]) < delta ? DOCSET_BITMAP : DOCSET_DELTA;
+    }
+
+    if (n > 0 && type == DOCSET_BITMAP) {
+        t.type = DOCSET_BITMAP;
+        t.base = ids[0] & ~63;
+        if (bitmap_reserve(&t, ids[n - 1]) == -1) goto fail;
+        for (int i = 0; i < n; i++) t.words[(ids[i] - t.base) >> 6] |= 1ULL << ((ids[i] - t.base) & 63);
+        t.count = n;
+        t.last = ids[n - 1];
+    } else {
+        for (int i = 0; i < n; i++) {
+            if (delta_append(&t, ids[i]) == -1) goto fail;
+        }
+    }
+
+    docset_free(s);
+    *s = t;
+    return 0;
+fail:
+    docset_free(&t);
+    return -1;
+}
+
+int docset_decode(const DocSet *s, int *out) {
+    DocSetCursor c;
+    int n = 0;
+    for (docset_cursor(&c, s); c.index < s->count; docset_next(&c)) out[n++] = c.id;
+    return n;
+}
+
+// Switches encoding, adding extra (0 = none) above the last ID on the way
+static int docset_convert(DocSet *s, int type, int extra) {
+    int *ids = malloc((s->count + 1) * sizeof(int));
+    if (!ids) return -1;
+    int n = docset_decode(s, ids);
+    if (extra) ids[n++] = extra;
+    int r = docset_build(s, ids, n, type);
+    free(ids);
+    return r;
+}
+
+// id above every ID in the set. The encoding is revisited here: a bitmap
+// turns into deltas before a gap would make it larger, and deltas into a
+// bitmap, checked once per block, when the set has become dense.
+static int docset_append(DocSet *s, int id) {
+    if (s->type == DOCSET_BITMAP) {
+        if (delta_estimate(s->count + 1, id - s->base) * 4 < bitmap_size(s->base, id) * 3) {
+            return docset_convert(s, DOCSET_DELTA, id);
+        }
+        if (bitmap_reserve(s, id) == -1) return -1;
+        s->words[(id - s->base) >> 6] |= 1ULL << ((id - s->base) & 63);
+        s->count++;
+        s->last = id;
+        return 0;
+    }
+
+    if (delta_append(s, id) == -1) return -1;
+    if (s->count % DOCSET_BLOCK == 0 &&
+        bitmap_size(s->blocks[0].first, s->last) * 4 < docset_bytes(s) * 3) {
+        docset_convert(s, DOCSET_BITMAP, 0);
+    }
+    return 0;
+}
+
+// Moves the base of a bitmap down to hold id
+static int bitmap_rebase(DocSet *s, int id) {
+    int base = id & ~63, shift = (s->base - base) >> 6;
+    if (s->word_count + shift > s->word_cap) {
+        int new_cap = s->word_cap * 2 > s->word_count + shift ? s->word_cap * 2 : s->word_count + shift;
+        uint64_t *grown = realloc(s->words, new_cap * sizeof(uint64_t));
+        if (!grown) return -1;
+        s->words = grown;
+        s->word_cap = new_cap;
+    }
+    memmove(s->words + shift, s->words, s->word_count * sizeof(uint64_t));
+    memset(s->words, 0, shift * sizeof(uint64_t));
+    s->word_count += shift;
+    s->base = base;
+    return 0;
+}
+
+int docset_insert(DocSet *s, int id) {
+    // Documents are usually added in increasing ID order
+    if (s->count == 0 || id > s->last) return docset_append(s, id) == -1 ? -2 : s->count - 1;
+
+    if (s->type == DOCSET_BITMAP && id < s->base) {
+        // Far below the bitmap deltas are smaller
+        if (delta_estimate(s->count + 1, s->last - id) * 4 < bitmap_size(id, s->last) * 3) {
+            if (docset_convert(s, DOCSET_DELTA, 0) == -1) return -2;
+        } else if (bitmap_rebase(s, id) == -1) {
+            return -2;
+        }
+    }
+    if (s->type == DOCSET_BITMAP) {
+        uint64_t bit = 1ULL << ((id - s->base) & 63);
+        uint64_t *word = &s->words[(id - s->base) >> 6];
+        if (*word & bit) return -1;
+        *word |= bit;
+        s->count++;
+        return bitmap_rank(s, id);
+    }
+
+    // Out of order: only the block the ID falls in is re-encoded
+    int ids[DOCSET_BLOCK + 1];
+    int b = block_find(s, id);
+    int n = block_decode(s, b, ids);
+    int at = 0;
+    while (at < n && ids[at] < id) at++;
+    if (at < n && ids[at] == id) return -1;
+    memmove(&ids[at + 1], &ids[at], (n - at) * sizeof(int));
+    ids[at] = id;
+    int index = s->blocks[b].start + at;
+    return block_replace(s, b, ids, n + 1) == -1 ? -2 : index;
+}
+
+int docset_remove(DocSet *s, int id) {
+    int at = docset_find(s, id);
+    if (at == -1) return -1;
+    if (s->count == 1) {
+        docset_free(s);
+        return at;
+    }
+
+    if (s->type == DOCSET_BITMAP) {
+        s->words[(id - s->base) >> 6] &= ~(1ULL << ((id - s->base) & 63));
+        s->count--;
+        if (id == s->last) {
+            int w = s->word_count - 1;
+            while (!s->words[w]) w--;
+            s->word_count = w + 1;
+            s->last = s->base + (w << 6) + 63 - __builtin_clzll(s->words[w]);
+        }
+        if (delta_estimate(s->count, s->last - s->base) * 2 < docset_bytes(s)) docset_convert(s, DOCSET_DELTA, 0);
+        return at;
+    }
+
+    // Only the ID's block is re-encoded; it only shrinks, so this cannot fail
+    int ids[DOCSET_BLOCK];
+    int b = block_find(s, id);
+    int n = block_decode(s, b, ids);
+    int i = at - s->blocks[b].start;
+    memmove(&ids[i], &ids[i + 1], (n - i - 1) * sizeof(int));
+    block_replace(s, b, ids, n - 1);
+    if (id == s->last) {
+        n = block_decode(s, s->block_count - 1, ids);
+        s->last = ids[n - 1];
+    }
+    return at;
+}
+
+int docset_find(const DocSet *s, int id) {
+    if (s->count == 0 || id > s->last) return -1;
+
+    if (s->type == DOCSET_BITMAP) {
+        if (id < s->base) return -1;
+        if (!(s->words[(id - s->base) >> 6] & (1ULL << ((id - s->base) & 63)))) return -1;
+        return bitmap_rank(s, id);
+    }
+
+    if (id < s->blocks[0].first) return -1;
+    int b = block_find(s, id);
+    int index = s->blocks[b].start;
+    int end = block_limit(s, b);
+    int cur = s->blocks[b].first;
+    const unsigned char *p = s->bytes + s->blocks[b].offset;
+    while (cur < id) {
+        if (++index == end) return -1;
+        cur += varint_get(&p);
+    }
+    return cur == id ? index : -1;
+}
+
+void docset_cursor(DocSetCursor *c, const DocSet *s) {
+    c->set = s;
+    c->index = 0;
+    c->block = 0;
+    c->word = 0;
+    if (s->count == 0) {
+        c->id = INT_MAX;
+    } else if (s->type == DOCSET_BITMAP) {
+        c->bits = s->words[0];
+        while (!c->bits) c->bits = s->words[++c->word];
+        c->id = s->base + (c->word << 6) + __builtin_ctzll(c->bits);
+    } else {
+        c->id = s->blocks[0].first;
+        c->p = s->bytes + s->blocks[0].offset;
+        c->block_end = block_limit(s, 0);
+    }
+}
+
+void docset_next(DocSetCursor *c) {
+    const DocSet *s = c->set;
+    if (++c->index >= s->count) {
+        c->index = s->count;
+        c->id = INT_MAX;
+    } else if (s->type == DOCSET_BITMAP) {
+        c->bits &= c->bits - 1;
+        while (!c->bits) c->bits = s->words[++c->word];
+        c->id = s->base + (c->word << 6) + __builtin_ctzll(c->bits);
+    } else if (c->index == c->block_end) {
+        c->block++;
+        c->id = s->blocks[c->block].first;
+        c->p = s->bytes + s->blocks[c->block].offset;
+        c->block_end = block_limit(s, c->block);
+    } else {
+        c->id += varint_get(&c->p);
+    }
+}
+
+// Bitmaps jump straight to the target word, counting the IDs passed over;
+// delta sets binary-search the skip table and decode one block at most
+void docset_seek(DocSetCursor *c, int id) {
+    if (c->id >= id) return;
+    const DocSet *s = c->set;
+    if (id > s->last) {
+        c->index = s->count;
+        c->id = INT_MAX;
+        return;
+    }
+
+    if (s->type == DOCSET_BITMAP) {
+        int w = (id - s->base) >> 6;
+        if (w > c->word) {
+            c->index += __builtin_popcountll(c->bits);
+            for (int i = c->word + 1; i < w; i++) c->index += __builtin_popcountll(s->words[i]);
+            c->word = w;
+            c->bits = s->words[w];
+        }
+        uint64_t below = c->bits & ((1ULL << ((id - s->base) & 63)) - 1);
+        c->index += __builtin_popcountll(below);
+        c->bits &= ~below;
+        while (!c->bits) c->bits = s->words[++c->word];
+        c->id = s->base + (c->word << 6) + __builtin_ctzll(c->bits);
+        return;
+    }
+
+    int lo = c->block, hi = s->block_count - 1;
+    if (lo < hi && s->blocks[lo + 1].first <= id) {
+        while (lo < hi) {
+            int mid = lo + (hi - lo + 1) / 2;
+            if (s->blocks[mid].first <= id) lo = mid;
+            else hi = mid - 1;
+        }
+        c->block = lo;
+        c->index = s->blocks[lo].start;
+        c->id = s->blocks[lo].first;
+        c->p = s->bytes + s->blocks[lo].offset;
+        c->block_end = block_limit(s, lo);
+    }
+    while (c->id < id) docset_next(c);
+}
+
+void docset_or(const DocSet *s, uint64_t *bits) {
+    if (s->type == DOCSET_BITMAP) {
+        uint64_t *out = bits + (s->base >> 6);
+        for (int i = 0; i < s->word_count; i++) out[i] |= s->words[i];
+        return;
+    }
+    DocSetCursor c;
+    for (docset_cursor(&c, s); c.index < s->count; docset_next(&c)) bits[c.id >> 6] |= 1ULL << (c.id & 63);
+}
+
+// The list drives: the set is only seeked, so the cost follows the list
+static int docset_filter(const DocSet *s, const int *ids, int n, int *out, int keep) {
+    DocSetCursor c;
+    docset_cursor(&c, s);
+    int w = 0;
+    for (int i = 0; i < n; i++) {
+        docset_seek(&c, ids[i]);
+        if ((c.id == ids[i]) == keep) out[w++] = ids[i];
+    }
+    return w;
+}
+
+int docset_intersect(const DocSet *s, const int *ids, int n, int *out) {
+    return docset_filter(s, ids, n, out, 1);
+}
+
+int docset_difference(const DocSet *s, const int *ids, int n, int *out) {
+    return docset_filter(s, ids, n, out, 0);
+}
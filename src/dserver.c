@@ -1,31 +1,199 @@
 #include "common.h"
 #include "server.h"
 #include "index.h"
+#include "postings.h"
+#include "journal.h"
+#include "workers.h"
+#include "scan.h"
+#include "doccache.h"
+#include "resultcache.h"
+#include "metacache.h"
+#include "query.h"
+#include "stats.h"
+#include "ingest.h"
+#include "shmring.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
 
-CacheEntry cache[MAX_CACHE];
 int cache_size = 0;
 int next_id = 1;
 char document_folder[256] = {0};
+static const char *index_file = INDEX_FILE_BIN;
+static const char *stats_file = NULL;      // --stats-file: periodic dump target
+static int stats_interval = 10;            // seconds between dumps
+static int cache_snapshot_interval = 60;   // --cache-snapshot: seconds, 0 = only at shutdown
 extern void cache_print_stats();
-extern void cache_export_snapshot(const char *filename);
 static int debug_mode = 1;  // Debug mode flag
 
-void send_response(const char *client_fifo, const char *response) {
-    int fd = open(client_fifo, O_WRONLY);
-    if (fd == -1) {
+// A session keeps one request FIFO and one response FIFO open for many
+// pipelined requests. Requests are dispatched like any other and answer on
+// the shared response FIFO, frames tagged with the request's seq.
+#define MAX_SESSIONS 64
+
+struct Session {
+    int slot;
+    int fd;                         // response FIFO
+    char client_fifo[256];
+    char request_fifo[256];
+    pthread_mutex_t write_lock;     // one frame at a time
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    int pending;                    // requests queued but not yet answered
+};
+
+static Session *sessions[MAX_SESSIONS];
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Session *session_get(int session) {
+    pthread_mutex_lock(&sessions_lock);
+    Session *s = session > 0 && session <= MAX_SESSIONS ? sessions[session - 1] : NULL;
+    pthread_mutex_unlock(&sessions_lock);
+    return s;
+}
+
+static void session_done(Session *s) {
+    pthread_mutex_lock(&s->lock);
+    if (--s->pending == 0) pthread_cond_broadcast(&s->idle);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void session_wait_idle(Session *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->pending > 0) pthread_cond_wait(&s->idle, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Responses are a sequence of length-prefixed DATA frames closed by an END
+// frame, so their size is unbounded and the client can print each frame as
+// it arrives
+int response_open(Response *r, const Message *msg) {
+    r->seq = msg->seq;
+    r->shm_slot = msg->shm_slot;
+    if (r->shm_slot) {
+        r->session = NULL;
+        r->fd = SHM_RESPONSE;
+        return 0;
+    }
+    r->session = msg->session ? session_get(msg->session) : NULL;
+    if (r->session) {
+        r->fd = r->session->fd;
+        return 0;
+    }
+
+    r->fd = open(msg->client_fifo, O_WRONLY);
+    if (r->fd == -1) {
         if (debug_mode) perror("Error opening client FIFO");
-        return;
+        return -1;
     }
-    
-    ssize_t bytes_written = write(fd, response, strlen(response));
-    if (bytes_written == -1 || (size_t)bytes_written != strlen(response)) {
-        if (debug_mode) perror("Error writing to client FIFO");
+    return 0;
+}
+
+static int response_frame(Response *r, uint32_t type, const char *data, size_t len) {
+    FrameHeader header = { type, (uint32_t)len, r->seq };
+    if (r->shm_slot) {
+        // Written straight into the client's ring, which it reads in place
+        int ok = shm_server_write(r->shm_slot - 1, &header, sizeof(header)) == 0 &&
+                 shm_server_write(r->shm_slot - 1, data, len) == 0;
+        if (!ok && debug_mode) fprintf(stderr, "Error writing to client ring: client gone\n");
+        return ok ? 0 : -1;
     }
-    close(fd);
+    if (r->session) pthread_mutex_lock(&r->session->write_lock);
+    int ok = write_all(r->fd, &header, sizeof(header)) == 0 && write_all(r->fd, data, len) == 0;
+    if (r->session) pthread_mutex_unlock(&r->session->write_lock);
+    if (!ok && debug_mode) perror("Error writing to client FIFO");
+    return ok ? 0 : -1;
+}
+
+int response_write(Response *r, const char *data, size_t len) {
+    if (r->fd == -1 || len == 0) return r->fd == -1 ? -1 : 0;
+
+    if (response_frame(r, FRAME_DATA, data, len) == -1) {
+        // A session's FIFO stays open for its other requests
+        if (!r->session && !r->shm_slot) close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void response_close(Response *r) {
+    if (r->fd != -1) {
+        response_frame(r, FRAME_END, NULL, 0);
+        if (!r->session && !r->shm_slot) close(r->fd);
+        r->fd = -1;
+    }
+    if (r->shm_slot) {
+        shm_server_done(r->shm_slot - 1);
+        r->shm_slot = 0;
+    }
+    if (r->session) {
+        session_done(r->session);
+        r->session = NULL;
+    }
+}
+
+void send_response(const Message *msg, const char *response) {
+    Response r;
+    if (response_open(&r, msg) == -1) return;
+    response_write(&r, response, strlen(response));
+    response_close(&r);
+}
+
+// Growable id list, filled batch by batch like a search stream
+typedef struct {
+    int *ids;
+    int count, cap;
+    int incomplete;     // an id could not be kept
+} IdList;
+
+static void id_list_add(const int *ids, int count, void *ctx) {
+    IdList *l = ctx;
+    if (l->count + count > l->cap) {
+        int cap = l->cap ? l->cap : 64;
+        while (cap < l->count + count) cap *= 2;
+        int *grown = realloc(l->ids, cap * sizeof(int));
+        if (grown) {
+            l->ids = grown;
+            l->cap = cap;
+        }
+    }
+    if (l->count + count <= l->cap) {
+        if (count > 0) memcpy(l->ids + l->count, ids, count * sizeof(int));
+        l->count += count;
+    } else {
+        l->incomplete = 1;
+    }
+}
+
+// Formats "[id, id, ...]" into frames of up to ID_CHUNK bytes
+#define ID_CHUNK 4096
+
+typedef struct {
+    Response *response;
+    char buf[ID_CHUNK];
+    size_t len;
+    int first;
+    IdList all;         // every id sent, kept for the result cache
+} IdStream;
+
+static void id_stream_flush(IdStream *s) {
+    response_write(s->response, s->buf, s->len);
+    s->len = 0;
+}
+
+static void id_stream_add(const int *ids, int count, void *ctx) {
+    IdStream *s = ctx;
+    id_list_add(ids, count, &s->all);
+    for (int i = 0; i < count; i++) {
+        if (s->len + 16 > sizeof(s->buf)) id_stream_flush(s);
+        s->len += snprintf(s->buf + s->len, sizeof(s->buf) - s->len, s->first ? "%d" : ", %d", ids[i]);
+        s->first = 0;
+    }
+    // Push each finished batch out right away
+    if (s->len > 0) id_stream_flush(s);
 }
 
 void handle_add(Message *msg) {
@@ -38,20 +206,30 @@ void handle_add(Message *msg) {
                            title, authors, year, path);
     
     if (fields_read != 4) {
-        send_response(msg->client_fifo, "Error: Invalid format for add command");
+        send_response(msg, "Error: Invalid format for add command");
         return;
     }
     
     char fullpath[MAX_PATH + 256] = {0};
     if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path) >= sizeof(fullpath)) {
-        send_response(msg->client_fifo, "Error: Path too long");
+        send_response(msg, "Error: Path too long");
         return;
     }
 
     char response[RESPONSE_SIZE];
     if (access(fullpath, F_OK) == -1) {
         snprintf(response, sizeof(response), "Error: File %s not found", path);
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
+        return;
+    }
+
+    // Async ingest: only the ID is handed out here; the file is read later
+    if (ingest_enabled()) {
+        int id = ingest_submit(year, path);
+        if (id > 0) snprintf(response, sizeof(response), "Document %d queued", id);
+        else if (id == -1) snprintf(response, sizeof(response), "Error: Ingest queue full, try again");
+        else snprintf(response, sizeof(response), "Error: Server is shutting down");
+        send_response(msg, response);
         return;
     }
 
@@ -61,17 +239,18 @@ void handle_add(Message *msg) {
             strncpy(response, "Document indexed", sizeof(response) - 1);
             response[sizeof(response) - 1] = '\0';
         }
-        index_save("data/index.txt");
+        index_persist(index_file, 1);
     } else {
         strncpy(response, "Error adding document", sizeof(response) - 1);
         response[sizeof(response) - 1] = '\0';
     }
-    send_response(msg->client_fifo, response);
+    send_response(msg, response);
 }
 
 void handle_query(Message *msg) {
     int id = atoi(msg->args);
-    DocumentMeta *doc = index_query(id);
+    DocumentMeta meta;
+    DocumentMeta *doc = index_query(id, &meta);
     char response[RESPONSE_SIZE] = {0};
 
     if (doc) {
@@ -85,7 +264,7 @@ void handle_query(Message *msg) {
     } else {
         snprintf(response, sizeof(response), "Document %d not found", id);
     }
-    send_response(msg->client_fifo, response);
+    send_response(msg, response);
 }
 
 void handle_remove(Message *msg) {
@@ -94,11 +273,14 @@ void handle_remove(Message *msg) {
 
     if (index_remove(id) == 0) {
         snprintf(response, sizeof(response), "Index entry %d deleted", id);
-        index_save("data/index.txt");
+        index_persist(index_file, 1);
+    } else if (ingest_enabled() && ingest_cancel(id)) {
+        // Still queued: it is simply never inserted
+        snprintf(response, sizeof(response), "Index entry %d deleted", id);
     } else {
         snprintf(response, sizeof(response), "Document %d not found", id);
     }
-    send_response(msg->client_fifo, response);
+    send_response(msg, response);
 }
 
 void handle_line_count(Message *msg) {
@@ -108,14 +290,14 @@ void handle_line_count(Message *msg) {
     // Parse arguments
     char *args_copy = strdup(msg->args);
     if (!args_copy) {
-        send_response(msg->client_fifo, "Error: Memory allocation failed");
+        send_response(msg, "Error: Memory allocation failed");
         return;
     }
     
     char *token = strtok(args_copy, "|");
     if (!token) {
         free(args_copy);
-        send_response(msg->client_fifo, "Error: Invalid arguments format");
+        send_response(msg, "Error: Invalid arguments format");
         return;
     }
     
@@ -126,315 +308,808 @@ void handle_line_count(Message *msg) {
     }
     free(args_copy);
 
-    DocumentMeta *doc = index_query(id);
+    DocumentMeta meta;
+    DocumentMeta *doc = index_query(id, &meta);
     char response[RESPONSE_SIZE];
 
     if (!doc) {
         snprintf(response, sizeof(response), "Document %d not found", id);
-        send_response(msg->client_fifo, response);
+        send_response(msg, response);
         return;
     }
 
     char fullpath[MAX_PATH + 256];
     if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-        send_response(msg->client_fifo, "Error: Path too long");
+        send_response(msg, "Error: Path too long");
+        return;
+    }
+
+    // Counted in process, with the same result and output as "grep -c"
+    int count = scan_count_lines(fullpath, keyword);
+    if (count >= 0) {
+        snprintf(response, sizeof(response), "%d\n", count);
+    } else {
+        snprintf(response, sizeof(response), "0");
+    }
+    send_response(msg, response);
+}
+
+// Result cache check for a document added after a result was cached: the
+// same test the scan path applies, which for an indexable keyword gives the
+// same answer as the inverted index
+static int search_match(const char *path, const char *keyword) {
+    char fullpath[MAX_PATH + 256];
+    if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path) >= (int)sizeof(fullpath)) return 0;
+    return scan_file_contains(fullpath, keyword);
+}
+
+// Feeds the ids matching one keyword to emit in id order: from the result
+// cache, the inverted index, or a scan split into nproc contiguous batches
+// streamed back as they finish. Returns 1 if the result must not be stored
+// in the result cache: it came from there, or is a phrase, whose catch-up
+// test would need positions.
+static int search_keyword(const char *keyword, int nproc, workers_emit_fn emit, void *ctx) {
+    int *ids = NULL;
+    int id_count = 0;
+
+    // ---------- PHRASE MODE ----------
+    if (postings_is_phrase(keyword) && postings_phrase_search(keyword, &ids, &id_count) == 0) {
+        emit(ids, id_count, ctx);
+        free(ids);
+        return 1;
+    }
+
+    // ---------- CACHED ----------
+    if (resultcache_get(keyword, &ids, &id_count)) {
+        emit(ids, id_count, ctx);
+        free(ids);
+        return 1;
+    }
+
+    // ---------- INDEXED MODE ----------
+    if (postings_search(keyword, &ids, &id_count) == 0) {
+        emit(ids, id_count, ctx);
+        free(ids);
+        return 0;
+    }
+
+    // ---------- SCAN MODE ----------
+    // Keywords the index cannot answer are scanned by the worker pool. Each
+    // distinct content is scanned once, under its lowest ID.
+    int total = index_total();
+    SearchItem *items = malloc((total > 0 ? total : 1) * sizeof(SearchItem));
+    int n = 0;
+    if (!items) return 0;
+    DocumentMeta meta;
+    for (int i = 0; i < total; i++) {
+        DocumentMeta *doc = index_get(i, &meta);
+        if (!doc || postings_is_twin(doc->id)) continue;
+        if (snprintf(items[n].fullpath, sizeof(items[n].fullpath), "%s/%s", document_folder, doc->path) >= (int)sizeof(items[n].fullpath)) {
+            continue;  // Skip if path is too long
+        }
+        items[n++].id = doc->id;
+    }
+
+    if (postings_twin_count() == 0) {
+        workers_search(keyword, items, n, nproc, emit, ctx);
+        free(items);
+        return 0;
+    }
+
+    // Twins go after later IDs, so the matches are gathered before any is sent
+    IdList list = { NULL, 0, 0, 0 };
+    workers_search(keyword, items, n, nproc, id_list_add, &list);
+    free(items);
+    if (!list.incomplete && postings_expand(&list.ids, &list.count) == -1) list.incomplete = 1;
+    emit(list.ids, list.count, ctx);
+    free(list.ids);
+    return list.incomplete;
+}
+
+// Query terms are searched like single keywords and share the result cache
+static int query_term(const char *term, void *ctx, int **ids, int *count) {
+    IdList list = { NULL, 0, 0, 0 };
+    int cached = search_keyword(term, *(int *)ctx, id_list_add, &list);
+    if (list.incomplete) {
+        free(list.ids);
+        return -1;
+    }
+    if (!cached) resultcache_put(term, list.ids, list.count);
+    *ids = list.ids;
+    *count = list.count;
+    return 0;
+}
+
+static int query_near(const char *left, const char *right, int distance, void *ctx,
+                      int **ids, int *count) {
+    (void)ctx;
+    return postings_near_search(left, right, distance, ids, count);
+}
+
+static int query_all(void *ctx, int **ids, int *count) {
+    (void)ctx;
+    int total = index_total();
+    *ids = malloc((total > 0 ? total : 1) * sizeof(int));
+    *count = 0;
+    if (!*ids) return -1;
+    DocumentMeta meta;
+    for (int i = 0; i < total; i++) {
+        DocumentMeta *doc = index_get(i, &meta);
+        if (doc) (*ids)[(*count)++] = doc->id;
+    }
+    return 0;
+}
+
+static int query_filter_ids(void *state, int *ids, int n, int keep) {
+    return postings_match_filter(state, ids, n, keep);
+}
+
+static void query_filter_close(void *state) {
+    postings_match_close(state);
+}
+
+// An indexed keyword inside an AND is tested against the postings rather
+// than listed; phrases and scanned keywords are listed by query_term
+static int query_filter(const char *term, void *ctx, QueryFilter *f) {
+    (void)ctx;
+    if (postings_is_phrase(term)) return -1;
+    PostingsMatch *m = postings_match_open(term, &f->cost);
+    if (!m) return -1;
+    f->state = m;
+    f->filter = query_filter_ids;
+    f->close = query_filter_close;
+    return 0;
+}
+
+// -s keyword --top K: the K best documents by BM25, as "[id: score, ...]"
+static void search_ranked(const Message *msg, const char *keyword, int top) {
+    if (query_is_boolean(keyword)) {
+        send_response(msg, "Error: --top ranks plain keywords, not queries");
         return;
     }
 
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        snprintf(response, sizeof(response), "Error: Pipe creation failed");
-        send_response(msg->client_fifo, response);
+    int count = index_get_count();
+    if (top > count) top = count;
+    PostingsHit *hits = malloc((top > 0 ? top : 1) * sizeof(PostingsHit));
+    if (!hits) {
+        send_response(msg, "Error: Memory allocation failed");
+        return;
+    }
+    int found = postings_rank(keyword, top, hits);
+    if (found == -1) {
+        free(hits);
+        send_response(msg, "Error: Keyword has no words to rank");
         return;
     }
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        close(pipefd[0]);
-        close(pipefd[1]);
-        send_response(msg->client_fifo, "Error: Fork failed");
+    Response response;
+    if (response_open(&response, msg) == -1) {
+        free(hits);
         return;
     }
-    
-    if (pid == 0) {
-        // Child process
-        close(pipefd[0]);
-        if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
-            _exit(1);
+    char buf[ID_CHUNK];
+    size_t len = 0;
+    buf[len++] = '[';
+    for (int i = 0; i < found; i++) {
+        if (len + 48 > sizeof(buf)) {
+            response_write(&response, buf, len);
+            len = 0;
         }
-        close(pipefd[1]);
-        execlp("grep", "grep", "-c", keyword, fullpath, (char *)NULL);
-        _exit(1);
-    } else {
-        // Parent process
-        close(pipefd[1]);
-        char buf[64] = {0};
-        ssize_t bytes_read = read(pipefd[0], buf, sizeof(buf) - 1);
-        close(pipefd[0]);
-        
-        int status;
-        waitpid(pid, &status, 0);
-        
-        if (bytes_read > 0) {
-            snprintf(response, sizeof(response), "%s", buf);
-        } else {
-            snprintf(response, sizeof(response), "0");
-        }
-        send_response(msg->client_fifo, response);
+        len += snprintf(buf + len, sizeof(buf) - len, i ? ", %d: %.4f" : "%d: %.4f", hits[i].id, hits[i].score);
     }
+    buf[len++] = ']';
+    response_write(&response, buf, len);
+    response_close(&response);
+    free(hits);
 }
 
 void handle_search(Message *msg) {
-    // Safe allocation with proper checking
-    char *result = NULL;
     char *keyword = NULL;
     char *nproc_str = NULL;
     int nproc = 0;
-    int total = index_total();
     
     // Make a copy of the arguments for safe parsing
     char *args_copy = strdup(msg->args);
     if (!args_copy) {
-        send_response(msg->client_fifo, "[]");
+        send_response(msg, "[]");
         return;
     }
     
     keyword = strtok(args_copy, "|");
     if (!keyword) {
         free(args_copy);
-        send_response(msg->client_fifo, "[]");
+        send_response(msg, "[]");
         return;
     }
     
     nproc_str = strtok(NULL, "|");
     nproc = (nproc_str != NULL) ? atoi(nproc_str) : 0;
-    
-    // Allocate memory for result
-    result = malloc(65536);
-    if (!result) {
+
+    // ---------- RANKED ----------
+    char *top_str = strtok(NULL, "|");
+    if (top_str) {
+        search_ranked(msg, keyword, atoi(top_str));
+        free(args_copy);
+        return;
+    }
+
+    // ---------- BOOLEAN QUERY ----------
+    int *ids = NULL;
+    int id_count = 0;
+    int boolean = query_is_boolean(keyword);
+    if (boolean) {
+        char error[RESPONSE_SIZE];
+        if (query_evaluate(keyword, query_term, query_near, query_all, query_filter, &nproc, &ids, &id_count, error, sizeof(error)) == -1) {
+            send_response(msg, error);
+            free(args_copy);
+            return;
+        }
+    }
+
+    Response response;
+    if (response_open(&response, msg) == -1) {
+        free(ids);
         free(args_copy);
-        send_response(msg->client_fifo, "[]");
         return;
     }
-    result[0] = '[';
-    result[1] = '\0';
+    IdStream stream = { &response, "[", 1, 1, { NULL, 0, 0, 0 } };
 
-    // ---------- SEQUENTIAL MODE ----------
-    if (nproc <= 0 || nproc == 1 || total <= 1) {
-        int first = 1;
+    int cached = 1;
+    if (boolean) {
+        id_stream_add(ids, id_count, &stream);
+        free(ids);
+    } else {
+        cached = search_keyword(keyword, nproc, id_stream_add, &stream);
+    }
 
-        for (int i = 0; i < total; i++) {
-            DocumentMeta *doc = index_get(i);
-            if (!doc) continue;
+    stream.buf[stream.len++] = ']';
+    id_stream_flush(&stream);
+    response_close(&response);
 
-            char fullpath[MAX_PATH + 256];
-            if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-                continue;  // Skip if path is too long
-            }
+    if (!cached && !stream.all.incomplete) resultcache_put(keyword, stream.all.ids, stream.all.count);
+    free(stream.all.ids);
+    free(args_copy);
+}
 
-            int pipefd[2];
-            if (pipe(pipefd) == -1) continue;
-            
-            pid_t pid = fork();
-            if (pid == -1) {
-                close(pipefd[0]);
-                close(pipefd[1]);
-                continue;
-            }
-            
-            if (pid == 0) {
-                // Child process
-                close(pipefd[0]);
-                dup2(pipefd[1], STDOUT_FILENO);
-                close(pipefd[1]);
-                execlp("grep", "grep", "-q", keyword, fullpath, (char *)NULL);
-                _exit(1);
-            }
+// Everything CMD_STATS reports; the caller holds the index read lock.
+// Returns the length written, which a full buffer truncates.
+static int stats_report(char *buf, size_t size) {
+    long cache_hits, cache_misses, cache_rejected, result_hits, result_misses;
+    long postings, posting_bytes;
+    int bitmaps;
+    postings_id_usage(&postings, &posting_bytes, &bitmaps);
+    metacache_counts(&cache_hits, &cache_misses, &cache_rejected);
+    resultcache_counts(&result_hits, &result_misses);
 
-            // Parent process
-            close(pipefd[1]);
-            close(pipefd[0]);
-            
-            int status;
-            waitpid(pid, &status, 0);
-            
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                // Match found
-                if (!first) strncat(result, ", ", 65536 - strlen(result) - 1);
-                char buf[16];
-                snprintf(buf, sizeof(buf), "%d", doc->id);
-                strncat(result, buf, 65536 - strlen(result) - 1);
-                first = 0;
-            }
-        }
+    int len = snprintf(buf, size, "Documents indexed: %d (%d distinct contents)\n"
+                       "Postings: %ld in %d terms, %.2f bits per posting (%d bitmaps)\n",
+                       index_get_count(), postings_body_count(),
+                       postings, postings_term_count(), postings ? 8.0 * posting_bytes / postings : 0.0, bitmaps);
+    if (len < (int)size) len += stats_format(buf + len, size - len);
+    if (len < (int)size && ingest_enabled()) {
+        len += snprintf(buf + len, size - len, "\nIngest queue: %d pending", ingest_pending());
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len,
+                "\nMetadata cache (%s): %ld hits, %ld misses (%.1f%% hits), %ld not admitted"
+                "\nResult cache: %ld hits, %ld misses (%.1f%% hits)",
+                metacache_policy_name(), cache_hits, cache_misses,
+                cache_hits + cache_misses ? 100.0 * cache_hits / (cache_hits + cache_misses) : 0.0,
+                cache_rejected,
+                result_hits, result_misses,
+                result_hits + result_misses ? 100.0 * result_hits / (result_hits + result_misses) : 0.0);
+    }
+    return len < (int)size ? len : (int)size - 1;
+}
 
-        strncat(result, "]", 65536 - strlen(result) - 1);
-        send_response(msg->client_fifo, result);
-        free(result);
-        free(args_copy);
+// Replaces the file whole, so a reader never sees a half-written report
+static void stats_dump() {
+    char report[4096], tmp[512];
+    int len = stats_report(report, sizeof(report));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats_file);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        if (debug_mode) perror("Error writing stats file");
         return;
     }
+    fwrite(report, 1, len, f);
+    fputc('\n', f);
+    if (fclose(f) == 0) rename(tmp, stats_file);
+    else unlink(tmp);
+}
 
-    // ---------- CONCURRENT MODE ----------
-    if (nproc > total) nproc = total;  // Limit number of processes
-    
-    int fds[nproc][2];
-    pid_t pids[nproc];
-    int docs_per_proc = total / nproc;
-    int rest = total % nproc;
-
-    for (int i = 0, start = 0; i < nproc; i++) {
-        int count = docs_per_proc + (i < rest ? 1 : 0);
-        if (pipe(fds[i]) == -1) {
-            // Handle pipe creation error
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                kill(pids[j], SIGTERM);
-                waitpid(pids[j], NULL, 0);
-            }
-            send_response(msg->client_fifo, "[]");
-            free(result);
-            free(args_copy);
-            return;
+// Whether an ID handed out by an add is in the index yet
+void handle_status(Message *msg) {
+    static const char *states[] = { "not found", "pending", "indexed", "failed" };
+    int id = atoi(msg->args);
+    int status = ingest_enabled() ? ingest_status(id)
+               : index_contains(id) ? INGEST_INDEXED : INGEST_UNKNOWN;
+    char response[RESPONSE_SIZE];
+    snprintf(response, sizeof(response), "Document %d %s", id, states[status]);
+    send_response(msg, response);
+}
+
+void handle_stats(Message *msg) {
+    char report[4096];
+    stats_report(report, sizeof(report));
+    send_response(msg, report);
+}
+
+void handle_shutdown(Message *msg) {
+    char response[RESPONSE_SIZE];
+    snprintf(response, sizeof(response), "Server is shutting down");
+    send_response(msg, response);
+    index_save(index_file);
+    journal_close();
+    workers_stop();
+    cache_print_stats();
+    if (stats_file) stats_dump();
+    unlink(FIFO_SERVER);
+    shm_server_stop();
+    cache_export_snapshot(CACHE_SNAPSHOT_FILE);
+    exit(EXIT_SUCCESS);
+}
+
+typedef struct {
+    char year[MAX_YEAR + 1];
+    char path[MAX_PATH + 1];
+    PreparedDocument doc;
+} BatchItem;
+
+typedef struct {
+    BatchItem *items;
+    int count;
+    int next;       // next item to prepare, claimed atomically
+} BatchWork;
+
+static void *batch_prepare_thread(void *arg) {
+    BatchWork *work = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+        index_prepare(&work->items[i].doc, work->items[i].year, work->items[i].path);
+    }
+    return NULL;
+}
+
+// Whether path names one of a client's own FIFOs, /tmp/docindex_<pid>_<suffix>
+static int is_client_fifo(const char *path, const char *suffix) {
+    int pid, end = 0;
+    return sscanf(path, "/tmp/docindex_%d_%n", &pid, &end) == 1 && end > 0 && pid > 0 &&
+           strcmp(path + end, suffix) == 0;
+}
+
+// Opens a FIFO named by a client for reading. Only the client's own FIFOs
+// are opened with the server's privileges: no other file, no symlink, and
+// not FIFO_SERVER, which would steal the other clients' requests.
+static int client_fifo_open(const char *path, const char *suffix) {
+    if (!is_client_fifo(path, suffix)) return -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The client streams "title|authors|year|path" lines through the FIFO named
+// in args. Files are read and tokenized in parallel without any lock; then
+// everything is inserted under one write lock and persisted once.
+static FILE *batch_open(const char *path) {
+    int fd = client_fifo_open(path, "batch");
+    if (fd == -1) return NULL;
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) close(fd);
+    return fp;
+}
+
+void handle_add_batch(Message *msg) {
+    char response[RESPONSE_SIZE];
+    FILE *fp = batch_open(msg->args);
+    if (!fp) {
+        send_response(msg, "Error: Cannot open batch stream");
+        return;
+    }
+
+    BatchWork work = { NULL, 0, 0 };
+    int capacity = 0, skipped = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+
+        char title[MAX_TITLE+1], authors[MAX_AUTHORS+1], year[MAX_YEAR+1], path[MAX_PATH+1];
+        char fullpath[MAX_PATH + 256];
+        if (sscanf(line, "%200[^|]|%200[^|]|%4[^|]|%64[^|]", title, authors, year, path) != 4 ||
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path) >= (int)sizeof(fullpath) ||
+            access(fullpath, F_OK) == -1) {
+            skipped++;
+            continue;
         }
 
-        pids[i] = fork();
-        if (pids[i] == -1) {
-            // Handle fork error
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                kill(pids[j], SIGTERM);
-                waitpid(pids[j], NULL, 0);
-            }
-            close(fds[i][0]);
-            close(fds[i][1]);
-            send_response(msg->client_fifo, "[]");
-            free(result);
-            free(args_copy);
-            return;
+        if (work.count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            BatchItem *grown = realloc(work.items, capacity * sizeof(BatchItem));
+            if (!grown) break;
+            work.items = grown;
         }
-        
-        if (pids[i] == 0) {
-            // Child process
-            for (int j = 0; j < i; j++) {
-                close(fds[j][0]);
-                close(fds[j][1]);
-            }
-            close(fds[i][0]);
-
-            char partial[4096] = "";
-            int first = 1;
-
-            for (int j = 0; j < count; j++) {
-                int index = start + j;
-                DocumentMeta *doc = index_get(index);
-                if (!doc) continue;
-
-                char fullpath[MAX_PATH + 256];
-                if (snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc->path) >= sizeof(fullpath)) {
-                    continue;  // Skip if path is too long
-                }
-
-                int grep_pipe[2];
-                if (pipe(grep_pipe) == -1) continue;
-                
-                pid_t grep_pid = fork();
-                if (grep_pid == -1) {
-                    close(grep_pipe[0]);
-                    close(grep_pipe[1]);
-                    continue;
-                }
-                
-                if (grep_pid == 0) {
-                    // Grep process
-                    close(grep_pipe[0]);
-                    dup2(grep_pipe[1], STDOUT_FILENO);
-                    close(grep_pipe[1]);
-                    execlp("grep", "grep", "-q", keyword, fullpath, (char *)NULL);
-                    _exit(1);
-                }
-                
-                // Child process handling grep result
-                close(grep_pipe[1]);
-                close(grep_pipe[0]);
-                
-                int status;
-                waitpid(grep_pid, &status, 0);
-                
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                    // Match found
-                    if (!first) strncat(partial, ", ", sizeof(partial) - strlen(partial) - 1);
-                    char buf[16];
-                    snprintf(buf, sizeof(buf), "%d", doc->id);
-                    strncat(partial, buf, sizeof(partial) - strlen(partial) - 1);
-                    first = 0;
-                }
-            }
+        BatchItem *item = &work.items[work.count++];
+        memset(item, 0, sizeof(*item));
+        strncpy(item->year, year, MAX_YEAR);
+        strncpy(item->path, path, MAX_PATH);
+    }
+    fclose(fp);
 
-            ssize_t bytes_written = write(fds[i][1], partial, strlen(partial));
-            if (bytes_written == -1 || (size_t)bytes_written != strlen(partial)) {
-                if (debug_mode) perror("Write error in child process");
-            }
-            close(fds[i][1]);
-            exit(0);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = cpus < 1 ? 1 : cpus > 16 ? 16 : (int)cpus;
+    if (nthreads > work.count) nthreads = work.count;
+    pthread_t threads[16];
+    int started = 0;
+    for (; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, batch_prepare_thread, &work) != 0) break;
+    }
+    batch_prepare_thread(&work);    // also covers the case where no thread started
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    // Queued async adds hold reserved IDs below next_id; they go in first
+    // so the table stays in ID order
+    int first_id = 0, last_id = 0, added = 0;
+    index_write_lock();
+    while (ingest_pending() > 0) {
+        index_unlock();
+        ingest_drain();
+        index_write_lock();
+    }
+    for (int i = 0; i < work.count; i++) {
+        int id = index_add_prepared(&work.items[i].doc);
+        if (id > 0) {
+            if (!first_id) first_id = id;
+            last_id = id;
+            added++;
         } else {
-            // Parent process
-            close(fds[i][1]);
-            start += count;
+            skipped++;
         }
     }
+    if (added > 0) index_persist(index_file, added);
+    index_unlock();
 
-    int first = 1;
-    for (int i = 0; i < nproc; i++) {
-        char buffer[4096] = {0};
-        ssize_t bytes_read = read(fds[i][0], buffer, sizeof(buffer) - 1);
-        close(fds[i][0]);
-        
-        int status;
-        waitpid(pids[i], &status, 0);
-        
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            if (strlen(buffer) > 0) {
-                if (!first) strncat(result, ", ", 65536 - strlen(result) - 1);
-                strncat(result, buffer, 65536 - strlen(result) - 1);
-                first = 0;
-            }
+    for (int i = 0; i < work.count; i++) postings_terms_free(&work.items[i].doc.terms);
+    free(work.items);
+
+    if (added > 0) {
+        snprintf(response, sizeof(response), "Documents %d-%d indexed (%d added, %d skipped)",
+                 first_id, last_id, added, skipped);
+    } else {
+        snprintf(response, sizeof(response), "No documents indexed (%d skipped)", skipped);
+    }
+    send_response(msg, response);
+}
+
+// Requests read from the server FIFO wait here for a dispatcher thread
+#define QUEUE_SIZE 64
+static Message queue[QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_len = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+
+// Also the entry point of requests arriving over shared memory
+static void queue_push(const Message *msg) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_len == QUEUE_SIZE) pthread_cond_wait(&queue_not_full, &queue_lock);
+    queue[(queue_head + queue_len) % QUEUE_SIZE] = *msg;
+    queue_len++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void queue_pop(Message *msg) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_len == 0) pthread_cond_wait(&queue_not_empty, &queue_lock);
+    *msg = queue[queue_head];
+    queue_head = (queue_head + 1) % QUEUE_SIZE;
+    queue_len--;
+    pthread_cond_signal(&queue_not_full);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static int is_mutation(CommandType command) {
+    return command == CMD_ADD || command == CMD_REMOVE || command == CMD_SHUTDOWN;
+}
+
+// Reads the session's requests and queues them. Queries pipeline freely;
+// a mutation waits for the session's earlier requests and holds back later
+// ones until it is answered, so each session sees its own writes in order.
+static void *session_thread(void *arg) {
+    Session *s = arg;
+    int in = -1;
+
+    // Same open order as the client: response FIFO first
+    s->fd = open(s->client_fifo, O_WRONLY | O_CLOEXEC);
+    if (s->fd != -1) in = client_fifo_open(s->request_fifo, "req");
+    if (debug_mode) printf("[SESSION] Sessão %d aberta (%s)\n", s->slot + 1, s->client_fifo);
+
+    Message msg;
+    int served = 0;
+    while (in != -1 && read_all(in, &msg, sizeof(msg)) == 0) {
+        msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
+        msg.args[sizeof(msg.args) - 1] = '\0';
+        strcpy(msg.client_fifo, s->client_fifo);
+        msg.session = s->slot + 1;
+        msg.shm_slot = 0;
+
+        int mutation = is_mutation(msg.command);
+        pthread_mutex_lock(&s->lock);
+        while (mutation && s->pending > 0) pthread_cond_wait(&s->idle, &s->lock);
+        s->pending++;
+        pthread_mutex_unlock(&s->lock);
+        served++;
+
+        if (msg.command == CMD_SESSION || msg.command == CMD_ADD_BATCH) {
+            send_response(&msg, "Error: Command not available in a session");
+            continue;
         }
+        queue_push(&msg);
+        if (mutation) session_wait_idle(s);
     }
 
-    strncat(result, "]", 65536 - strlen(result) - 1);
-    send_response(msg->client_fifo, result);
-    free(result);
-    free(args_copy);
+    session_wait_idle(s);
+    if (in != -1) close(in);
+    if (s->fd != -1) close(s->fd);
+    if (debug_mode) printf("[SESSION] Sessão %d fechada (%d pedidos)\n", s->slot + 1, served);
+
+    pthread_mutex_lock(&sessions_lock);
+    sessions[s->slot] = NULL;
+    pthread_mutex_unlock(&sessions_lock);
+    pthread_mutex_destroy(&s->write_lock);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->idle);
+    free(s);
+    return NULL;
 }
 
-void handle_shutdown(Message *msg) {
-    char response[RESPONSE_SIZE];
-    snprintf(response, sizeof(response), "Server is shutting down");
-    send_response(msg->client_fifo, response);
-    index_save("data/index.txt");
-    cache_print_stats();
-    unlink(FIFO_SERVER);
-    cache_export_snapshot("data/cache_snapshot.txt");
-    exit(EXIT_SUCCESS);
+// args names the client's request FIFO, /tmp/docindex_<pid>_req;
+// responses go to client_fifo
+void handle_session(Message *msg) {
+    if (!is_client_fifo(msg->args, "req")) {
+        send_response(msg, "Error: Invalid session FIFO");
+        return;
+    }
+
+    Session *s = calloc(1, sizeof(Session));
+    if (!s) {
+        send_response(msg, "Error: Memory allocation failed");
+        return;
+    }
+
+    pthread_mutex_lock(&sessions_lock);
+    s->slot = -1;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i]) {
+            s->slot = i;
+            sessions[i] = s;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessions_lock);
+    if (s->slot == -1) {
+        free(s);
+        send_response(msg, "Error: Too many sessions");
+        return;
+    }
+
+    strcpy(s->client_fifo, msg->client_fifo);
+    strncpy(s->request_fifo, msg->args, sizeof(s->request_fifo) - 1);
+    pthread_mutex_init(&s->write_lock, NULL);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->idle, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, session_thread, s) != 0) {
+        pthread_mutex_lock(&sessions_lock);
+        sessions[s->slot] = NULL;
+        pthread_mutex_unlock(&sessions_lock);
+        free(s);
+        send_response(msg, "Error: Cannot start session");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Read-only commands run in parallel under the index read lock; add,
+// remove and shutdown take it exclusively and so stay serialized. The
+// latency recorded includes the wait for the lock.
+static void dispatch(Message *msg) {
+    uint64_t start = stats_now_us();
+
+    // Batches stream their input before taking the lock themselves
+    if (msg->command == CMD_ADD_BATCH) {
+        handle_add_batch(msg);
+        stats_record(msg->command, stats_now_us() - start);
+        return;
+    }
+    if (msg->command == CMD_SESSION) {
+        handle_session(msg);
+        stats_record(msg->command, stats_now_us() - start);
+        return;
+    }
+    // Queued adds were acknowledged: index them before the final save
+    if (msg->command == CMD_SHUTDOWN) ingest_stop();
+
+    if (is_mutation(msg->command)) index_write_lock();
+    else index_read_lock();
+
+    switch (msg->command) {
+        case CMD_ADD: handle_add(msg); break;
+        case CMD_QUERY: handle_query(msg); break;
+        case CMD_REMOVE: handle_remove(msg); break;
+        case CMD_LINE_COUNT: handle_line_count(msg); break;
+        case CMD_SEARCH: handle_search(msg); break;
+        case CMD_SHUTDOWN: handle_shutdown(msg); break;
+        case CMD_STATS: handle_stats(msg); break;
+        case CMD_STATUS: handle_status(msg); break;
+        default:
+            if (debug_mode) fprintf(stderr, "Unknown command: %d\n", msg->command);
+            send_response(msg, "Error: Unknown command");
+            break;
+    }
+
+    index_unlock();
+    stats_record(msg->command, stats_now_us() - start);
+}
+
+static void *dispatcher_thread(void *arg) {
+    (void)arg;
+    Message msg;
+    while (1) {
+        queue_pop(&msg);
+        dispatch(&msg);
+    }
+    return NULL;
+}
+
+// Group-commit deadlines, compaction, log folding and stats dumps happen
+// here, off the request path
+static void *maintenance_thread(void *arg) {
+    (void)arg;
+    uint64_t last_dump = stats_now_us();
+    uint64_t last_snapshot = last_dump;
+    long snapshot_lookups = 0;
+    while (1) {
+        usleep(100 * 1000);
+        index_maintenance();
+        if (stats_file && stats_now_us() - last_dump >= (uint64_t)stats_interval * 1000000) {
+            index_read_lock();
+            stats_dump();
+            index_unlock();
+            last_dump = stats_now_us();
+        }
+        // Limits the warmth a crash loses; skipped while the cache sits idle
+        if (cache_snapshot_interval &&
+            stats_now_us() - last_snapshot >= (uint64_t)cache_snapshot_interval * 1000000) {
+            long hits, misses;
+            metacache_counts(&hits, &misses, NULL);
+            if (hits + misses != snapshot_lookups) {
+                index_read_lock();
+                cache_export_snapshot(CACHE_SNAPSHOT_FILE);
+                index_unlock();
+                snapshot_lookups = hits + misses;
+            }
+            last_snapshot = stats_now_us();
+        }
+    }
+    return NULL;
+}
+
+static void server_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <document_folder> [cache_size] [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --format=binary|text        snapshot as %s (default) or %s\n", INDEX_FILE_BIN, INDEX_FILE_TEXT);
+    fprintf(stderr, "  --workers=N                 request dispatcher threads (default: 4)\n");
+    fprintf(stderr, "  --pool=N                    search worker processes started at boot (default: 4)\n");
+    fprintf(stderr, "  --doc-cache=MB              document contents kept mapped for -l/-s (default: %d, 0 = off)\n", DOCCACHE_DEFAULT_MB);
+    fprintf(stderr, "  --result-cache=KB           memory for cached -s results (default: %d, 0 = off)\n", RESULTCACHE_DEFAULT_KB);
+    fprintf(stderr, "  --persist=journal|snapshot  append mutations to %s (default) or rewrite the index\n", JOURNAL_FILE);
+    fprintf(stderr, "  --fsync=always|group|none   journal sync policy (default: group)\n");
+    fprintf(stderr, "  --group-commit=N            records per fsync with --fsync=group (default: 32)\n");
+    fprintf(stderr, "  --ingest=sync|async         answer -a after indexing (default) or once queued\n");
+    fprintf(stderr, "  --policy=lru|tinylfu        eviction policy of the -c cache (default: lru)\n");
+    fprintf(stderr, "  --cache-trace=PATH          append the ID of every -c lookup to PATH\n");
+    fprintf(stderr, "  --cache-snapshot=S          seconds between snapshots of the -c cache (default: 60, 0 = at shutdown)\n");
+    fprintf(stderr, "  --shm                       also accept clients over shared memory (%s)\n", SHM_NAME);
+    fprintf(stderr, "  --stats-file=PATH           write the --stats report to PATH periodically\n");
+    fprintf(stderr, "  --stats-interval=S          seconds between --stats-file dumps (default: 10)\n");
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <document_folder> [cache_size]\n", argv[0]);
+        server_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    // Create data directory if it doesn't exist
-    mkdir("data", 0777);
+    int use_journal = 1;
+    int sync_policy = JOURNAL_SYNC_GROUP;
+    int group_commit = 32;
+    int pool_size = 4;
+    int dispatchers = 4;
+    int async_ingest = 0;
+    int use_shm = 0;
+    int cache_policy = METACACHE_LRU;
+    const char *cache_trace = NULL;
+    long doc_cache_mb = DOCCACHE_DEFAULT_MB;
+    long result_cache_kb = RESULTCACHE_DEFAULT_KB;
 
-    if (index_load("data/index.txt") == 0) {
-        printf("[INFO] Index loaded successfully.\n");
-    } else {
-        printf("[INFO] No index loaded.\n");
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--format=binary") == 0) {
+            index_file = INDEX_FILE_BIN;
+        } else if (strcmp(argv[i], "--format=text") == 0) {
+            index_file = INDEX_FILE_TEXT;
+        } else if (strcmp(argv[i], "--persist=journal") == 0) {
+            use_journal = 1;
+        } else if (strcmp(argv[i], "--persist=snapshot") == 0) {
+            use_journal = 0;
+        } else if (strcmp(argv[i], "--fsync=always") == 0) {
+            sync_policy = JOURNAL_SYNC_ALWAYS;
+        } else if (strcmp(argv[i], "--fsync=group") == 0) {
+            sync_policy = JOURNAL_SYNC_GROUP;
+        } else if (strcmp(argv[i], "--fsync=none") == 0) {
+            sync_policy = JOURNAL_SYNC_NONE;
+        } else if (strncmp(argv[i], "--group-commit=", 15) == 0) {
+            group_commit = atoi(argv[i] + 15);
+        } else if (strcmp(argv[i], "--ingest=sync") == 0) {
+            async_ingest = 0;
+        } else if (strcmp(argv[i], "--ingest=async") == 0) {
+            async_ingest = 1;
+        } else if (strncmp(argv[i], "--policy=", 9) == 0 && metacache_policy(argv[i] + 9) != -1) {
+            cache_policy = metacache_policy(argv[i] + 9);
+        } else if (strncmp(argv[i], "--cache-trace=", 14) == 0 && argv[i][14]) {
+            cache_trace = argv[i] + 14;
+        } else if (strncmp(argv[i], "--cache-snapshot=", 17) == 0) {
+            cache_snapshot_interval = atoi(argv[i] + 17);
+            if (cache_snapshot_interval < 0) cache_snapshot_interval = 0;
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            use_shm = 1;
+        } else if (strncmp(argv[i], "--stats-file=", 13) == 0 && argv[i][13]) {
+            stats_file = argv[i] + 13;
+        } else if (strncmp(argv[i], "--stats-interval=", 17) == 0) {
+            stats_interval = atoi(argv[i] + 17);
+            if (stats_interval < 1) stats_interval = 1;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            dispatchers = atoi(argv[i] + 10);
+            if (dispatchers < 1) dispatchers = 1;
+        } else if (strncmp(argv[i], "--doc-cache=", 12) == 0) {
+            doc_cache_mb = atol(argv[i] + 12);
+            if (doc_cache_mb < 0) doc_cache_mb = 0;
+        } else if (strncmp(argv[i], "--result-cache=", 15) == 0) {
+            result_cache_kb = atol(argv[i] + 15);
+            if (result_cache_kb < 0) result_cache_kb = 0;
+        } else if (strncmp(argv[i], "--pool=", 7) == 0) {
+            pool_size = atoi(argv[i] + 7);
+            if (pool_size < 0) pool_size = 0;
+        } else if (argv[i][0] != '-') {
+            cache_size = atoi(argv[i]);
+            if (cache_size > MAX_CACHE) cache_size = MAX_CACHE;
+            if (cache_size <= 0) cache_size = 10; // Default value
+        } else {
+            server_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
     }
 
+    stats_init();
+    metacache_init(cache_size, cache_policy);
+    if (cache_trace && metacache_trace(cache_trace) == -1) {
+        perror("open cache trace");
+        return EXIT_FAILURE;
+    }
+
+    // Create data directory if it doesn't exist
+    mkdir("data", 0777);
+
     if (strlen(argv[1]) >= sizeof(document_folder)) {
         fprintf(stderr, "Error: Document folder path too long\n");
         return EXIT_FAILURE;
@@ -448,10 +1123,30 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    if (argc >= 3) {
-        cache_size = atoi(argv[2]);
-        if (cache_size > MAX_CACHE) cache_size = MAX_CACHE;
-        if (cache_size <= 0) cache_size = 10; // Default value
+    // Opened before loading so the log can be replayed on top of the snapshot
+    if (use_journal && journal_open(JOURNAL_FILE, sync_policy, group_commit) == -1) {
+        perror("open journal");
+        return EXIT_FAILURE;
+    }
+
+    // Loaded after document_folder is set: the inverted index may need rebuilding
+    if (index_load(index_file) == 0) {
+        printf("[INFO] Index loaded successfully.\n");
+    } else {
+        printf("[INFO] No index loaded.\n");
+    }
+    int warmed = cache_import_snapshot(CACHE_SNAPSHOT_FILE);
+
+    // Before the workers are forked, so each inherits the same budget
+    doccache_init((size_t)doc_cache_mb << 20);
+    resultcache_init((size_t)result_cache_kb << 10, search_match);
+
+    // A client that goes away mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Started before the server FIFO exists so workers never inherit it
+    if (workers_start(pool_size) == -1) {
+        fprintf(stderr, "Warning: only %d of %d search workers started\n", workers_count(), pool_size);
     }
 
     unlink(FIFO_SERVER);
@@ -461,7 +1156,8 @@ int main(int argc, char *argv[]) {
     }
 
     printf("Server started. Document folder: %s\n", document_folder);
-    printf("Loaded %d documents. Cache size: %d\n", index_get_count(), cache_size);
+    printf("Loaded %d documents. Cache size: %d, %s (%d restored). Dispatchers: %d. Search workers: %d\n",
+           index_get_count(), cache_size, metacache_policy_name(), warmed, dispatchers, workers_count());
 
     int fd = open(FIFO_SERVER, O_RDWR);
     if (fd == -1) {
@@ -470,6 +1166,25 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (async_ingest && ingest_start(index_file) == -1) {
+        perror("start ingest thread");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t thread;
+    for (int i = 0; i < dispatchers; i++) {
+        if (pthread_create(&thread, NULL, dispatcher_thread, NULL) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+        pthread_detach(thread);
+    }
+    if (pthread_create(&thread, NULL, maintenance_thread, NULL) == 0) pthread_detach(thread);
+    if (use_shm) {
+        if (shm_server_start(queue_push) == 0) printf("Shared-memory transport: %s\n", SHM_NAME);
+        else perror("Warning: shared-memory transport unavailable");
+    }
+
     Message msg;
     while (1) {
         ssize_t bytes = read(fd, &msg, sizeof(msg));
@@ -483,19 +1198,10 @@ int main(int argc, char *argv[]) {
         // Ensure null-termination of strings
         msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
         msg.args[sizeof(msg.args) - 1] = '\0';
+        msg.session = 0;    // only session threads route replies to a session
+        msg.shm_slot = 0;
 
-        switch (msg.command) {
-            case CMD_ADD: handle_add(&msg); break;
-            case CMD_QUERY: handle_query(&msg); break;
-            case CMD_REMOVE: handle_remove(&msg); break;
-            case CMD_LINE_COUNT: handle_line_count(&msg); break;
-            case CMD_SEARCH: handle_search(&msg); break;
-            case CMD_SHUTDOWN: handle_shutdown(&msg); break;
-            default:
-                if (debug_mode) fprintf(stderr, "Unknown command: %d\n", msg.command);
-                send_response(msg.client_fifo, "Error: Unknown command");
-                break;
-        }
+        queue_push(&msg);
     }
 
     close(fd);
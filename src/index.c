@@ -1,159 +1,455 @@
+#define _GNU_SOURCE
 #include "common.h"
 #include "index.h"
+#include "postings.h"
+#include "journal.h"
+#include "indexfile.h"
+#include "doccache.h"
+#include "resultcache.h"
+#include "metacache.h"
+#include "strpool.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
-
-static DocumentMeta docs[MAX_DOCUMENTS];
-static int doc_count = 0;
+#include <pthread.h>
+
+// Document table: a growable array of compact records. Slots are appended
+// in insertion order and removals leave a tombstone (id 0) that is squeezed
+// out later by index_compact(), so the iteration order seen through
+// index_get() never changes.
+// Records hold string handles, not strings: entries loaded from a binary
+// snapshot refer straight into the mapped file; entries added afterwards
+// share interned strings from the string pool.
+typedef struct {
+    int id;
+    uint32_t title, authors, year, path;    // see doc_string()
+} DocRecord;
+
+// Handles with this bit set are offsets into the mapped snapshot
+#define MAPPED_STRING 0x80000000u
+
+static DocRecord *docs = NULL;
+static int doc_capacity = 0;
+static IndexFile mapped;
+static int doc_slots = 0;       // slots in use, including tombstones
+static int doc_count = 0;       // live documents
 static int next_id = 1;
+static char snapshot_file[256] = "data/index.txt";
 
-// LRU Cache
-static CacheEntry cache[MAX_CACHE];
-static int cache_count = 0;
-extern int cache_size;
+// Readers (queries, searches) share the table; mutations take it exclusively.
+// Writers are preferred so a stream of searches cannot starve an add.
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 
-int debug_mode = DEBUG_MODE;
-static int cache_hits = 0;
-static int cache_misses = 0;
+// Primary key index: id -> slot, open addressing with linear probing,
+// resized to stay at most half full
+static int *doc_buckets = NULL;     // slot + 1, 0 = empty
+static unsigned int doc_bucket_count = 0;
 
+int debug_mode = DEBUG_MODE;
 
 void cache_print_stats() {
     if (debug_mode) {
-        printf("[CACHE] Stats → Hits: %d, Misses: %d, Total: %d\n",
-               cache_hits, cache_misses, cache_hits + cache_misses);
+        metacache_print_stats(stdout);
+        doccache_print_stats(stdout, "Server");
+        resultcache_print_stats(stdout);
+        strpool_print_stats(stdout);
     }
 }
 
 
-void cache_move_to_front(int index) {
-    if (index <= 0 || index >= cache_count) return;
-    CacheEntry temp = cache[index];
-    for (int i = index; i > 0; i--) {
-        cache[i] = cache[i - 1];
+static const char *doc_string(uint32_t handle) {
+    if (handle & MAPPED_STRING) return (const char *)mapped.base + (handle & ~MAPPED_STRING);
+    return strpool_get(handle);
+}
+
+// Resolves a record into the DocumentMeta callers see
+static DocumentMeta *doc_meta(const DocRecord *r, DocumentMeta *out) {
+    out->id = r->id;
+    out->title = doc_string(r->title);
+    out->authors = doc_string(r->authors);
+    out->year = doc_string(r->year);
+    out->path = doc_string(r->path);
+    return out;
+}
+
+static int doc_find(int id) {
+    if (!doc_bucket_count) return -1;
+    unsigned int mask = doc_bucket_count - 1;
+    unsigned int h = (unsigned int)id & mask;
+    while (doc_buckets[h]) {
+        int slot = doc_buckets[h] - 1;
+        if (docs[slot].id == id) return slot;
+        h = (h + 1) & mask;
     }
-    cache[0] = temp;
-    if (debug_mode) printf("[CACHE] ID %d movido para o topo (LRU)\n", temp.id);
+    return -1;
 }
 
-void cache_add(int id, DocumentMeta *doc) {
-    for (int i = 0; i < cache_count; i++) {
-        if (cache[i].id == id) {
-            if (debug_mode) printf("[CACHE] ID %d já está na cache — não adicionado novamente\n", id);
-            return;
+static void doc_hash_insert(int id, int slot) {
+    unsigned int mask = doc_bucket_count - 1;
+    unsigned int h = (unsigned int)id & mask;
+    while (doc_buckets[h]) h = (h + 1) & mask;
+    doc_buckets[h] = slot + 1;
+}
+
+static void doc_hash_remove(int id) {
+    if (!doc_bucket_count) return;
+    unsigned int mask = doc_bucket_count - 1;
+    unsigned int h = (unsigned int)id & mask;
+    while (doc_buckets[h] && docs[doc_buckets[h] - 1].id != id) h = (h + 1) & mask;
+    if (!doc_buckets[h]) return;
+    doc_buckets[h] = 0;
+
+    // Backward-shift deletion keeps probe sequences intact without hash tombstones
+    unsigned int i = (h + 1) & mask;
+    while (doc_buckets[i]) {
+        unsigned int home = (unsigned int)docs[doc_buckets[i] - 1].id & mask;
+        if (((i - home) & mask) >= ((i - h) & mask)) {
+            doc_buckets[h] = doc_buckets[i];
+            doc_buckets[i] = 0;
+            h = i;
         }
+        i = (i + 1) & mask;
+    }
+}
+
+// Sized for the slots in use plus room to grow
+static int doc_hash_rebuild() {
+    unsigned int count = 4096;
+    while (count < (unsigned int)doc_slots * 2 + 2) count *= 2;
+    if (count != doc_bucket_count) {
+        int *grown = realloc(doc_buckets, count * sizeof(int));
+        if (!grown) return -1;
+        doc_buckets = grown;
+        doc_bucket_count = count;
+    }
+    memset(doc_buckets, 0, doc_bucket_count * sizeof(int));
+    for (int i = 0; i < doc_slots; i++) {
+        if (docs[i].id) doc_hash_insert(docs[i].id, i);
+    }
+    return 0;
+}
+
+// Room for one more slot in the table and its hash
+static int doc_reserve() {
+    if (doc_slots == doc_capacity) {
+        int new_capacity = doc_capacity ? doc_capacity * 2 : 1024;
+        DocRecord *grown = realloc(docs, new_capacity * sizeof(DocRecord));
+        if (!grown) return -1;
+        docs = grown;
+        doc_capacity = new_capacity;
     }
+    if ((unsigned int)(doc_slots + 1) * 2 > doc_bucket_count) return doc_hash_rebuild();
+    return 0;
+}
 
-    if (cache_count == cache_size) {
-        if (debug_mode) printf("[CACHE] Removido ID %d (mais antigo)\n", cache[cache_count - 1].id);
-        cache_count--;
+// Squeezes tombstones out of docs[], keeping the relative order of live slots
+void index_compact() {
+    if (doc_slots == doc_count) return;
+
+    int w = 0;
+    for (int i = 0; i < doc_slots; i++) {
+        if (!docs[i].id) continue;
+        if (w != i) docs[w] = docs[i];
+        w++;
     }
+    doc_slots = w;
+    doc_hash_rebuild();
+    if (debug_mode) printf("[INDEX] Compactação concluída: %d documentos\n", doc_count);
+}
 
-    for (int i = cache_count; i > 0; i--) {
-        cache[i] = cache[i - 1];
+// Runs on the server's maintenance thread and is skipped while requests hold
+// the table. Compacts once tombstones outnumber live documents, so the cost
+// is amortized over the removals that created them.
+void index_maintenance() {
+    if (pthread_rwlock_trywrlock(&index_lock) != 0) return;
+
+    int tombstones = doc_slots - doc_count;
+    if (tombstones > 64 && tombstones > doc_count) index_compact();
+
+    if (journal_enabled()) {
+        journal_commit();
+        // Fold the log into a fresh snapshot once it holds at least half as
+        // many records as the table: the rewrite stays amortized O(1) per mutation
+        int records = journal_records();
+        if (records >= JOURNAL_COMPACT_MIN && records * 2 >= doc_count) index_save(snapshot_file);
     }
 
-    cache[0].id = id;
-    memcpy(&cache[0].meta, doc, sizeof(DocumentMeta));
-    cache_count++;
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void index_read_lock() {
+    pthread_rwlock_rdlock(&index_lock);
+}
 
-    if (debug_mode) printf("[CACHE] ID %d adicionado\n", id);
+void index_write_lock() {
+    pthread_rwlock_wrlock(&index_lock);
 }
 
+void index_unlock() {
+    pthread_rwlock_unlock(&index_lock);
+}
 
-DocumentMeta* index_query(int id) {
-    for (int i = 0; i < cache_count; i++) {
-        if (cache[i].id == id) {
-            if (debug_mode) printf("[CACHE] HIT: ID %d\n", id);
-            cache_hits++;
-            cache_move_to_front(i);
-            return &cache[0].meta;
-        }
-    }
 
+// Copies the entry into *out: a cache entry may be evicted by another
+// reader as soon as it is returned. The strings stay valid for as long as
+// the caller holds the index read lock.
+DocumentMeta* index_query(int id, DocumentMeta *out) {
+    if (metacache_get(id, out)) {
+        if (debug_mode) printf("[CACHE] HIT: ID %d\n", id);
+        return out;
+    }
     if (debug_mode) printf("[CACHE] MISS: ID %d\n", id);
-    cache_misses++;
 
-    for (int i = 0; i < doc_count; i++) {
-        if (docs[i].id == id) {
-            cache_add(id, &docs[i]);
-            return &docs[i];
-        }
-    }
+    int slot = doc_find(id);
+    if (slot == -1) return NULL;
 
-    return NULL;
+    metacache_put(id, doc_meta(&docs[slot], out));
+    return out;
 }
 
 
+static void snapshot_entry(int id, const DocumentMeta *m, void *arg) {
+    fprintf(arg, "%d|%s|%s|%s|%s\n", id, m->title, m->authors, m->year, m->path);
+}
+
+// The snapshot lists full entries, most recent first, in the index.txt
+// line format. It is written aside and renamed, so a crash mid-write
+// leaves the previous snapshot in place. The caller holds the index read
+// lock: the entries point at the table's strings.
 void cache_export_snapshot(const char *filename) {
     if (!filename) return;
-    
-    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd == -1) {
+
+    char tmpfile[512];
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+    FILE *fp = fopen(tmpfile, "w");
+    if (!fp) {
         if (debug_mode) perror("[CACHE] Error creating snapshot file");
         return;
     }
 
-    char line[512];
+    fprintf(fp, "CACHE v%d\n", CACHE_SNAPSHOT_VERSION);
+    metacache_foreach(snapshot_entry, fp);
 
-    int header_len = snprintf(line, sizeof(line), "Cache Snapshot - %d entries\n", cache_count);
-    if (write(fd, line, header_len) == -1) {
-        if (debug_mode) perror("[CACHE] Error writing header");
-        close(fd);
+    if (fclose(fp) != 0 || rename(tmpfile, filename) == -1) {
+        if (debug_mode) perror("[CACHE] Error writing snapshot");
+        unlink(tmpfile);
         return;
     }
-    
-    for (int i = 0; i < cache_count; i++) {
-        int len = snprintf(line, sizeof(line), "ID %d: %s\n", cache[i].id, cache[i].meta.title);
-        write(fd, line, len);
+    if (debug_mode) printf("[CACHE] Snapshot exportado para %s\n", filename);
+}
+
+// Re-warms the cache after index_load(). Entries are checked against the
+// loaded table, so documents removed (or changed) since the snapshot was
+// taken are dropped. Returns the number of entries restored.
+int cache_import_snapshot(const char *filename) {
+    int capacity = metacache_capacity();
+    if (capacity <= 0) return 0;
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    // Older snapshots only held IDs and titles
+    char line[1024];
+    int version;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "CACHE v%d", &version) != 1 || version != CACHE_SNAPSHOT_VERSION) {
+        fclose(fp);
+        return 0;
     }
 
-    close(fd);
-    if (debug_mode) printf("[CACHE] Snapshot exportado para %s\n", filename);
+    // Most recent first: keep the first capacity valid entries, then
+    // insert them backwards so the head ends up most recent
+    int slots[MAX_CACHE];
+    int n = 0;
+    while (n < capacity && fgets(line, sizeof(line), fp)) {
+        int id;
+        char title[MAX_TITLE+1], authors[MAX_AUTHORS+1], year[MAX_YEAR+1], path[MAX_PATH+1];
+        if (sscanf(line, "%d|%200[^|]|%200[^|]|%4[^|]|%64[^\n]", &id, title, authors, year, path) != 5) continue;
+
+        int slot = doc_find(id);
+        if (slot == -1) continue;
+        DocumentMeta meta;
+        doc_meta(&docs[slot], &meta);
+        if (strcmp(meta.title, title) || strcmp(meta.authors, authors) ||
+            strcmp(meta.year, year) || strcmp(meta.path, path)) continue;
+
+        int dup = 0;
+        for (int i = 0; i < n && !dup; i++) dup = slots[i] == slot;
+        if (!dup) slots[n++] = slot;
+    }
+    fclose(fp);
+
+    DocumentMeta meta;
+    for (int i = n - 1; i >= 0; i--) metacache_put(docs[slots[i]].id, doc_meta(&docs[slots[i]], &meta));
+    if (debug_mode) printf("[CACHE] %d entradas restauradas de %s\n", n, filename);
+    return n;
 }
 
 
-int index_add(const char *title, const char *authors, const char *year, const char *path) {
-    if (doc_count >= MAX_DOCUMENTS) return -1;
+static void doc_free_strings(DocRecord *doc) {
+    uint32_t *handles[] = { &doc->title, &doc->authors, &doc->year, &doc->path };
+    for (int i = 0; i < 4; i++) {
+        if (!(*handles[i] & MAPPED_STRING)) strpool_release(*handles[i]);
+        *handles[i] = 0;
+    }
+}
+
+// Interns the strings of an entry, truncated to the field limits
+static int doc_set_strings(DocRecord *doc, const char *title, const char *authors, const char *year, const char *path) {
+    doc->title = strpool_intern(title, strnlen(title, MAX_TITLE));
+    doc->authors = strpool_intern(authors, strnlen(authors, MAX_AUTHORS));
+    doc->year = strpool_intern(year, strnlen(year, MAX_YEAR));
+    doc->path = strpool_intern(path, strnlen(path, MAX_PATH));
+    if (doc->title && doc->authors && doc->year && doc->path) return 0;
+    doc_free_strings(doc);
+    return -1;
+}
+
+// Inserts a fully described document without touching the journal.
+// Terms already collected by index_prepare() are used as-is; otherwise
+// (journal replay) the document is tokenized here.
+static int index_insert(int id, const char *title, const char *authors, const char *year, const char *path,
+                        const PostingsTerms *terms) {
+    if (doc_reserve() == -1) return -1;
+
+    int slot = doc_slots;
+    if (doc_set_strings(&docs[slot], title, authors, year, path) == -1) return -1;
+    docs[slot].id = id;
+
+    // Without terms, or when the content they deferred to is gone, the
+    // file is read here
+    if (!terms || postings_add_terms(id, terms) == -1) {
+        char fullpath[512];
+        snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path);
+        postings_add_document(id, fullpath);
+    }
+
+    doc_hash_insert(id, slot);
+    doc_slots++;
+    doc_count++;
+    if (id >= next_id) next_id = id + 1;
+    return id;
+}
+
+static int index_delete(int id) {
+    int slot = doc_find(id);
+    if (slot == -1) return -1;
 
-    docs[doc_count].id = next_id++;
+    doc_hash_remove(id);
+    docs[slot].id = 0;
+    doc_count--;
+    metacache_remove(id);
+    doc_free_strings(&docs[slot]);
+    postings_remove_document(id);
+    return 0;
+}
+
+// The expensive part of an add: reads the file for its metadata and terms.
+// Needs no lock, so a batch can prepare many documents in parallel. Content
+// that is already indexed is neither tokenized nor searched for metadata:
+// both are taken from its twin when the document is inserted.
+int index_prepare(PreparedDocument *doc, const char *year, const char *path) {
+    strncpy(doc->title, "Desconhecido", MAX_TITLE);
+    strncpy(doc->authors, "Desconhecido", MAX_AUTHORS);
+    snprintf(doc->year, sizeof(doc->year), "%s", year);
+    snprintf(doc->path, sizeof(doc->path), "%s", path);
 
-    char real_title[MAX_TITLE + 1] = "Desconhecido";
-    char real_author[MAX_AUTHORS + 1] = "Desconhecido";
     char fullpath[512];
     snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, path);
-    extract_metadata(fullpath, real_title, sizeof(real_title), real_author, sizeof(real_author));
+    int rc = postings_tokenize(fullpath, &doc->terms);
+    if (rc == 0 && doc->terms.twin) return 0;
+    extract_metadata(fullpath, doc->title, sizeof(doc->title), doc->authors, sizeof(doc->authors));
+    return rc;
+}
 
-    strncpy(docs[doc_count].title, real_title, MAX_TITLE);
-    strncpy(docs[doc_count].authors, real_author, MAX_AUTHORS);
-    strncpy(docs[doc_count].year, year, MAX_YEAR);
-    strncpy(docs[doc_count].path, path, MAX_PATH);
+// Hands out an ID ahead of index_add_prepared_as(); caller holds the write lock
+int index_reserve_id() {
+    return next_id++;
+}
 
-    doc_count++;
-    return docs[doc_count - 1].id;
+// Assigns the next ID and journals the add; caller holds the write lock
+int index_add_prepared(PreparedDocument *prepared) {
+    return index_add_prepared_as(prepared, next_id);
 }
 
-int index_remove(int id) {
-    for (int i = 0; i < doc_count; i++) {
-        if (docs[i].id == id) {
-            for (int j = i; j < doc_count - 1; j++) {
-                docs[j] = docs[j + 1];
-            }
-            doc_count--;
-            return 0;
+// Same, under an ID from index_reserve_id()
+int index_add_prepared_as(PreparedDocument *prepared, int id) {
+    if (prepared->terms.twin) {
+        // Title and authors come from the content, so the twin has them
+        int twin = postings_find_content(prepared->terms.hash, prepared->terms.size);
+        int slot = twin ? doc_find(twin) : -1;
+        if (slot != -1) {
+            DocumentMeta meta;
+            doc_meta(&docs[slot], &meta);
+            snprintf(prepared->title, sizeof(prepared->title), "%s", meta.title);
+            snprintf(prepared->authors, sizeof(prepared->authors), "%s", meta.authors);
+        } else {
+            char fullpath[512];
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, prepared->path);
+            extract_metadata(fullpath, prepared->title, sizeof(prepared->title),
+                             prepared->authors, sizeof(prepared->authors));
         }
     }
-    return -1;
+
+    id = index_insert(id, prepared->title, prepared->authors, prepared->year, prepared->path,
+                          &prepared->terms);
+    if (id <= 0) return id;
+
+    DocumentMeta meta;
+    DocumentMeta *doc = doc_meta(&docs[doc_find(id)], &meta);
+    resultcache_note_add(id, doc->path);
+    if (journal_enabled()) {
+        // Read back the stored (truncated) fields so replay reproduces them exactly
+        char record[1024];
+        snprintf(record, sizeof(record), "A|%d|%s|%s|%s|%s",
+                 doc->id, doc->title, doc->authors, doc->year, doc->path);
+        journal_append(record);
+    }
+    return id;
 }
 
-int index_load(const char *filename) {
+int index_add(const char *title, const char *authors, const char *year, const char *path) {
+    (void)title;
+    (void)authors;
+
+    PreparedDocument prepared;
+    index_prepare(&prepared, year, path);
+    int id = index_add_prepared(&prepared);
+    postings_terms_free(&prepared.terms);
+    return id;
+}
+
+int index_remove(int id) {
+    if (index_delete(id) == -1) return -1;
+    resultcache_note_remove(id);
+
+    if (journal_enabled()) {
+        char record[32];
+        snprintf(record, sizeof(record), "R|%d", id);
+        journal_append(record);
+    }
+    return 0;
+}
+
+// Replay callback: records are idempotent, since a crash between writing a
+// snapshot and resetting the log replays records the snapshot already holds
+static void index_apply(const char *payload) {
+    int id;
+    char title[MAX_TITLE+1], authors[MAX_AUTHORS+1], year[MAX_YEAR+1], path[MAX_PATH+1];
+
+    if (payload[0] == 'A' && sscanf(payload, "A|%d|%200[^|]|%200[^|]|%4[^|]|%64[^\n]",
+                                    &id, title, authors, year, path) == 5) {
+        if (doc_find(id) == -1) index_insert(id, title, authors, year, path, NULL);
+    } else if (payload[0] == 'R' && sscanf(payload, "R|%d", &id) == 1) {
+        index_delete(id);
+        if (id >= next_id) next_id = id + 1;
+    }
+}
+
+static int index_load_text(const char *filename) {
     FILE *fp = fopen(filename, "r");
     if (!fp) return 0;
 
-    doc_count = 0;
-    next_id = 1;
-
     char line[1024];
     while (fgets(line, sizeof(line), fp)) {
         int id;
@@ -162,15 +458,13 @@ int index_load(const char *filename) {
         if (sscanf(line, "%d|%200[^|]|%200[^|]|%4[^|]|%64[^\n]",
                    &id, title, authors, year, path) == 5) {
 
+            if (doc_reserve() == -1 ||
+                doc_set_strings(&docs[doc_count], title, authors, year, path) == -1) break;
             docs[doc_count].id = id;
-            strncpy(docs[doc_count].title, title, MAX_TITLE);
-            strncpy(docs[doc_count].authors, authors, MAX_AUTHORS);
-            strncpy(docs[doc_count].year, year, MAX_YEAR);
-            strncpy(docs[doc_count].path, path, MAX_PATH);
 
             if (id >= next_id) next_id = id + 1;
             doc_count++;
-            if (doc_count >= MAX_DOCUMENTS) break;
+            doc_slots = doc_count;
         }
     }
 
@@ -178,6 +472,84 @@ int index_load(const char *filename) {
     return 1;
 }
 
+// Entries reference the mapping directly: no parsing and no string copies
+static int index_load_binary(const char *filename) {
+    if (indexfile_open(filename, &mapped) == -1) return 0;
+    // Mapped handles are 31-bit offsets
+    if (mapped.size > MAPPED_STRING) {
+        indexfile_close(&mapped);
+        return 0;
+    }
+
+    const IndexFileHeader *h = mapped.header;
+    uint32_t heap = h->heap_offset;
+    for (uint32_t i = 0; i < h->record_count; i++) {
+        const IndexRecord *r = &mapped.records[i];
+        if (doc_reserve() == -1) break;
+        docs[doc_count].id = r->id;
+        docs[doc_count].title = MAPPED_STRING | (heap + r->title);
+        docs[doc_count].authors = MAPPED_STRING | (heap + r->authors);
+        docs[doc_count].year = MAPPED_STRING | (uint32_t)((const char *)r->year - (const char *)mapped.base);
+        docs[doc_count].path = MAPPED_STRING | (heap + r->path);
+        if (r->id >= next_id) next_id = r->id + 1;
+        doc_count++;
+        doc_slots = doc_count;
+    }
+    if ((int)h->next_id > next_id) next_id = h->next_id;
+    return 1;
+}
+
+static int is_binary_file(const char *filename) {
+    size_t len = strlen(filename);
+    return len > 4 && strcmp(filename + len - 4, ".bin") == 0;
+}
+
+int index_load(const char *filename) {
+    strncpy(snapshot_file, filename, sizeof(snapshot_file) - 1);
+
+    doc_slots = 0;
+    doc_count = 0;
+    next_id = 1;
+
+    int loaded;
+    if (is_binary_file(filename)) {
+        loaded = index_load_binary(filename);
+        if (!loaded) {
+            // First start after switching formats: read the text index it
+            // replaces; the next snapshot is written in binary
+            char textfile[256];
+            snprintf(textfile, sizeof(textfile), "%.*s.txt", (int)strlen(filename) - 4, filename);
+            loaded = index_load_text(textfile);
+        }
+    } else {
+        loaded = index_load_text(filename);
+    }
+
+    if (!loaded) {
+        // No snapshot yet, but the journal may still hold every mutation
+        if (journal_enabled() && journal_replay(JOURNAL_FILE, index_apply) > 0) return 1;
+        return 0;
+    }
+
+    doc_slots = doc_count;
+    doc_hash_rebuild();
+
+    // Rebuild the inverted index if it is missing or out of date
+    if (!postings_load(POSTINGS_FILE, doc_count, next_id)) {
+        postings_clear();
+        char fullpath[512];
+        for (int i = 0; i < doc_count; i++) {
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", document_folder, doc_string(docs[i].path));
+            postings_add_document(docs[i].id, fullpath);
+        }
+        postings_save(POSTINGS_FILE, doc_count, next_id);
+    }
+
+    // Mutations made after the snapshot was written
+    if (journal_enabled()) journal_replay(JOURNAL_FILE, index_apply);
+    return 1;
+}
+
 int extract_metadata(const char *filepath, char *title, size_t max_title, char *author, size_t max_author) {
     FILE *fp = fopen(filepath, "r");
     if (!fp) return -1;
@@ -204,34 +576,76 @@ int extract_metadata(const char *filepath, char *title, size_t max_title, char *
     return 0;
 }
 
-int index_save(const char *filename) {
+static int index_save_text(const char *filename) {
     int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
     if (fd == -1) return 0;
 
     char buffer[1024];
-    for (int i = 0; i < doc_count; i++) {
+    DocumentMeta meta;
+    for (int i = 0; i < doc_slots; i++) {
+        if (!docs[i].id) continue;
+        DocumentMeta *doc = doc_meta(&docs[i], &meta);
         int len = snprintf(buffer, sizeof(buffer), "%d|%s|%s|%s|%s\n",
-                           docs[i].id,
-                           docs[i].title,
-                           docs[i].authors,
-                           docs[i].year,
-                           docs[i].path);
+                           doc->id,
+                           doc->title,
+                           doc->authors,
+                           doc->year,
+                           doc->path);
         write(fd, buffer, len);
     }
 
+    if (journal_enabled()) fsync(fd);
     close(fd);
     return 1;
 }
 
+// Written aside and renamed, so a crash never leaves a half-written snapshot.
+// A mapped binary snapshot stays valid after the rename: its inode lives
+// on while mapped, so entries pointing into it are unaffected.
+static int index_save_snapshot(const char *filename, int with_postings) {
+    char tmpfile[512];
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+
+    int saved = is_binary_file(filename)
+                    ? indexfile_write(tmpfile, index_get, doc_slots, next_id) == 0
+                    : index_save_text(tmpfile);
+    if (!saved || rename(tmpfile, filename) == -1) return 0;
+    if (!with_postings) return 1;
+    // Keep the journal until the postings match the snapshot too
+    if (!postings_save(POSTINGS_FILE, doc_count, next_id)) return 0;
+
+    // The snapshot now covers every journaled mutation
+    journal_reset();
+    return 1;
+}
+
+int index_save(const char *filename) {
+    return index_save_snapshot(filename, 1);
+}
+
+// Makes the latest mutations durable according to the persistence mode.
+// A snapshot after a single add/remove leaves the postings file alone, as
+// rewriting it is O(corpus): its header then no longer matches the index
+// and index_load() rebuilds it, unless a batch or the shutdown saved it first.
+int index_persist(const char *filename, int mutations) {
+    if (journal_enabled()) return journal_commit() == 0;
+    return index_save_snapshot(filename, mutations > 1);
+}
+
+// Number of slots to iterate with index_get(); removed slots yield NULL
 int index_total() {
-    return doc_count;
+    return doc_slots;
 }
 
-DocumentMeta* index_get(int i) {
-    if (i >= 0 && i < doc_count) return &docs[i];
+DocumentMeta* index_get(int i, DocumentMeta *out) {
+    if (i >= 0 && i < doc_slots && docs[i].id) return doc_meta(&docs[i], out);
     return NULL;
 }
 
+int index_contains(int id) {
+    return doc_find(id) != -1;
+}
+
 int index_get_count() {
     return doc_count;
 }
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "common.h"
+#include "indexfile.h"
+
+// Converts a pipe-delimited text index (id|title|authors|year|path) into the
+// binary format mapped by dserver.
+
+static DocumentMeta *docs = NULL;
+
+static DocumentMeta *get_doc(int i, DocumentMeta *out) {
+    *out = docs[i];
+    return out;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <index.txt> <index.bin>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp) {
+        perror("open text index");
+        return EXIT_FAILURE;
+    }
+
+    int count = 0, capacity = 0, next_id = 1;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp)) {
+        int id;
+        char title[MAX_TITLE+1], authors[MAX_AUTHORS+1], year[MAX_YEAR+1], path[MAX_PATH+1];
+
+        if (sscanf(line, "%d|%200[^|]|%200[^|]|%4[^|]|%64[^\n]",
+                   &id, title, authors, year, path) != 5) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            DocumentMeta *grown = realloc(docs, capacity * sizeof(DocumentMeta));
+            if (!grown) {
+                fprintf(stderr, "Error: out of memory\n");
+                fclose(fp);
+                return EXIT_FAILURE;
+            }
+            docs = grown;
+        }
+
+        docs[count].id = id;
+        docs[count].title = strdup(title);
+        docs[count].authors = strdup(authors);
+        docs[count].year = strdup(year);
+        docs[count].path = strdup(path);
+        if (id >= next_id) next_id = id + 1;
+        count++;
+    }
+    fclose(fp);
+
+    if (indexfile_write(argv[2], get_doc, count, next_id) == -1) {
+        perror("write binary index");
+        return EXIT_FAILURE;
+    }
+
+    printf("Converted %d documents (next id %d) to %s\n", count, next_id, argv[2]);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+#include "common.h"
+#include "indexfile.h"
+#include <sys/mman.h>
+
+int indexfile_open(const char *filename, IndexFile *file) {
+    memset(file, 0, sizeof(*file));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    const IndexFileHeader *h = base;
+    size_t records_end = sizeof(IndexFileHeader) + (size_t)h->record_count * sizeof(IndexRecord);
+    if (memcmp(h->magic, INDEXFILE_MAGIC, 4) != 0 ||
+        h->version != INDEXFILE_VERSION ||
+        h->record_size != sizeof(IndexRecord) ||
+        h->heap_offset < records_end ||
+        (size_t)h->heap_offset + h->heap_size > (size_t)st.st_size ||
+        h->heap_size == 0 ||
+        ((const char *)base)[h->heap_offset + h->heap_size - 1] != '\0') {
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    // Every string offset must land inside the heap
+    const IndexRecord *r = (const IndexRecord *)((const char *)base + sizeof(IndexFileHeader));
+    for (uint32_t i = 0; i < h->record_count; i++) {
+        if (r[i].title >= h->heap_size || r[i].authors >= h->heap_size ||
+            r[i].path >= h->heap_size || r[i].year[sizeof(r[i].year) - 1] != '\0') {
+            munmap(base, st.st_size);
+            return -1;
+        }
+    }
+
+    file->base = base;
+    file->size = st.st_size;
+    file->header = h;
+    file->records = r;
+    file->heap = (const char *)base + h->heap_offset;
+    return 0;
+}
+
+void indexfile_close(IndexFile *file) {
+    if (file->base) munmap(file->base, file->size);
+    memset(file, 0, sizeof(*file));
+}
+
+// String heap under construction; a hash of the offsets already written
+// lets repeated titles, authors and paths share one copy
+typedef struct {
+    char *data;
+    size_t len, cap;
+    uint32_t *table;        // offset + 1, 0 = empty
+    size_t table_size, count;
+} Heap;
+
+static unsigned int heap_hash(const char *s) {
+    unsigned int h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int heap_table_grow(Heap *heap) {
+    size_t new_size = heap->table_size ? heap->table_size * 2 : 4096;
+    uint32_t *new_table = calloc(new_size, sizeof(uint32_t));
+    if (!new_table) return -1;
+    for (size_t i = 0; i < heap->table_size; i++) {
+        if (!heap->table[i]) continue;
+        size_t h = heap_hash(heap->data + heap->table[i] - 1) & (new_size - 1);
+        while (new_table[h]) h = (h + 1) & (new_size - 1);
+        new_table[h] = heap->table[i];
+    }
+    free(heap->table);
+    heap->table = new_table;
+    heap->table_size = new_size;
+    return 0;
+}
+
+static uint32_t heap_append(Heap *heap, const char *s) {
+    if ((heap->count + 1) * 2 > heap->table_size && heap_table_grow(heap) == -1) return UINT32_MAX;
+
+    size_t h = heap_hash(s) & (heap->table_size - 1);
+    while (heap->table[h]) {
+        if (strcmp(heap->data + heap->table[h] - 1, s) == 0) return heap->table[h] - 1;
+        h = (h + 1) & (heap->table_size - 1);
+    }
+
+    size_t n = strlen(s) + 1;
+    if (heap->len + n > heap->cap) {
+        size_t new_cap = heap->cap ? heap->cap * 2 : 65536;
+        while (new_cap < heap->len + n) new_cap *= 2;
+        char *new_data = realloc(heap->data, new_cap);
+        if (!new_data) return UINT32_MAX;
+        heap->data = new_data;
+        heap->cap = new_cap;
+    }
+    memcpy(heap->data + heap->len, s, n);
+    uint32_t offset = heap->len;
+    heap->len += n;
+    heap->table[h] = offset + 1;
+    heap->count++;
+    return offset;
+}
+
+// Writes the live entries of slots [0, count) to filename
+int indexfile_write(const char *filename, indexfile_get_fn get, int count, int next_id) {
+    DocumentMeta meta;
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        if (get(i, &meta)) live++;
+    }
+
+    IndexRecord *records = calloc(live ? live : 1, sizeof(IndexRecord));
+    Heap heap = { NULL, 0, 0, NULL, 0, 0 };
+    if (!records) return -1;
+
+    // Offset 0 is a shared empty string
+    heap_append(&heap, "");
+
+    int r = 0;
+    for (int i = 0; i < count && r < live; i++) {
+        DocumentMeta *doc = get(i, &meta);
+        if (!doc) continue;
+        records[r].id = doc->id;
+        records[r].title = heap_append(&heap, doc->title);
+        records[r].authors = heap_append(&heap, doc->authors);
+        records[r].path = heap_append(&heap, doc->path);
+        strncpy(records[r].year, doc->year, sizeof(records[r].year) - 1);
+        if (records[r].title == UINT32_MAX || records[r].authors == UINT32_MAX ||
+            records[r].path == UINT32_MAX) {
+            free(records);
+            free(heap.data);
+            free(heap.table);
+            return -1;
+        }
+        r++;
+    }
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEXFILE_MAGIC, 4);
+    header.version = INDEXFILE_VERSION;
+    header.record_count = live;
+    header.record_size = sizeof(IndexRecord);
+    header.next_id = next_id;
+    header.heap_offset = sizeof(header) + (size_t)live * sizeof(IndexRecord);
+    header.heap_size = heap.len;
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int ok = fd != -1 &&
+             write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+             write(fd, records, (size_t)live * sizeof(IndexRecord)) == (ssize_t)((size_t)live * sizeof(IndexRecord)) &&
+             write(fd, heap.data, heap.len) == (ssize_t)heap.len;
+    if (fd != -1) {
+        if (ok) fsync(fd);
+        close(fd);
+    }
+
+    free(records);
+    free(heap.data);
+    free(heap.table);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,169 @@
+#include "common.h"
+#include "index.h"
+#include "ingest.h"
+#include <pthread.h>
+
+#define FAILED_SIZE 256         // recent failures kept for ingest_status()
+
+typedef struct {
+    int id;
+    int cancelled;              // removed while still queued
+    char year[MAX_YEAR + 1];
+    char path[MAX_PATH + 1];
+} IngestItem;
+
+// Items leave the queue only once inserted, under the index write lock:
+// while a caller holds that lock, every reserved ID not yet in the table
+// is in the queue
+static IngestItem queue[INGEST_QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_len = 0;
+static int failed[FAILED_SIZE];
+static int failed_next = 0;
+static int enabled = 0;
+static int stopping = 0;
+static const char *persist_file = NULL;
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_empty = PTHREAD_COND_INITIALIZER;
+
+static IngestItem *queue_at(int i) {
+    return &queue[(queue_head + i) % INGEST_QUEUE_SIZE];
+}
+
+static void *ingest_thread(void *arg) {
+    (void)arg;
+    static IngestItem batch[INGEST_BATCH];
+    static PreparedDocument docs[INGEST_BATCH];
+    int readable[INGEST_BATCH];
+
+    for (;;) {
+        pthread_mutex_lock(&ingest_lock);
+        while (queue_len == 0) pthread_cond_wait(&queue_not_empty, &ingest_lock);
+        int n = queue_len < INGEST_BATCH ? queue_len : INGEST_BATCH;
+        for (int i = 0; i < n; i++) batch[i] = *queue_at(i);
+        pthread_mutex_unlock(&ingest_lock);
+
+        // The slow part, with no lock held: searches and queries go on
+        for (int i = 0; i < n; i++) {
+            readable[i] = index_prepare(&docs[i], batch[i].year, batch[i].path) == 0;
+        }
+
+        index_write_lock();
+        pthread_mutex_lock(&ingest_lock);
+        int added = 0;
+        for (int i = 0; i < n; i++) {
+            int ok = 0;
+            if (queue_at(i)->cancelled) {
+                ok = 1;
+            } else if (readable[i]) {
+                ok = index_add_prepared_as(&docs[i], batch[i].id) > 0;
+                added += ok;
+            }
+            if (!ok) {
+                failed[failed_next] = batch[i].id;
+                failed_next = (failed_next + 1) % FAILED_SIZE;
+            }
+            postings_terms_free(&docs[i].terms);
+        }
+        queue_head = (queue_head + n) % INGEST_QUEUE_SIZE;
+        queue_len -= n;
+        if (queue_len == 0) pthread_cond_broadcast(&queue_empty);
+        pthread_mutex_unlock(&ingest_lock);
+
+        if (added > 0) index_persist(persist_file, added);
+        index_unlock();
+    }
+    return NULL;
+}
+
+int ingest_start(const char *index_file) {
+    persist_file = index_file;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ingest_thread, NULL) != 0) return -1;
+    pthread_detach(thread);
+    enabled = 1;
+    return 0;
+}
+
+int ingest_enabled() {
+    return enabled;
+}
+
+// Reserves an ID for the document and queues it; caller holds the write
+// lock. Returns the ID, -1 if the queue is full, -2 once stopped.
+int ingest_submit(const char *year, const char *path) {
+    pthread_mutex_lock(&ingest_lock);
+    if (stopping || queue_len == INGEST_QUEUE_SIZE) {
+        int rc = stopping ? -2 : -1;
+        pthread_mutex_unlock(&ingest_lock);
+        return rc;
+    }
+    IngestItem *item = queue_at(queue_len);
+    memset(item, 0, sizeof(*item));
+    item->id = index_reserve_id();
+    snprintf(item->year, sizeof(item->year), "%s", year);
+    snprintf(item->path, sizeof(item->path), "%s", path);
+    queue_len++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&ingest_lock);
+    return item->id;
+}
+
+// Drops a queued add; caller holds the write lock. 1 if the ID was queued.
+int ingest_cancel(int id) {
+    int found = 0;
+    pthread_mutex_lock(&ingest_lock);
+    for (int i = 0; i < queue_len && !found; i++) {
+        IngestItem *item = queue_at(i);
+        if (item->id == id && !item->cancelled) {
+            item->cancelled = 1;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&ingest_lock);
+    return found;
+}
+
+// Caller holds the index lock (read or write)
+int ingest_status(int id) {
+    if (index_contains(id)) return INGEST_INDEXED;
+
+    int status = INGEST_UNKNOWN;
+    pthread_mutex_lock(&ingest_lock);
+    for (int i = 0; i < queue_len; i++) {
+        if (queue_at(i)->id == id) {
+            status = queue_at(i)->cancelled ? INGEST_UNKNOWN : INGEST_PENDING;
+            break;
+        }
+    }
+    for (int i = 0; i < FAILED_SIZE && status == INGEST_UNKNOWN; i++) {
+        if (failed[i] == id && id > 0) status = INGEST_FAILED;
+    }
+    pthread_mutex_unlock(&ingest_lock);
+    return status;
+}
+
+// Reserved IDs not yet inserted; exact while the caller holds the index lock
+int ingest_pending() {
+    pthread_mutex_lock(&ingest_lock);
+    int n = queue_len;
+    pthread_mutex_unlock(&ingest_lock);
+    return n;
+}
+
+// Waits until every queued add is inserted; caller holds no index lock
+void ingest_drain() {
+    pthread_mutex_lock(&ingest_lock);
+    while (queue_len > 0) pthread_cond_wait(&queue_empty, &ingest_lock);
+    pthread_mutex_unlock(&ingest_lock);
+}
+
+// Refuses further adds and waits for the queued ones, before shutdown
+void ingest_stop() {
+    if (!enabled) return;
+    pthread_mutex_lock(&ingest_lock);
+    stopping = 1;
+    pthread_mutex_unlock(&ingest_lock);
+    ingest_drain();
+}
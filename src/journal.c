@@ -0,0 +1,155 @@
+#include "common.h"
+#include "journal.h"
+
+// Pending records are forced to disk at most this long after being written
+#define JOURNAL_GROUP_MS 100
+
+static int journal_fd = -1;
+static int sync_policy = JOURNAL_SYNC_GROUP;
+static int group_size = 32;
+static int pending = 0;             // records written since the last fsync
+static struct timespec pending_since;
+static int records = 0;             // records since the last reset
+
+static unsigned int crc_table[256];
+static int crc_ready = 0;
+
+static unsigned int crc32(const char *data, size_t len) {
+    if (!crc_ready) {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+        crc_ready = 1;
+    }
+
+    unsigned int crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+int journal_open(const char *filename, int policy, int group) {
+    journal_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (journal_fd == -1) return -1;
+
+    sync_policy = policy;
+    group_size = group > 0 ? group : 1;
+    pending = 0;
+    return 0;
+}
+
+void journal_close() {
+    if (journal_fd == -1) return;
+    journal_flush();
+    close(journal_fd);
+    journal_fd = -1;
+}
+
+int journal_enabled() {
+    return journal_fd != -1;
+}
+
+int journal_append(const char *payload) {
+    if (journal_fd == -1) return -1;
+
+    char record[1024];
+    int len = snprintf(record, sizeof(record), "%08x|%s\n", crc32(payload, strlen(payload)), payload);
+    if (len < 0 || (size_t)len >= sizeof(record)) return -1;
+
+    // O_APPEND + a single write keeps each record contiguous in the file
+    if (write(journal_fd, record, len) != len) return -1;
+
+    if (pending == 0) clock_gettime(CLOCK_MONOTONIC, &pending_since);
+    pending++;
+    records++;
+    return 0;
+}
+
+int journal_flush() {
+    if (journal_fd == -1 || pending == 0) return 0;
+    pending = 0;
+    return fsync(journal_fd);
+}
+
+// Applies the sync policy; called after each mutation and between requests
+int journal_commit() {
+    if (journal_fd == -1 || pending == 0) return 0;
+
+    switch (sync_policy) {
+        case JOURNAL_SYNC_ALWAYS:
+            return journal_flush();
+        case JOURNAL_SYNC_GROUP: {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed_ms = (now.tv_sec - pending_since.tv_sec) * 1000 +
+                              (now.tv_nsec - pending_since.tv_nsec) / 1000000;
+            if (pending >= group_size || elapsed_ms >= JOURNAL_GROUP_MS) return journal_flush();
+            return 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Replays every intact record in order. Replay stops at the first record that
+// is incomplete or fails its checksum (a torn write from a crash), and the
+// file is truncated there so new records are appended after valid data.
+int journal_replay(const char *filename, journal_apply_fn apply) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    off_t good_offset = 0;
+    int replayed = 0;
+    int torn = 0;
+
+    while ((len = getline(&line, &line_cap, fp)) > 0) {
+        if (line[len - 1] != '\n' || len < 10 || line[8] != '|') {
+            torn = 1;
+            break;
+        }
+        line[len - 1] = '\0';
+
+        char *end;
+        unsigned long crc = strtoul(line, &end, 16);
+        const char *payload = line + 9;
+        if (end != line + 8 || crc != crc32(payload, strlen(payload))) {
+            torn = 1;
+            break;
+        }
+
+        apply(payload);
+        replayed++;
+        good_offset += len;
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (torn) {
+        fprintf(stderr, "[JOURNAL] Registo incompleto ou corrompido em %s (offset %lld), ignorado\n",
+                filename, (long long)good_offset);
+        truncate(filename, good_offset);
+    }
+
+    records = replayed;
+    return replayed;
+}
+
+// Called once a snapshot covers every record in the log
+int journal_reset() {
+    if (journal_fd == -1) return 0;
+    if (ftruncate(journal_fd, 0) == -1) return -1;
+    pending = 0;
+    records = 0;
+    return fsync(journal_fd);
+}
+
+int journal_records() {
+    return records;
+}
@@ -0,0 +1,284 @@
+#include "common.h"
+#include "metacache.h"
+#include <pthread.h>
+
+// Entries never move once stored. A hash on the ID finds the entry and an
+// intrusive doubly-linked list per segment (head = most recent) keeps the
+// recency order, so hits and inserts are O(1) relinks.
+// Plain LRU is the degenerate case of W-TinyLFU: an empty window whose
+// every candidate is admitted to the main segment.
+#define METACACHE_BUCKETS 1024
+#define WINDOW 0
+#define MAIN 1
+
+typedef struct {
+    int id;
+    DocumentMeta meta;
+    int prev, next;     // segment list links (-1 = none)
+    int hash_next;      // next entry in the same hash bucket + 1, 0 = none
+    int segment;
+} CacheEntry;
+
+typedef struct {
+    int head, tail;
+    int count, limit;
+} Segment;
+
+// One spare entry: an insert overflows the window before its tail moves on
+static CacheEntry entries[MAX_CACHE + 1];
+static int buckets[METACACHE_BUCKETS];     // entry index + 1, 0 = empty
+static Segment segments[2];
+static int free_list = -1;     // entries released by eviction or removal
+static int used = 0;
+static int capacity = 0;
+static int policy = METACACHE_LRU;
+
+static long hits = 0, misses = 0, rejected = 0;
+static FILE *trace = NULL;
+
+// Count-min sketch of lookup frequencies: 4 rows of saturating 4-bit
+// counters, all halved once the sample reaches 10 lookups per entry so
+// the counts follow the recent workload
+#define SKETCH_ROWS 4
+#define SKETCH_MAX_WIDTH 4096
+#define SKETCH_COUNTER_MAX 15
+
+static unsigned char sketch[SKETCH_ROWS][SKETCH_MAX_WIDTH];
+static unsigned int sketch_mask = 0;
+static int sketch_samples = 0;
+static int sketch_sample_size = 0;
+
+static pthread_mutex_t metacache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t id_mix(int id) {
+    uint64_t h = (uint64_t)(unsigned int)id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Each row indexes with its own 16 bits of the mixed ID
+static void sketch_increment(int id) {
+    uint64_t h = id_mix(id);
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        unsigned char *c = &sketch[r][(h >> (16 * r)) & sketch_mask];
+        if (*c < SKETCH_COUNTER_MAX) (*c)++;
+    }
+
+    if (++sketch_samples >= sketch_sample_size) {
+        for (int r = 0; r < SKETCH_ROWS; r++) {
+            for (unsigned int i = 0; i <= sketch_mask; i++) sketch[r][i] >>= 1;
+        }
+        sketch_samples /= 2;
+    }
+}
+
+static int sketch_frequency(int id) {
+    uint64_t h = id_mix(id);
+    int f = SKETCH_COUNTER_MAX;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        int c = sketch[r][(h >> (16 * r)) & sketch_mask];
+        if (c < f) f = c;
+    }
+    return f;
+}
+
+void metacache_init(int size, int cache_policy) {
+    pthread_mutex_lock(&metacache_lock);
+    capacity = size < 0 ? 0 : size > MAX_CACHE ? MAX_CACHE : size;
+    policy = cache_policy;
+
+    memset(buckets, 0, sizeof(buckets));
+    free_list = -1;
+    used = 0;
+    hits = misses = rejected = 0;
+
+    // The window holds 1% of the entries (at least one) under TinyLFU
+    int window = policy == METACACHE_TINYLFU && capacity > 0 ? capacity / 100 : 0;
+    if (policy == METACACHE_TINYLFU && capacity > 0 && window < 1) window = 1;
+    segments[WINDOW] = (Segment){ -1, -1, 0, window };
+    segments[MAIN] = (Segment){ -1, -1, 0, capacity - window };
+
+    unsigned int width = 64;
+    while (width < (unsigned int)capacity * 8 && width < SKETCH_MAX_WIDTH) width *= 2;
+    sketch_mask = width - 1;
+    sketch_samples = 0;
+    sketch_sample_size = capacity > 0 ? capacity * 10 : 1;
+    memset(sketch, 0, sizeof(sketch));
+    pthread_mutex_unlock(&metacache_lock);
+}
+
+int metacache_policy(const char *name) {
+    if (strcmp(name, "lru") == 0) return METACACHE_LRU;
+    if (strcmp(name, "tinylfu") == 0) return METACACHE_TINYLFU;
+    return -1;
+}
+
+const char *metacache_policy_name() {
+    return policy == METACACHE_TINYLFU ? "tinylfu" : "lru";
+}
+
+int metacache_capacity() {
+    return capacity;
+}
+
+static int entry_find(int id) {
+    int i = buckets[(unsigned int)id & (METACACHE_BUCKETS - 1)] - 1;
+    while (i != -1 && entries[i].id != id) i = entries[i].hash_next - 1;
+    return i;
+}
+
+static void segment_unlink(int index) {
+    CacheEntry *e = &entries[index];
+    Segment *s = &segments[e->segment];
+    if (e->prev != -1) entries[e->prev].next = e->next;
+    else s->head = e->next;
+    if (e->next != -1) entries[e->next].prev = e->prev;
+    else s->tail = e->prev;
+    s->count--;
+}
+
+static void segment_link_front(int segment, int index) {
+    Segment *s = &segments[segment];
+    entries[index].segment = segment;
+    entries[index].prev = -1;
+    entries[index].next = s->head;
+    if (s->head != -1) entries[s->head].prev = index;
+    s->head = index;
+    if (s->tail == -1) s->tail = index;
+    s->count++;
+}
+
+static void hash_remove(int index) {
+    int *link = &buckets[(unsigned int)entries[index].id & (METACACHE_BUCKETS - 1)];
+    while (*link - 1 != index) link = &entries[*link - 1].hash_next;
+    *link = entries[index].hash_next;
+}
+
+// Releases an entry already unlinked from its segment
+static void entry_drop(int index) {
+    hash_remove(index);
+    entries[index].next = free_list;
+    free_list = index;
+}
+
+// The window overflowed: its tail either moves to the main segment or is
+// dropped, whichever of it and the main victim the sketch has seen less
+static void window_evict() {
+    int candidate = segments[WINDOW].tail;
+    segment_unlink(candidate);
+
+    Segment *main = &segments[MAIN];
+    if (main->count < main->limit) {
+        segment_link_front(MAIN, candidate);
+        return;
+    }
+
+    int victim = main->tail;
+    if (victim != -1 && (policy == METACACHE_LRU ||
+                         sketch_frequency(entries[candidate].id) > sketch_frequency(entries[victim].id))) {
+        segment_unlink(victim);
+        entry_drop(victim);
+        segment_link_front(MAIN, candidate);
+    } else {
+        entry_drop(candidate);
+        rejected++;
+    }
+}
+
+int metacache_get(int id, DocumentMeta *out) {
+    pthread_mutex_lock(&metacache_lock);
+    if (trace) fprintf(trace, "%d\n", id);
+    if (policy == METACACHE_TINYLFU && capacity > 0) sketch_increment(id);
+
+    int index = entry_find(id);
+    if (index == -1) {
+        misses++;
+        pthread_mutex_unlock(&metacache_lock);
+        return 0;
+    }
+
+    hits++;
+    int segment = entries[index].segment;
+    if (segments[segment].head != index) {
+        segment_unlink(index);
+        segment_link_front(segment, index);
+    }
+    *out = entries[index].meta;
+    pthread_mutex_unlock(&metacache_lock);
+    return 1;
+}
+
+void metacache_put(int id, const DocumentMeta *meta) {
+    pthread_mutex_lock(&metacache_lock);
+    if (capacity <= 0 || entry_find(id) != -1) {
+        pthread_mutex_unlock(&metacache_lock);
+        return;
+    }
+
+    int index;
+    if (free_list != -1) {
+        index = free_list;
+        free_list = entries[index].next;
+    } else {
+        index = used++;
+    }
+
+    entries[index].id = id;
+    entries[index].meta = *meta;
+    int *bucket = &buckets[(unsigned int)id & (METACACHE_BUCKETS - 1)];
+    entries[index].hash_next = *bucket;
+    *bucket = index + 1;
+
+    segment_link_front(WINDOW, index);
+    if (segments[WINDOW].count > segments[WINDOW].limit) window_evict();
+    pthread_mutex_unlock(&metacache_lock);
+}
+
+void metacache_remove(int id) {
+    pthread_mutex_lock(&metacache_lock);
+    int index = entry_find(id);
+    if (index != -1) {
+        segment_unlink(index);
+        entry_drop(index);
+    }
+    pthread_mutex_unlock(&metacache_lock);
+}
+
+void metacache_foreach(void (*visit)(int id, const DocumentMeta *meta, void *arg), void *arg) {
+    pthread_mutex_lock(&metacache_lock);
+    for (int s = WINDOW; s <= MAIN; s++) {
+        for (int i = segments[s].head; i != -1; i = entries[i].next) visit(entries[i].id, &entries[i].meta, arg);
+    }
+    pthread_mutex_unlock(&metacache_lock);
+}
+
+void metacache_counts(long *hit_count, long *miss_count, long *rejected_count) {
+    pthread_mutex_lock(&metacache_lock);
+    *hit_count = hits;
+    *miss_count = misses;
+    if (rejected_count) *rejected_count = rejected;
+    pthread_mutex_unlock(&metacache_lock);
+}
+
+// Written through a full buffer; exit() flushes it at shutdown
+int metacache_trace(const char *path) {
+    FILE *fp = fopen(path, "a");
+    if (!fp) return -1;
+    setvbuf(fp, NULL, _IOFBF, 1 << 16);
+    pthread_mutex_lock(&metacache_lock);
+    trace = fp;
+    pthread_mutex_unlock(&metacache_lock);
+    return 0;
+}
+
+void metacache_print_stats(FILE *out) {
+    pthread_mutex_lock(&metacache_lock);
+    fprintf(out, "[CACHE] Stats → Policy: %s, Hits: %ld, Misses: %ld, Total: %ld, Rejected: %ld, Entries: %d/%d\n",
+            metacache_policy_name(), hits, misses, hits + misses, rejected,
+            segments[WINDOW].count + segments[MAIN].count, capacity);
+    pthread_mutex_unlock(&metacache_lock);
+}
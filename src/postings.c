@@ -0,0 +1,1670 @@
+#define _GNU_SOURCE
+#include "common.h"
+#include "postings.h"
+#include "docset.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define POSTINGS_VERSION 3
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+typedef struct {
+    char *text;
+    int len;
+    DocSet ids;             // posting i is the i-th ID of the set
+    uint32_t *pos_off;      // posting i's positions are pos[pos_off[i]] up to pos[pos_off[i + 1]]
+    unsigned char *pos;     // positions of every posting, back to back
+    uint32_t pos_cap;
+    int *freqs;             // occurrences in each document
+    int max_freq;           // highest freq and shortest document ever seen,
+    int min_length;         // kept through removals: they only bound scores
+    int capacity;           // of freqs and pos_off
+} Term;
+
+static Term *terms = NULL;
+static int term_count = 0;
+static int term_capacity = 0;
+
+// Tokens of each document, indexed by id (0 = not indexed)
+static int *doc_lengths = NULL;
+static int doc_lengths_cap = 0;
+static long total_length = 0;
+
+// Terms of each document holding postings, by id: term index + 1 in
+// ascending order, as varint gaps, so removing or renaming a document
+// visits only its own terms
+typedef struct {
+    unsigned char *data;
+    uint32_t len, cap;
+    int last;               // last index + 1 stored, 0 = none
+} DocTerms;
+
+static DocTerms *doc_terms = NULL;
+static int doc_terms_cap = 0;
+static int doc_terms_valid = 1;     // 0 after running out of memory: scan the terms
+
+// Open addressing hash table: slot holds term index + 1 (0 = empty)
+static int *table = NULL;
+static int table_size = 0;
+
+// Documents with identical content share one body. Its postings are filed
+// under the body's canonical ID, the lowest ID with that content; the other
+// IDs (twins) are only listed here and fanned out into every result.
+typedef struct {
+    uint64_t hash;          // content fingerprint: hash and length
+    uint64_t size;
+    int id;                 // canonical ID, 0 = free slot
+    int *twins;             // other IDs with this content, ascending
+    int twin_count, twin_cap;
+    int next_free;
+} Body;
+
+static Body *bodies = NULL;
+static int body_slots = 0, body_cap = 0;
+static int body_free = -1;
+static int body_live = 0;           // documents as BM25 counts them
+static int twin_total = 0;          // 0: results need no fan-out
+static int *body_table = NULL;      // by fingerprint: slot + 1, 0 = empty
+static int body_table_size = 0;
+static int *doc_body = NULL;        // by ID: slot + 1, 0 = none
+static int doc_body_cap = 0;
+
+// Writers change bodies under the index write lock and this mutex; the
+// fingerprint lookup in postings_tokenize() runs with no index lock held
+static pthread_mutex_t body_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int is_term_char(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') || c >= 0x80;
+}
+
+static int varint_put(unsigned char *out, uint32_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+static uint32_t varint_get(const unsigned char **p) {
+    uint32_t v = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        v |= (uint32_t)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return v | (uint32_t)*(*p)++ << shift;
+}
+
+static unsigned int hash_term(const char *s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int table_grow() {
+    int new_size = table_size ? table_size * 2 : 1024;
+    int *new_table = calloc(new_size, sizeof(int));
+    if (!new_table) return -1;
+
+    for (int i = 0; i < term_count; i++) {
+        unsigned int h = hash_term(terms[i].text, terms[i].len) & (new_size - 1);
+        while (new_table[h]) h = (h + 1) & (new_size - 1);
+        new_table[h] = i + 1;
+    }
+
+    free(table);
+    table = new_table;
+    table_size = new_size;
+    return 0;
+}
+
+// N-gram index of the dictionary: every string of 1 to GRAM_MAX bytes
+// found in a term maps to the set of terms containing it (index + 1), so
+// a substring search reads the terms sharing the keyword's grams instead
+// of the whole dictionary
+#define GRAM_MAX 3
+
+typedef struct {
+    uint32_t key;           // length << 24 | bytes, 0 = empty slot
+    DocSet terms;
+} Gram;
+
+static Gram *grams = NULL;
+static int gram_count = 0;
+static int gram_size = 0;
+static int grams_valid = 1;     // 0 after running out of memory: scan the terms
+
+static uint32_t gram_key(const char *s, int len) {
+    uint32_t key = (uint32_t)len << 24;
+    for (int i = 0; i < len; i++) key |= (uint32_t)(unsigned char)s[i] << (16 - 8 * i);
+    return key;
+}
+
+static unsigned int gram_hash(uint32_t key) {
+    unsigned int h = key * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+static int gram_grow() {
+    int new_size = gram_size ? gram_size * 2 : 4096;
+    Gram *new_grams = calloc(new_size, sizeof(Gram));
+    if (!new_grams) return -1;
+
+    for (int i = 0; i < gram_size; i++) {
+        if (!grams[i].key) continue;
+        unsigned int h = gram_hash(grams[i].key) & (new_size - 1);
+        while (new_grams[h].key) h = (h + 1) & (new_size - 1);
+        new_grams[h] = grams[i];
+    }
+
+    free(grams);
+    grams = new_grams;
+    gram_size = new_size;
+    return 0;
+}
+
+static Gram *gram_get(uint32_t key, int create) {
+    if (gram_size == 0) {
+        if (!create || gram_grow() == -1) return NULL;
+    }
+
+    unsigned int h = gram_hash(key) & (gram_size - 1);
+    while (grams[h].key) {
+        if (grams[h].key == key) return &grams[h];
+        h = (h + 1) & (gram_size - 1);
+    }
+    if (!create) return NULL;
+
+    if ((gram_count + 1) * 10 > gram_size * 7) {
+        if (gram_grow() == -1) return NULL;
+        return gram_get(key, create);
+    }
+    grams[h].key = key;
+    docset_init(&grams[h].terms);
+    gram_count++;
+    return &grams[h];
+}
+
+// Terms are only ever appended, so each set grows at its end
+static void grams_add(int index) {
+    const Term *t = &terms[index];
+    for (int n = 1; n <= GRAM_MAX && grams_valid; n++) {
+        for (int i = 0; i + n <= t->len; i++) {
+            Gram *g = gram_get(gram_key(t->text + i, n), 1);
+            if (g && g->terms.count && g->terms.last == index + 1) continue;
+            if (!g || docset_insert(&g->terms, index + 1) == -2) {
+                grams_valid = 0;
+                break;
+            }
+        }
+    }
+}
+
+static void grams_clear() {
+    for (int i = 0; i < gram_size; i++) {
+        if (grams[i].key) docset_free(&grams[i].terms);
+    }
+    free(grams);
+    grams = NULL;
+    gram_count = gram_size = 0;
+    grams_valid = 1;
+}
+
+// Indexes of the terms containing keyword, ascending, into *out (malloc'd).
+// A keyword of up to GRAM_MAX bytes is a gram itself; a longer one takes
+// the terms holding all of its trigrams, starting from the rarest, and
+// checks each. Returns the count, -1 if out of memory.
+static int terms_containing(const char *keyword, int klen, int **out) {
+    *out = NULL;
+    if (!grams_valid) {
+        int *found = malloc((term_count ? term_count : 1) * sizeof(int));
+        if (!found) return -1;
+        int n = 0;
+        for (int i = 0; i < term_count; i++) {
+            if (memmem(terms[i].text, terms[i].len, keyword, klen)) found[n++] = i;
+        }
+        *out = found;
+        return n;
+    }
+
+    int shortest = klen <= GRAM_MAX ? klen : GRAM_MAX;
+    int gram_total = klen - shortest + 1;
+    Gram **parts = malloc(gram_total * sizeof(Gram *));
+    if (!parts) return -1;
+    int rarest = 0;
+    for (int i = 0; i < gram_total; i++) {
+        parts[i] = gram_get(gram_key(keyword + i, shortest), 0);
+        if (!parts[i]) {
+            free(parts);
+            return 0;
+        }
+        if (parts[i]->terms.count < parts[rarest]->terms.count) rarest = i;
+    }
+
+    int *found = malloc(parts[rarest]->terms.count * sizeof(int));
+    if (!found) {
+        free(parts);
+        return -1;
+    }
+    int n = docset_decode(&parts[rarest]->terms, found);
+    for (int i = 0; i < gram_total && n > 0; i++) {
+        if (i != rarest) n = docset_intersect(&parts[i]->terms, found, n, found);
+    }
+    free(parts);
+
+    // Sharing every trigram does not make the keyword a substring
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        const Term *t = &terms[found[i] - 1];
+        if (klen <= GRAM_MAX || memmem(t->text, t->len, keyword, klen)) found[kept++] = found[i] - 1;
+    }
+    *out = found;
+    return kept;
+}
+
+static Term *term_get(const char *s, int len, int create) {
+    if (table_size == 0) {
+        if (!create || table_grow() == -1) return NULL;
+    }
+
+    unsigned int h = hash_term(s, len) & (table_size - 1);
+    while (table[h]) {
+        Term *t = &terms[table[h] - 1];
+        if (t->len == len && memcmp(t->text, s, len) == 0) return t;
+        h = (h + 1) & (table_size - 1);
+    }
+    if (!create) return NULL;
+
+    if ((term_count + 1) * 10 > table_size * 7) {
+        if (table_grow() == -1) return NULL;
+        return term_get(s, len, create);
+    }
+
+    if (term_count == term_capacity) {
+        int new_capacity = term_capacity ? term_capacity * 2 : 1024;
+        Term *new_terms = realloc(terms, new_capacity * sizeof(Term));
+        if (!new_terms) return NULL;
+        terms = new_terms;
+        term_capacity = new_capacity;
+    }
+
+    Term *t = &terms[term_count];
+    t->text = malloc(len + 1);
+    if (!t->text) return NULL;
+    memcpy(t->text, s, len);
+    t->text[len] = '\0';
+    t->len = len;
+    docset_init(&t->ids);
+    t->pos_off = NULL;
+    t->pos = NULL;
+    t->pos_cap = 0;
+    t->freqs = NULL;
+    t->max_freq = 0;
+    t->min_length = 0;
+    t->capacity = 0;
+
+    table[h] = ++term_count;
+    grams_add(term_count - 1);
+    return t;
+}
+
+// Adds document id with its encoded positions (len bytes of data)
+static int term_add_posting(Term *t, int id, const unsigned char *data, int len) {
+    int count = t->ids.count;
+    if (count > 0 && t->ids.last == id) return 0;
+
+    if (count == t->capacity) {
+        int new_capacity = t->capacity ? t->capacity * 2 : 4;
+        int *new_freqs = realloc(t->freqs, new_capacity * sizeof(int));
+        if (!new_freqs) return -1;
+        t->freqs = new_freqs;
+        uint32_t *new_off = realloc(t->pos_off, (new_capacity + 1) * sizeof(uint32_t));
+        if (!new_off) return -1;
+        if (!t->pos_off) new_off[0] = 0;
+        t->pos_off = new_off;
+        t->capacity = new_capacity;
+    }
+
+    uint32_t used = t->pos_off[count];
+    if (used + len > t->pos_cap) {
+        uint32_t new_cap = t->pos_cap ? t->pos_cap * 2 : 64;
+        while (new_cap < used + len) new_cap *= 2;
+        unsigned char *new_pos = realloc(t->pos, new_cap);
+        if (!new_pos) return -1;
+        t->pos = new_pos;
+        t->pos_cap = new_cap;
+    }
+
+    // Usually an append: documents are added in increasing ID order
+    int pos = docset_insert(&t->ids, id);
+    if (pos == -1) return 0;
+    if (pos < 0) return -1;
+
+    // One varint per position: count the bytes that end one
+    int freq = 0;
+    for (int i = 0; i < len; i++) freq += !(data[i] & 0x80);
+
+    uint32_t at = t->pos_off[pos];
+    memmove(&t->freqs[pos + 1], &t->freqs[pos], (count - pos) * sizeof(int));
+    memmove(&t->pos_off[pos + 1], &t->pos_off[pos], (count - pos + 1) * sizeof(uint32_t));
+    for (int i = pos + 1; i <= count + 1; i++) t->pos_off[i] += len;
+    memmove(t->pos + at + len, t->pos + at, used - at);
+    memcpy(t->pos + at, data, len);
+    t->freqs[pos] = freq;
+    if (freq > t->max_freq) t->max_freq = freq;
+    return 0;
+}
+
+static uint64_t rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+// Content fingerprint: one multiply-rotate round per 8-byte word and a
+// final avalanche. Paired with the length, a false match is not a
+// practical concern.
+static uint64_t content_hash(const unsigned char *p, size_t n) {
+    const uint64_t m1 = 0x9E3779B97F4A7C15ULL, m2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t h = m1 ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h ^= rotl64(w * m2, 31) * m1;
+        h = rotl64(h, 27) * m1 + 0x52DCE729;
+    }
+    uint64_t tail = 0;
+    for (int shift = 0; i < n; i++, shift += 8) tail |= (uint64_t)p[i] << shift;
+    h ^= rotl64(tail * m2, 31) * m1;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Slot of the body with this fingerprint, or -1; caller holds body_lock
+static int body_find(uint64_t hash, uint64_t size) {
+    if (body_table_size == 0) return -1;
+    unsigned int mask = body_table_size - 1;
+    for (unsigned int h = (unsigned int)hash & mask; body_table[h]; h = (h + 1) & mask) {
+        const Body *b = &bodies[body_table[h] - 1];
+        if (b->hash == hash && b->size == size) return body_table[h] - 1;
+    }
+    return -1;
+}
+
+static void body_table_put(int slot) {
+    unsigned int mask = body_table_size - 1;
+    unsigned int h = (unsigned int)bodies[slot].hash & mask;
+    while (body_table[h]) h = (h + 1) & mask;
+    body_table[h] = slot + 1;
+}
+
+// Linear probing: later entries of the run shift back into the gap
+static void body_table_remove(int slot) {
+    unsigned int mask = body_table_size - 1;
+    unsigned int h = (unsigned int)bodies[slot].hash & mask;
+    while (body_table[h] != slot + 1) h = (h + 1) & mask;
+    body_table[h] = 0;
+    for (unsigned int j = (h + 1) & mask; body_table[j]; j = (j + 1) & mask) {
+        int moved = body_table[j] - 1;
+        body_table[j] = 0;
+        body_table_put(moved);
+    }
+}
+
+static int doc_body_reserve(int id) {
+    if (id < doc_body_cap) return 0;
+    int new_cap = doc_body_cap ? doc_body_cap : 1024;
+    while (new_cap <= id) new_cap *= 2;
+    int *grown = realloc(doc_body, new_cap * sizeof(int));
+    if (!grown) return -1;
+    memset(grown + doc_body_cap, 0, (new_cap - doc_body_cap) * sizeof(int));
+    doc_body = grown;
+    doc_body_cap = new_cap;
+    return 0;
+}
+
+// New body for id's content; caller holds body_lock. Slot, or -1.
+static int body_create(int id, uint64_t hash, uint64_t size) {
+    if (doc_body_reserve(id) == -1) return -1;
+    if ((body_live + 1) * 2 > body_table_size) {
+        int new_size = body_table_size ? body_table_size * 2 : 1024;
+        int *grown = calloc(new_size, sizeof(int));
+        if (!grown) return -1;
+        free(body_table);
+        body_table = grown;
+        body_table_size = new_size;
+        for (int i = 0; i < body_slots; i++) {
+            if (bodies[i].id) body_table_put(i);
+        }
+    }
+
+    int slot = body_free;
+    if (slot != -1) {
+        body_free = bodies[slot].next_free;
+    } else {
+        if (body_slots == body_cap) {
+            int new_cap = body_cap ? body_cap * 2 : 1024;
+            Body *grown = realloc(bodies, new_cap * sizeof(Body));
+            if (!grown) return -1;
+            bodies = grown;
+            body_cap = new_cap;
+        }
+        slot = body_slots++;
+    }
+
+    Body *b = &bodies[slot];
+    memset(b, 0, sizeof(*b));
+    b->hash = hash;
+    b->size = size;
+    b->id = id;
+    body_table_put(slot);
+    doc_body[id] = slot + 1;
+    body_live++;
+    return slot;
+}
+
+static void body_delete(int slot) {
+    body_table_remove(slot);
+    free(bodies[slot].twins);
+    bodies[slot].twins = NULL;
+    bodies[slot].id = 0;
+    bodies[slot].next_free = body_free;
+    body_free = slot;
+    body_live--;
+}
+
+static int body_add_twin(Body *b, int id) {
+    if (b->twin_count == b->twin_cap) {
+        int new_cap = b->twin_cap ? b->twin_cap * 2 : 4;
+        int *grown = realloc(b->twins, new_cap * sizeof(int));
+        if (!grown) return -1;
+        b->twins = grown;
+        b->twin_cap = new_cap;
+    }
+    int pos = b->twin_count;
+    while (pos > 0 && b->twins[pos - 1] > id) pos--;
+    memmove(&b->twins[pos + 1], &b->twins[pos], (b->twin_count - pos) * sizeof(int));
+    b->twins[pos] = id;
+    b->twin_count++;
+    twin_total++;
+    return 0;
+}
+
+static int lengths_reserve(int id) {
+    if (id < doc_lengths_cap) return 0;
+    int new_cap = doc_lengths_cap ? doc_lengths_cap : 1024;
+    while (new_cap <= id) new_cap *= 2;
+    int *grown = realloc(doc_lengths, new_cap * sizeof(int));
+    if (!grown) return -1;
+    memset(grown + doc_lengths_cap, 0, (new_cap - doc_lengths_cap) * sizeof(int));
+    doc_lengths = grown;
+    doc_lengths_cap = new_cap;
+    return 0;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int doc_terms_reserve(int id) {
+    if (id < doc_terms_cap) return 0;
+    int new_cap = doc_terms_cap ? doc_terms_cap : 1024;
+    while (new_cap <= id) new_cap *= 2;
+    DocTerms *grown = realloc(doc_terms, new_cap * sizeof(DocTerms));
+    if (!grown) return -1;
+    memset(grown + doc_terms_cap, 0, (new_cap - doc_terms_cap) * sizeof(DocTerms));
+    doc_terms = grown;
+    doc_terms_cap = new_cap;
+    return 0;
+}
+
+// Indexes must come in ascending order
+static void doc_terms_append(int id, int index) {
+    if (!doc_terms_valid) return;
+    if (doc_terms_reserve(id) == -1) {
+        doc_terms_valid = 0;
+        return;
+    }
+    DocTerms *d = &doc_terms[id];
+    if (d->len + 5 > d->cap) {
+        uint32_t new_cap = d->cap ? d->cap * 2 : 64;
+        unsigned char *grown = realloc(d->data, new_cap);
+        if (!grown) {
+            doc_terms_valid = 0;
+            return;
+        }
+        d->data = grown;
+        d->cap = new_cap;
+    }
+    d->len += varint_put(d->data + d->len, index + 1 - d->last);
+    d->last = index + 1;
+}
+
+// Term indexes of id into *out (malloc'd): count, or -1 when the lists
+// are incomplete or out of memory, and the caller must scan every term
+static int doc_terms_get(int id, int **out) {
+    *out = NULL;
+    if (!doc_terms_valid) return -1;
+    if (id >= doc_terms_cap || !doc_terms[id].len) return 0;
+    const DocTerms *d = &doc_terms[id];
+    int *found = malloc(d->len * sizeof(int));
+    if (!found) return -1;
+    int n = 0, index = 0;
+    for (const unsigned char *p = d->data, *end = d->data + d->len; p < end; ) {
+        index += varint_get(&p);
+        found[n++] = index - 1;
+    }
+    *out = found;
+    return n;
+}
+
+static void doc_terms_drop(int id) {
+    if (id >= doc_terms_cap) return;
+    free(doc_terms[id].data);
+    memset(&doc_terms[id], 0, sizeof(DocTerms));
+}
+
+// Decodes the positions of posting i into out (room for as many ints as
+// the posting has bytes); returns how many
+static int term_positions(const Term *t, int i, int *out) {
+    const unsigned char *p = t->pos + t->pos_off[i], *end = t->pos + t->pos_off[i + 1];
+    int n = 0, last = 0;
+    while (p < end) {
+        last += varint_get(&p);
+        out[n++] = last;
+    }
+    return n;
+}
+
+static int positions_add(PostingsPositions *pp, int position) {
+    if (pp->len + 5 > pp->cap) {
+        int new_cap = pp->cap ? pp->cap * 2 : 16;
+        unsigned char *new_data = realloc(pp->data, new_cap);
+        if (!new_data) return -1;
+        pp->data = new_data;
+        pp->cap = new_cap;
+    }
+    pp->len += varint_put(pp->data + pp->len, position - pp->last);
+    pp->last = position;
+    return 0;
+}
+
+// Returns the number of the token in the document's term set, adding it
+// if not yet present, or -1
+static int terms_insert(PostingsTerms *dt, const char *token, int len) {
+    if ((dt->count + 1) * 2 > dt->set_size) {
+        int new_size = dt->set_size ? dt->set_size * 2 : 256;
+        int *new_set = calloc(new_size, sizeof(int));
+        if (!new_set) return -1;
+        for (int i = 0; i < dt->set_size; i++) {
+            if (!dt->set[i]) continue;
+            const char *t = dt->text + dt->offsets[dt->set[i] - 1];
+            unsigned int h = hash_term(t, strlen(t)) & (new_size - 1);
+            while (new_set[h]) h = (h + 1) & (new_size - 1);
+            new_set[h] = dt->set[i];
+        }
+        free(dt->set);
+        dt->set = new_set;
+        dt->set_size = new_size;
+    }
+
+    unsigned int h = hash_term(token, len) & (dt->set_size - 1);
+    while (dt->set[h]) {
+        const char *t = dt->text + dt->offsets[dt->set[h] - 1];
+        if (strncmp(t, token, len) == 0 && t[len] == '\0') return dt->set[h] - 1;
+        h = (h + 1) & (dt->set_size - 1);
+    }
+
+    if (dt->len + len + 1 > dt->cap) {
+        int new_cap = dt->cap ? dt->cap * 2 : 4096;
+        while (new_cap < dt->len + len + 1) new_cap *= 2;
+        char *new_text = realloc(dt->text, new_cap);
+        if (!new_text) return -1;
+        dt->text = new_text;
+        dt->cap = new_cap;
+    }
+
+    if (dt->count == dt->terms_cap) {
+        int new_cap = dt->terms_cap ? dt->terms_cap * 2 : 256;
+        int *new_offsets = realloc(dt->offsets, new_cap * sizeof(int));
+        if (!new_offsets) return -1;
+        dt->offsets = new_offsets;
+        PostingsPositions *new_positions = realloc(dt->positions, new_cap * sizeof(PostingsPositions));
+        if (!new_positions) return -1;
+        dt->positions = new_positions;
+        dt->terms_cap = new_cap;
+    }
+
+    memcpy(dt->text + dt->len, token, len);
+    dt->text[dt->len + len] = '\0';
+    dt->offsets[dt->count] = dt->len;
+    memset(&dt->positions[dt->count], 0, sizeof(PostingsPositions));
+    dt->set[h] = dt->count + 1;
+    dt->len += len + 1;
+    return dt->count++;
+}
+
+// Records one occurrence of a token at the next position
+static void terms_add_token(PostingsTerms *dt, const char *token, int len) {
+    int term = terms_insert(dt, token, len);
+    if (term != -1) positions_add(&dt->positions[term], dt->tokens);
+    dt->tokens++;
+}
+
+// Reads a document, fingerprints it and collects its distinct terms and
+// where each occurs. Content that is already indexed is not tokenized: its
+// body's canonical ID is left in dt->twin instead. Shared state is only
+// read, under body_lock, so several documents can be tokenized in parallel.
+int postings_tokenize(const char *fullpath, PostingsTerms *dt) {
+    memset(dt, 0, sizeof(*dt));
+
+    int fd = open(fullpath, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    const char *data = NULL;
+    size_t size = st.st_size;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    dt->size = size;
+    dt->hash = content_hash((const unsigned char *)data, size);
+    pthread_mutex_lock(&body_lock);
+    int slot = body_find(dt->hash, dt->size);
+    if (slot != -1) dt->twin = bodies[slot].id;
+    pthread_mutex_unlock(&body_lock);
+
+    if (!dt->twin) {
+        size_t start = 0;
+        for (size_t i = 0; i <= size; i++) {
+            // A token may run up to EOF
+            if (i < size && is_term_char((unsigned char)data[i])) continue;
+            if (i > start) terms_add_token(dt, data + start, i - start);
+            start = i + 1;
+        }
+    }
+
+    if (data) munmap((void *)data, size);
+    return 0;
+}
+
+static void term_remove(Term *t, int id) {
+    int count = t->ids.count;
+    int i = docset_remove(&t->ids, id);
+    if (i == -1) return;
+    uint32_t at = t->pos_off[i], len = t->pos_off[i + 1] - at;
+    memmove(t->pos + at, t->pos + at + len, t->pos_off[count] - at - len);
+    memmove(&t->freqs[i], &t->freqs[i + 1], (count - i - 1) * sizeof(int));
+    for (int j = i; j < count; j++) t->pos_off[j] = t->pos_off[j + 1] - len;
+}
+
+// Files a body's postings under a new canonical ID
+static void postings_rename(int from, int to) {
+    if (lengths_reserve(to) == 0 && from < doc_lengths_cap) {
+        doc_lengths[to] = doc_lengths[from];
+        doc_lengths[from] = 0;
+    }
+
+    int *list;
+    int n = doc_terms_get(from, &list);
+    unsigned char *copy = NULL;
+    uint32_t copy_cap = 0;
+    for (int i = 0; i < (n == -1 ? term_count : n); i++) {
+        Term *t = &terms[n == -1 ? i : list[i]];
+        int at = docset_find(&t->ids, from);
+        if (at == -1) continue;
+        uint32_t len = t->pos_off[at + 1] - t->pos_off[at];
+        if (len > copy_cap) {
+            unsigned char *grown = realloc(copy, len);
+            if (!grown) continue;
+            copy = grown;
+            copy_cap = len;
+        }
+        memcpy(copy, t->pos + t->pos_off[at], len);
+        term_remove(t, from);
+        term_add_posting(t, to, copy, len);
+    }
+    free(copy);
+    free(list);
+
+    // The body's terms are the same under its new ID
+    if (doc_terms_valid && doc_terms_reserve(to) == -1) doc_terms_valid = 0;
+    if (doc_terms_valid && from < doc_terms_cap) {
+        free(doc_terms[to].data);
+        doc_terms[to] = doc_terms[from];
+        memset(&doc_terms[from], 0, sizeof(DocTerms));
+    }
+}
+
+// Returns -1 if dt skipped tokenizing for a body that has since gone: the
+// caller must tokenize the document again
+int postings_add_terms(int id, const PostingsTerms *dt) {
+    pthread_mutex_lock(&body_lock);
+    int slot = body_find(dt->hash, dt->size);
+    if (slot != -1 && bodies[slot].id != id && doc_body_reserve(id) == 0) {
+        Body *b = &bodies[slot];
+        int canonical = b->id;
+        if (id < canonical) {
+            // Older ID than the current canonical one: the postings move to it
+            body_add_twin(b, canonical);
+            b->id = id;
+        } else {
+            body_add_twin(b, id);
+        }
+        doc_body[id] = slot + 1;
+        pthread_mutex_unlock(&body_lock);
+        if (id < canonical) postings_rename(canonical, id);
+        return 0;
+    }
+    if (dt->twin) {
+        pthread_mutex_unlock(&body_lock);
+        return -1;
+    }
+    // Without a body the document is still indexed, just never shared
+    body_create(id, dt->hash, dt->size);
+    pthread_mutex_unlock(&body_lock);
+
+    int *list = malloc((dt->count ? dt->count : 1) * sizeof(int));
+    if (!list) doc_terms_valid = 0;
+    int n = 0;
+    for (int i = 0; i < dt->count; i++) {
+        const char *text = dt->text + dt->offsets[i];
+        Term *t = term_get(text, strlen(text), 1);
+        if (!t || term_add_posting(t, id, dt->positions[i].data, dt->positions[i].len) == -1) continue;
+        if (!t->min_length || dt->tokens < t->min_length) t->min_length = dt->tokens;
+        if (list) list[n++] = t - terms;
+    }
+    if (list) {
+        qsort(list, n, sizeof(int), compare_ids);
+        for (int i = 0; i < n; i++) doc_terms_append(id, list[i]);
+        free(list);
+    }
+    if (lengths_reserve(id) == 0) {
+        total_length += dt->tokens - doc_lengths[id];
+        doc_lengths[id] = dt->tokens;
+    }
+    return 0;
+}
+
+void postings_terms_free(PostingsTerms *dt) {
+    for (int i = 0; i < dt->count; i++) free(dt->positions[i].data);
+    free(dt->text);
+    free(dt->set);
+    free(dt->offsets);
+    free(dt->positions);
+    memset(dt, 0, sizeof(*dt));
+}
+
+int postings_add_document(int id, const char *fullpath) {
+    PostingsTerms dt;
+    if (postings_tokenize(fullpath, &dt) == -1) return -1;
+    postings_add_terms(id, &dt);
+    postings_terms_free(&dt);
+    return 0;
+}
+
+void postings_remove_document(int id) {
+    // A twin owns no postings; removing the canonical ID hands them to the
+    // oldest twin
+    pthread_mutex_lock(&body_lock);
+    int slot = id < doc_body_cap ? doc_body[id] - 1 : -1;
+    if (slot != -1) {
+        Body *b = &bodies[slot];
+        doc_body[id] = 0;
+        if (b->id != id || b->twin_count > 0) {
+            int heir = 0;
+            if (b->id == id) {
+                heir = b->twins[0];
+                b->id = heir;
+            }
+            int i = 0;
+            while (b->twins[i] != b->id && b->twins[i] != id) i++;
+            memmove(&b->twins[i], &b->twins[i + 1], (b->twin_count - i - 1) * sizeof(int));
+            b->twin_count--;
+            twin_total--;
+            pthread_mutex_unlock(&body_lock);
+            if (heir) postings_rename(id, heir);
+            return;
+        }
+        body_delete(slot);
+    }
+    pthread_mutex_unlock(&body_lock);
+
+    if (id < doc_lengths_cap) {
+        total_length -= doc_lengths[id];
+        doc_lengths[id] = 0;
+    }
+
+    int *list;
+    int n = doc_terms_get(id, &list);
+    if (n == -1) {
+        for (int i = 0; i < term_count; i++) term_remove(&terms[i], id);
+    } else {
+        for (int i = 0; i < n; i++) term_remove(&terms[list[i]], id);
+    }
+    free(list);
+    doc_terms_drop(id);
+}
+
+// Adds the twins of every canonical ID in the sorted list and keeps it
+// sorted. A no-op while no content is shared.
+int postings_expand(int **ids, int *count) {
+    if (twin_total == 0 || *count == 0) return 0;
+
+    int extra = 0;
+    for (int i = 0; i < *count; i++) {
+        int id = (*ids)[i];
+        if (id < doc_body_cap && doc_body[id]) extra += bodies[doc_body[id] - 1].twin_count;
+    }
+    if (extra == 0) return 0;
+
+    int *grown = realloc(*ids, (*count + extra) * sizeof(int));
+    if (!grown) return -1;
+    int n = *count;
+    for (int i = 0; i < *count; i++) {
+        int id = grown[i];
+        if (id >= doc_body_cap || !doc_body[id]) continue;
+        const Body *b = &bodies[doc_body[id] - 1];
+        if (b->id != id || b->twin_count == 0) continue;
+        memcpy(grown + n, b->twins, b->twin_count * sizeof(int));
+        n += b->twin_count;
+    }
+    qsort(grown, n, sizeof(int), compare_ids);
+    *ids = grown;
+    *count = n;
+    return 0;
+}
+
+// 1 if id shares the content of a lower ID, whose results it inherits
+int postings_is_twin(int id) {
+    if (twin_total == 0 || id >= doc_body_cap || !doc_body[id]) return 0;
+    return bodies[doc_body[id] - 1].id != id;
+}
+
+int postings_twin_count() {
+    return twin_total;
+}
+
+// Canonical ID of already indexed content with this fingerprint, or 0
+int postings_find_content(uint64_t hash, uint64_t size) {
+    pthread_mutex_lock(&body_lock);
+    int slot = body_find(hash, size);
+    int id = slot == -1 ? 0 : bodies[slot].id;
+    pthread_mutex_unlock(&body_lock);
+    return id;
+}
+
+int postings_body_count() {
+    return body_live;
+}
+
+// A keyword can be answered from the index only if it cannot span a term
+// boundary: every occurrence is then a substring of a single term, which
+// keeps the same semantics as "grep -q keyword file".
+int postings_is_indexable(const char *keyword) {
+    if (!keyword || !keyword[0]) return 0;
+    for (const char *p = keyword; *p; p++) {
+        if (!is_term_char((unsigned char)*p)) return 0;
+    }
+    return 1;
+}
+
+int postings_search(const char *keyword, int **ids, int *count) {
+    *ids = NULL;
+    *count = 0;
+    if (!postings_is_indexable(keyword)) return -1;
+
+    int *found;
+    int found_count = terms_containing(keyword, strlen(keyword), &found);
+    if (found_count == -1) return -1;
+    const Term **matched = malloc((found_count ? found_count : 1) * sizeof(Term *));
+    if (!matched) {
+        free(found);
+        return -1;
+    }
+    int sources = 0, total = 0, last = 0;
+    for (int i = 0; i < found_count; i++) {
+        const Term *t = &terms[found[i]];
+        if (t->ids.count == 0) continue;
+        matched[sources++] = t;
+        total += t->ids.count;
+        if (t->ids.last > last) last = t->ids.last;
+    }
+    free(found);
+    if (sources == 0) {
+        free(matched);
+        return 0;
+    }
+
+    int *result = malloc(total * sizeof(int));
+    if (!result) {
+        free(matched);
+        return -1;
+    }
+
+    // Union of several posting lists, taken on the compressed sets: each
+    // one is OR-ed into a bitmap of every ID, which comes out sorted
+    int result_count = 0;
+    if (sources == 1) {
+        result_count = docset_decode(&matched[0]->ids, result);
+    } else {
+        int words = (last >> 6) + 1;
+        uint64_t *bits = calloc(words, sizeof(uint64_t));
+        if (!bits) {
+            free(matched);
+            free(result);
+            return -1;
+        }
+        for (int i = 0; i < sources; i++) docset_or(&matched[i]->ids, bits);
+        for (int w = 0; w < words; w++) {
+            for (uint64_t b = bits[w]; b; b &= b - 1) result[result_count++] = (w << 6) + __builtin_ctzll(b);
+        }
+        free(bits);
+    }
+    free(matched);
+
+    *ids = result;
+    *count = result_count;
+    return postings_expand(ids, count);
+}
+
+// Keywords matching this many terms or fewer are tested with one cursor
+// per term; beyond that, against the union of their sets in a bitmap
+#define MATCH_CURSORS 8
+
+struct PostingsMatch {
+    int count;                  // terms, 0 when bits holds their union
+    DocSetCursor cursors[MATCH_CURSORS];
+    uint64_t *bits;
+    int words;
+};
+
+// The documents containing keyword, to test IDs against without listing
+// them. NULL if the index cannot answer the keyword or out of memory;
+// *cost is the number of postings of its terms.
+PostingsMatch *postings_match_open(const char *keyword, long *cost) {
+    if (!postings_is_indexable(keyword)) return NULL;
+    int *found;
+    int found_count = terms_containing(keyword, strlen(keyword), &found);
+    if (found_count == -1) return NULL;
+    PostingsMatch *m = calloc(1, sizeof(PostingsMatch));
+    if (!m) {
+        free(found);
+        return NULL;
+    }
+
+    int last = 0, sources = 0;
+    *cost = 0;
+    for (int i = 0; i < found_count; i++) {
+        const Term *t = &terms[found[i]];
+        if (t->ids.count == 0) continue;
+        found[sources++] = found[i];
+        *cost += t->ids.count;
+        if (t->ids.last > last) last = t->ids.last;
+    }
+    if (sources <= MATCH_CURSORS) {
+        for (int i = 0; i < sources; i++) docset_cursor(&m->cursors[i], &terms[found[i]].ids);
+        m->count = sources;
+    } else {
+        m->words = (last >> 6) + 1;
+        m->bits = calloc(m->words, sizeof(uint64_t));
+        if (!m->bits) {
+            free(found);
+            free(m);
+            return NULL;
+        }
+        for (int i = 0; i < sources; i++) docset_or(&terms[found[i]].ids, m->bits);
+    }
+    free(found);
+    return m;
+}
+
+static int match_test(PostingsMatch *m, int id) {
+    // A twin matches through the ID its content is indexed under, which
+    // may be below IDs already tested
+    if (id < doc_body_cap && doc_body[id]) id = bodies[doc_body[id] - 1].id;
+    if (m->bits) return (id >> 6) < m->words && (m->bits[id >> 6] >> (id & 63) & 1);
+    for (int i = 0; i < m->count; i++) {
+        DocSetCursor *c = &m->cursors[i];
+        if (id < c->id) {
+            if (docset_find(c->set, id) != -1) return 1;
+            continue;
+        }
+        docset_seek(c, id);
+        if (c->id == id) return 1;
+    }
+    return 0;
+}
+
+// Keeps the ascending ids that contain the keyword (keep = 1) or those that
+// do not (keep = 0); returns how many are left
+int postings_match_filter(PostingsMatch *m, int *ids, int n, int keep) {
+    if (m->count == 1 && twin_total == 0) {
+        return keep ? docset_intersect(m->cursors[0].set, ids, n, ids)
+                    : docset_difference(m->cursors[0].set, ids, n, ids);
+    }
+    int w = 0;
+    for (int i = 0; i < n; i++) {
+        if (match_test(m, ids[i]) == keep) ids[w++] = ids[i];
+    }
+    return w;
+}
+
+void postings_match_close(PostingsMatch *m) {
+    if (!m) return;
+    free(m->bits);
+    free(m);
+}
+
+// A keyword in double quotes is a phrase: its terms, in order, as
+// consecutive tokens
+int postings_is_phrase(const char *keyword) {
+    size_t len = strlen(keyword);
+    return len >= 2 && keyword[0] == '"' && keyword[len - 1] == '"';
+}
+
+// Terms of a phrase or NEAR operand, split like a document is tokenized
+typedef struct {
+    Term *terms[POSTINGS_PHRASE_MAX];
+    int count;
+    int missing;        // some token is not in the index: nothing matches
+} Phrase;
+
+static int phrase_parse(const char *text, Phrase *ph) {
+    ph->count = 0;
+    ph->missing = 0;
+    for (const char *s = text; *s; ) {
+        if (!is_term_char((unsigned char)*s)) {
+            s++;
+            continue;
+        }
+        int len = 0;
+        while (is_term_char((unsigned char)s[len])) len++;
+        if (ph->count == POSTINGS_PHRASE_MAX) return -1;
+        ph->terms[ph->count] = term_get(s, len, 0);
+        if (!ph->terms[ph->count] || ph->terms[ph->count]->ids.count == 0) ph->missing = 1;
+        ph->count++;
+        s += len;
+    }
+    return ph->count > 0 ? 0 : -1;
+}
+
+// Walks the documents that contain every one of n terms, driven by the
+// rarest; idx[k] is then the document's posting in terms[k]. The other
+// lists seek forward on their compressed sets, and a list that jumps past
+// the candidate takes the driver with it.
+typedef struct {
+    Term **terms;
+    int n;
+    int driver;
+    DocSetCursor cur[2 * POSTINGS_PHRASE_MAX];
+    int *idx;
+} DocCursor;
+
+static void cursor_init(DocCursor *c, Term **terms, int n, int *idx) {
+    c->terms = terms;
+    c->n = n;
+    c->driver = 0;
+    c->idx = idx;
+    for (int k = 0; k < n; k++) {
+        docset_cursor(&c->cur[k], &terms[k]->ids);
+        if (terms[k]->ids.count < terms[c->driver]->ids.count) c->driver = k;
+    }
+}
+
+// Next document id, or 0 when there are no more
+static int cursor_next(DocCursor *c) {
+    DocSetCursor *d = &c->cur[c->driver];
+    while (d->id != INT_MAX) {
+        int id = d->id;
+        c->idx[c->driver] = d->index;
+        docset_next(d);
+        int k;
+        for (k = 0; k < c->n; k++) {
+            if (k == c->driver) continue;
+            DocSetCursor *t = &c->cur[k];
+            docset_seek(t, id);
+            if (t->id == INT_MAX) return 0;
+            if (t->id != id) {
+                docset_seek(d, t->id);
+                break;
+            }
+            c->idx[k] = t->index;
+        }
+        if (k == c->n) return id;
+    }
+    return 0;
+}
+
+typedef struct {
+    int *starts, *next;
+    int cap;
+} PhraseScratch;
+
+// Positions where the phrase starts in the document at postings idx, found
+// by merging the position lists of its terms; returns how many (in
+// s->starts) or -1
+static int phrase_starts(const Phrase *ph, const int *idx, PhraseScratch *s) {
+    int need = 0;
+    for (int k = 0; k < ph->count; k++) {
+        const Term *t = ph->terms[k];
+        int bytes = t->pos_off[idx[k] + 1] - t->pos_off[idx[k]];
+        if (bytes > need) need = bytes;
+    }
+    if (need > s->cap) {
+        int *starts = realloc(s->starts, need * sizeof(int));
+        if (!starts) return -1;
+        s->starts = starts;
+        int *next = realloc(s->next, need * sizeof(int));
+        if (!next) return -1;
+        s->next = next;
+        s->cap = need;
+    }
+
+    int n = term_positions(ph->terms[0], idx[0], s->starts);
+    for (int k = 1; k < ph->count && n > 0; k++) {
+        int m = term_positions(ph->terms[k], idx[k], s->next);
+        int w = 0;
+        for (int i = 0, j = 0; i < n; i++) {
+            int want = s->starts[i] + k;
+            while (j < m && s->next[j] < want) j++;
+            if (j < m && s->next[j] == want) s->starts[w++] = s->starts[i];
+        }
+        n = w;
+    }
+    return n;
+}
+
+// Exact-token phrase match; punctuation and line breaks between the terms
+// do not matter. Returns -1 if the text has no term or too many.
+int postings_phrase_search(const char *phrase, int **ids, int *count) {
+    *ids = NULL;
+    *count = 0;
+
+    Phrase ph;
+    if (phrase_parse(phrase, &ph) == -1) return -1;
+    if (ph.missing) return 0;
+
+    int idx[POSTINGS_PHRASE_MAX];
+    DocCursor c;
+    cursor_init(&c, ph.terms, ph.count, idx);
+    int *result = malloc(ph.terms[c.driver]->ids.count * sizeof(int));
+    if (!result) return -1;
+
+    PhraseScratch s = { NULL, NULL, 0 };
+    int id;
+    while ((id = cursor_next(&c)) > 0) {
+        if (phrase_starts(&ph, idx, &s) > 0) result[(*count)++] = id;
+    }
+    free(s.starts);
+    free(s.next);
+
+    *ids = result;
+    return postings_expand(ids, count);
+}
+
+// 1 if an occurrence of a (la tokens long) and one of b (lb tokens) are at
+// most distance tokens apart, in either order
+static int spans_near(const int *a, int na, int la, const int *b, int nb, int lb, int distance) {
+    for (int i = 0, j = 0; i < na; i++) {
+        while (j < nb && b[j] < a[i]) j++;
+        if (j < nb && b[j] - (a[i] + la - 1) <= distance) return 1;
+        if (j > 0 && a[i] - (b[j - 1] + lb - 1) <= distance) return 1;
+    }
+    return 0;
+}
+
+// Documents where left and right (each a word or phrase) occur within
+// distance tokens of each other: NEAR/1 means adjacent
+int postings_near_search(const char *left, const char *right, int distance, int **ids, int *count) {
+    *ids = NULL;
+    *count = 0;
+
+    Phrase a, b;
+    if (phrase_parse(left, &a) == -1 || phrase_parse(right, &b) == -1) return -1;
+    if (a.missing || b.missing) return 0;
+
+    // Both sides' terms in one cursor: a document must hold all of them
+    Term *terms[2 * POSTINGS_PHRASE_MAX];
+    int idx[2 * POSTINGS_PHRASE_MAX];
+    memcpy(terms, a.terms, a.count * sizeof(Term *));
+    memcpy(terms + a.count, b.terms, b.count * sizeof(Term *));
+    DocCursor c;
+    cursor_init(&c, terms, a.count + b.count, idx);
+    int *result = malloc(terms[c.driver]->ids.count * sizeof(int));
+    if (!result) return -1;
+
+    PhraseScratch sa = { NULL, NULL, 0 }, sb = { NULL, NULL, 0 };
+    int id;
+    while ((id = cursor_next(&c)) > 0) {
+        int na = phrase_starts(&a, idx, &sa);
+        int nb = na > 0 ? phrase_starts(&b, idx + a.count, &sb) : 0;
+        if (nb > 0 && spans_near(sa.starts, na, a.count, sb.starts, nb, b.count, distance)) {
+            result[(*count)++] = id;
+        }
+    }
+    free(sa.starts);
+    free(sa.next);
+    free(sb.starts);
+    free(sb.next);
+
+    *ids = result;
+    return postings_expand(ids, count);
+}
+
+static double bm25(double idf, int freq, int length, double avg_length) {
+    return idf * freq * (BM25_K1 + 1) /
+           (freq + BM25_K1 * (1 - BM25_B + BM25_B * length / avg_length));
+}
+
+typedef struct {
+    const Term *t;
+    DocSetCursor cur;   // current posting
+    double idf;
+    double bound;       // highest score the term can give a document
+} RankCursor;
+
+static int cursor_doc(const RankCursor *c) {
+    return c->cur.id;
+}
+
+// Worse hit first: lower score, or the same score and a higher id
+static int hit_worse(const PostingsHit *a, const PostingsHit *b) {
+    return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+static void heap_sift_down(PostingsHit *heap, int n, int i) {
+    for (;;) {
+        int worst = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && hit_worse(&heap[l], &heap[worst])) worst = l;
+        if (r < n && hit_worse(&heap[r], &heap[worst])) worst = r;
+        if (worst == i) return;
+        PostingsHit tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// Keeps the k best hits in a min-heap rooted at the worst of them
+static void heap_offer(PostingsHit *heap, int *n, int k, int id, double score) {
+    PostingsHit hit = { id, score };
+    if (*n < k) {
+        int i = (*n)++;
+        heap[i] = hit;
+        while (i > 0 && hit_worse(&heap[i], &heap[(i - 1) / 2])) {
+            PostingsHit tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (hit_worse(&heap[0], &hit)) {
+        heap[0] = hit;
+        heap_sift_down(heap, *n, 0);
+    }
+}
+
+static int compare_hits(const void *a, const void *b) {
+    const PostingsHit *x = a, *y = b;
+    return hit_worse(x, y) ? 1 : hit_worse(y, x) ? -1 : 0;
+}
+
+// Top k documents for the words of keyword by BM25, best first, into hits.
+// Each word matches the terms that contain it, as a single -s keyword does,
+// and every such term adds its own score. WAND: the lists are kept sorted by
+// their current document, and a document is scored only when the bounds of
+// the lists that reach it can beat the k-th best score so far; lists behind
+// it skip forward. Documents sharing content are scored once, as one
+// document, and fanned out at the end. Returns the number of hits, or -1 if
+// keyword has no word.
+int postings_rank(const char *keyword, int k, PostingsHit *hits) {
+    int doc_count = body_live;
+    const char *words[POSTINGS_PHRASE_MAX];
+    int word_len[POSTINGS_PHRASE_MAX];
+    int word_count = 0;
+    for (const char *s = keyword; *s && word_count < POSTINGS_PHRASE_MAX; ) {
+        if (!is_term_char((unsigned char)*s)) {
+            s++;
+            continue;
+        }
+        int len = 0;
+        while (is_term_char((unsigned char)s[len])) len++;
+        words[word_count] = s;
+        word_len[word_count++] = len;
+        s += len;
+    }
+    if (word_count == 0) return -1;
+    if (k <= 0 || doc_count <= 0 || total_length <= 0) return 0;
+
+    // Terms containing any of the words, in term order, each once
+    int *matched = NULL, matched_count = 0;
+    for (int w = 0; w < word_count; w++) {
+        int *found;
+        int found_count = terms_containing(words[w], word_len[w], &found);
+        int *grown = found_count == -1 ? NULL : realloc(matched, (matched_count + found_count + 1) * sizeof(int));
+        if (!grown) {
+            free(found);
+            free(matched);
+            return -1;
+        }
+        matched = grown;
+        if (found_count) memcpy(matched + matched_count, found, found_count * sizeof(int));
+        matched_count += found_count;
+        free(found);
+    }
+    if (word_count > 1) qsort(matched, matched_count, sizeof(int), compare_ids);
+
+    int n = 0;
+    RankCursor *cursors = NULL;
+    double avg_length = (double)total_length / doc_count;
+    for (int m = 0; m < matched_count; m++) {
+        if (m > 0 && matched[m] == matched[m - 1]) continue;
+        const Term *t = &terms[matched[m]];
+        if (t->ids.count == 0) continue;
+
+        if ((n & (n - 1)) == 0) {
+            RankCursor *grown = realloc(cursors, (n ? n * 2 : 16) * sizeof(RankCursor));
+            if (!grown) {
+                free(cursors);
+                free(matched);
+                return -1;
+            }
+            cursors = grown;
+        }
+        RankCursor *c = &cursors[n++];
+        c->t = t;
+        docset_cursor(&c->cur, &t->ids);
+        c->idf = log(1 + (doc_count - t->ids.count + 0.5) / (t->ids.count + 0.5));
+        // Increasing in freq, decreasing in length; the margin covers rounding
+        c->bound = bm25(c->idf, t->max_freq, t->min_length, avg_length) * (1 + 1e-9);
+    }
+    free(matched);
+
+    int found = 0;
+    for (;;) {
+        // Drop finished lists, then insertion-sort by current document:
+        // only the lists that moved are out of place
+        for (int i = 0; i < n; ) {
+            if (cursors[i].cur.id == INT_MAX) cursors[i] = cursors[--n];
+            else i++;
+        }
+        for (int i = 1; i < n; i++) {
+            RankCursor c = cursors[i];
+            int j = i;
+            while (j > 0 && cursor_doc(&cursors[j - 1]) > cursor_doc(&c)) {
+                cursors[j] = cursors[j - 1];
+                j--;
+            }
+            cursors[j] = c;
+        }
+
+        // Pivot: the first document whose lists together could enter the top k
+        double threshold = found == k ? hits[0].score : -1;
+        double reach = 0;
+        int pivot = -1;
+        for (int i = 0; i < n; i++) {
+            reach += cursors[i].bound;
+            if (reach > threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == -1) break;
+
+        int doc = cursor_doc(&cursors[pivot]);
+        if (cursor_doc(&cursors[0]) == doc) {
+            double score = 0;
+            for (int i = 0; i < n && cursor_doc(&cursors[i]) == doc; i++) {
+                const Term *t = cursors[i].t;
+                score += bm25(cursors[i].idf, t->freqs[cursors[i].cur.index], doc_lengths[doc], avg_length);
+                docset_next(&cursors[i].cur);
+            }
+            heap_offer(hits, &found, k, doc, score);
+        } else {
+            // No document before the pivot can make the top k
+            for (int i = 0; i < pivot; i++) docset_seek(&cursors[i].cur, doc);
+        }
+    }
+
+    free(cursors);
+    qsort(hits, found, sizeof(PostingsHit), compare_hits);
+    if (twin_total == 0 || found == 0) return found;
+
+    // Every body gives at least one document, so k bodies fill k hits
+    PostingsHit *ranked = malloc(found * sizeof(PostingsHit));
+    if (!ranked) return found;
+    memcpy(ranked, hits, found * sizeof(PostingsHit));
+    int filled = 0;
+    for (int i = 0; i < found && filled < k; i++) {
+        hits[filled++] = ranked[i];
+        int id = ranked[i].id;
+        if (id >= doc_body_cap || !doc_body[id]) continue;
+        const Body *b = &bodies[doc_body[id] - 1];
+        for (int j = 0; j < b->twin_count && filled < k; j++) {
+            hits[filled].id = b->twins[j];
+            hits[filled++].score = ranked[i].score;
+        }
+    }
+    free(ranked);
+    qsort(hits, filled, sizeof(PostingsHit), compare_hits);
+    return filled;
+}
+
+// One line per body, "@id hash size twin,twin", then one line per term:
+// "term|id:d,d,d id:d,d" with the position deltas of each document.
+// Written aside and renamed, like the index snapshot.
+int postings_save(const char *filename, int doc_count, int next_id) {
+    char tmpfile[512];
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+    FILE *fp = fopen(tmpfile, "w");
+    if (!fp) return 0;
+
+    fprintf(fp, "POSTINGS v%d %d %d\n", POSTINGS_VERSION, doc_count, next_id);
+    for (int i = 0; i < body_slots; i++) {
+        const Body *b = &bodies[i];
+        if (!b->id) continue;
+        fprintf(fp, "@%d %016llx %llu ", b->id, (unsigned long long)b->hash, (unsigned long long)b->size);
+        for (int j = 0; j < b->twin_count; j++) fprintf(fp, j ? ",%d" : "%d", b->twins[j]);
+        fputc('\n', fp);
+    }
+    for (int i = 0; i < term_count; i++) {
+        Term *t = &terms[i];
+        if (t->ids.count == 0) continue;
+        fprintf(fp, "%s|", t->text);
+        DocSetCursor c;
+        for (docset_cursor(&c, &t->ids); c.id != INT_MAX; docset_next(&c)) {
+            int j = c.index;
+            fprintf(fp, j ? " %d:" : "%d:", c.id);
+            const unsigned char *p = t->pos + t->pos_off[j], *end = t->pos + t->pos_off[j + 1];
+            for (int first = 1; p < end; first = 0) {
+                fprintf(fp, first ? "%u" : ",%u", varint_get(&p));
+            }
+        }
+        fputc('\n', fp);
+    }
+
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed || rename(tmpfile, filename) == -1) {
+        unlink(tmpfile);
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 0 if the file is missing, from an older version or does not match
+// the loaded index, in which case the caller rebuilds the postings from the
+// documents.
+int postings_load(const char *filename, int doc_count, int next_id) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    postings_clear();
+
+    int version, saved_count, saved_next;
+    if (fscanf(fp, "POSTINGS v%d %d %d\n", &version, &saved_count, &saved_next) != 3 ||
+        version != POSTINGS_VERSION || saved_count != doc_count || saved_next != next_id) {
+        fclose(fp);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    unsigned char *enc = NULL;
+    int enc_cap = 0;
+    int ok = 1;
+    while (ok && (len = getline(&line, &line_cap, fp)) > 0) {
+        if (line[0] == '@') {
+            int id;
+            unsigned long long hash, size;
+            int used;
+            if (sscanf(line, "@%d %llx %llu %n", &id, &hash, &size, &used) < 3 || id <= 0) continue;
+            int slot = body_create(id, hash, size);
+            if (slot == -1) {
+                ok = 0;
+                break;
+            }
+            for (char *p = line + used, *end; ; p = end + 1) {
+                long twin = strtol(p, &end, 10);
+                if (end == p || twin <= 0 || doc_body_reserve(twin) == -1) break;
+                if (body_add_twin(&bodies[slot], (int)twin) == 0) doc_body[twin] = slot + 1;
+                if (*end != ',') break;
+            }
+            continue;
+        }
+        char *sep = strchr(line, '|');
+        if (!sep || sep == line) continue;
+
+        Term *t = term_get(line, sep - line, 1);
+        if (!t) break;
+
+        char *p = sep + 1, *end;
+        for (;;) {
+            long id = strtol(p, &end, 10);
+            if (end == p || *end != ':') break;
+            p = end + 1;
+
+            // Re-encode the deltas: a varint never needs more bytes than
+            // the decimal digits it came from
+            int enc_len = 0;
+            if (enc_cap < len) {
+                enc_cap = len;
+                unsigned char *grown = realloc(enc, enc_cap);
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                enc = grown;
+            }
+            for (;;) {
+                unsigned long delta = strtoul(p, &end, 10);
+                if (end == p) break;
+                enc_len += varint_put(enc + enc_len, (uint32_t)delta);
+                p = end;
+                if (*p != ',') break;
+                p++;
+            }
+            term_add_posting(t, (int)id, enc, enc_len);
+        }
+    }
+
+    free(enc);
+    free(line);
+    fclose(fp);
+
+    // Every token is an occurrence of some term, so document lengths are
+    // the sums of the frequencies
+    for (int i = 0; i < term_count && ok; i++) {
+        Term *t = &terms[i];
+        DocSetCursor c;
+        for (docset_cursor(&c, &t->ids); c.id != INT_MAX; docset_next(&c)) {
+            if (lengths_reserve(c.id) == -1) {
+                ok = 0;
+                break;
+            }
+            doc_lengths[c.id] += t->freqs[c.index];
+            total_length += t->freqs[c.index];
+            doc_terms_append(c.id, i);
+        }
+    }
+    for (int i = 0; i < term_count && ok; i++) {
+        Term *t = &terms[i];
+        DocSetCursor c;
+        for (docset_cursor(&c, &t->ids); c.id != INT_MAX; docset_next(&c)) {
+            int length = doc_lengths[c.id];
+            if (!t->min_length || length < t->min_length) t->min_length = length;
+        }
+    }
+    return ok;
+}
+
+void postings_clear() {
+    for (int i = 0; i < term_count; i++) {
+        free(terms[i].text);
+        docset_free(&terms[i].ids);
+        free(terms[i].pos_off);
+        free(terms[i].pos);
+        free(terms[i].freqs);
+    }
+    free(terms);
+    free(table);
+    free(doc_lengths);
+    grams_clear();
+    for (int i = 0; i < doc_terms_cap; i++) free(doc_terms[i].data);
+    free(doc_terms);
+    doc_terms = NULL;
+    doc_terms_cap = 0;
+    doc_terms_valid = 1;
+    terms = NULL;
+    table = NULL;
+    doc_lengths = NULL;
+    term_count = term_capacity = table_size = doc_lengths_cap = 0;
+    total_length = 0;
+
+    for (int i = 0; i < body_slots; i++) free(bodies[i].twins);
+    free(bodies);
+    free(body_table);
+    free(doc_body);
+    bodies = NULL;
+    body_table = NULL;
+    doc_body = NULL;
+    body_slots = body_cap = body_live = twin_total = body_table_size = doc_body_cap = 0;
+    body_free = -1;
+}
+
+int postings_term_count() {
+    return term_count;
+}
+
+void postings_id_usage(long *postings, long *bytes, int *bitmaps) {
+    *postings = *bytes = 0;
+    *bitmaps = 0;
+    for (int i = 0; i < term_count; i++) {
+        *postings += terms[i].ids.count;
+        *bytes += docset_bytes(&terms[i].ids);
+        *bitmaps += terms[i].ids.type == DOCSET_BITMAP;
+    }
+}
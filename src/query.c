@@ -0,0 +1,486 @@
+#include "common.h"
+#include "query.h"
+
+#define QUERY_MAX_TOKENS 64
+
+typedef enum { NODE_TERM, NODE_AND, NODE_OR, NODE_NOT, NODE_NEAR } NodeType;
+
+typedef struct Node {
+    NodeType type;
+    char *text;                 // NODE_TERM
+    int distance;               // NODE_NEAR
+    struct Node **children;
+    int child_count;
+} Node;
+
+typedef struct {
+    char *tokens[QUERY_MAX_TOKENS];
+    int count;
+    int pos;
+    char *error;
+    size_t error_size;
+} Parser;
+
+typedef struct {
+    int *ids;
+    int count;
+} IdSet;
+
+static int is_operator(const char *token, const char *op) {
+    return token && strcmp(token, op) == 0;
+}
+
+// "NEAR/k" gives k, anything else -1
+static int near_distance(const char *token) {
+    if (!token || strncmp(token, "NEAR/", 5) != 0 || !token[5]) return -1;
+    char *end;
+    long k = strtol(token + 5, &end, 10);
+    return *end || k < 0 || k > 1000000 ? -1 : (int)k;
+}
+
+// Splits on whitespace; parentheses are tokens of their own and a double
+// quoted phrase is one token, quotes included. Returns -2 for an
+// unterminated quote.
+static int tokenize(const char *text, Parser *p) {
+    p->count = 0;
+    for (const char *s = text; *s; ) {
+        if (*s == ' ' || *s == '\t') {
+            s++;
+            continue;
+        }
+        size_t len;
+        if (*s == '"') {
+            const char *close = strchr(s + 1, '"');
+            if (!close) return -2;
+            len = close - s + 1;
+        } else {
+            len = (*s == '(' || *s == ')') ? 1 : strcspn(s, " \t()\"");
+        }
+        if (p->count == QUERY_MAX_TOKENS) return -1;
+        p->tokens[p->count] = strndup(s, len);
+        if (!p->tokens[p->count]) return -1;
+        p->count++;
+        s += len;
+    }
+    return 0;
+}
+
+// A keyword is read as a query only if it has an operator word or starts
+// with '(' or '"', so plain keywords (regexes, multi-word strings) keep
+// their meaning
+int query_is_boolean(const char *text) {
+    char first = text[strspn(text, " \t")];
+    if (first == '(' || first == '"') return 1;
+
+    Parser p = { .count = 0 };
+    if (tokenize(text, &p) < 0) {
+        // Reported by query_evaluate
+        for (int i = 0; i < p.count; i++) free(p.tokens[i]);
+        return 1;
+    }
+    int boolean = 0;
+    for (int i = 0; i < p.count; i++) {
+        if (is_operator(p.tokens[i], "AND") || is_operator(p.tokens[i], "OR") ||
+            is_operator(p.tokens[i], "NOT") || near_distance(p.tokens[i]) >= 0) boolean = 1;
+        free(p.tokens[i]);
+    }
+    return boolean;
+}
+
+static void node_free(Node *n) {
+    if (!n) return;
+    for (int i = 0; i < n->child_count; i++) node_free(n->children[i]);
+    free(n->children);
+    free(n->text);
+    free(n);
+}
+
+static Node *node_new(NodeType type) {
+    Node *n = calloc(1, sizeof(Node));
+    if (n) n->type = type;
+    return n;
+}
+
+static int node_add(Node *parent, Node *child) {
+    Node **grown = realloc(parent->children, (parent->child_count + 1) * sizeof(Node *));
+    if (!grown) return -1;
+    parent->children = grown;
+    parent->children[parent->child_count++] = child;
+    return 0;
+}
+
+static Node *parse_error(Parser *p, const char *message) {
+    if (!p->error[0]) snprintf(p->error, p->error_size, "Error: %s", message);
+    return NULL;
+}
+
+static const char *peek(Parser *p) {
+    return p->pos < p->count ? p->tokens[p->pos] : NULL;
+}
+
+static Node *parse_or(Parser *p);
+
+// primary := '(' or ')' | TERM ;  near := primary [NEAR/k primary] ;
+// unary := NOT unary | near
+static Node *parse_primary(Parser *p) {
+    const char *t = peek(p);
+    if (!t) return parse_error(p, "Incomplete query");
+
+    if (is_operator(t, "(")) {
+        p->pos++;
+        Node *n = parse_or(p);
+        if (!n) return NULL;
+        if (!is_operator(peek(p), ")")) {
+            node_free(n);
+            return parse_error(p, "Missing ')' in query");
+        }
+        p->pos++;
+        return n;
+    }
+    if (is_operator(t, ")") || is_operator(t, "AND") || is_operator(t, "OR") ||
+        is_operator(t, "NOT") || near_distance(t) >= 0) {
+        return parse_error(p, "Unexpected operator in query");
+    }
+
+    Node *n = node_new(NODE_TERM);
+    if (!n || !(n->text = strdup(t))) {
+        node_free(n);
+        return parse_error(p, "Memory allocation failed");
+    }
+    p->pos++;
+    return n;
+}
+
+// Proximity works on positions, so both sides must be words or phrases
+static Node *parse_near(Parser *p) {
+    Node *left = parse_primary(p);
+    if (!left) return NULL;
+    int distance = near_distance(peek(p));
+    if (distance < 0) return left;
+    p->pos++;
+
+    Node *right = parse_primary(p);
+    if (!right) {
+        node_free(left);
+        return NULL;
+    }
+    if (left->type != NODE_TERM || right->type != NODE_TERM) {
+        node_free(left);
+        node_free(right);
+        return parse_error(p, "NEAR needs a word or phrase on each side");
+    }
+
+    Node *n = node_new(NODE_NEAR);
+    if (!n || node_add(n, left) == -1) {
+        node_free(left);
+        node_free(right);
+        node_free(n);
+        return parse_error(p, "Memory allocation failed");
+    }
+    if (node_add(n, right) == -1) {
+        node_free(right);
+        node_free(n);
+        return parse_error(p, "Memory allocation failed");
+    }
+    n->distance = distance;
+    return n;
+}
+
+static Node *parse_unary(Parser *p) {
+    const char *t = peek(p);
+    if (!t) return parse_error(p, "Incomplete query");
+
+    if (is_operator(t, "NOT")) {
+        p->pos++;
+        Node *child = parse_unary(p);
+        Node *n = child ? node_new(NODE_NOT) : NULL;
+        if (!n || node_add(n, child) == -1) {
+            node_free(child);
+            node_free(n);
+            return parse_error(p, "Invalid query");
+        }
+        return n;
+    }
+    return parse_near(p);
+}
+
+// Builds an n-ary node of `type` from operands joined by `op` (NULL for the
+// implicit AND between adjacent terms)
+static Node *parse_chain(Parser *p, NodeType type, Node *(*operand)(Parser *), int implicit) {
+    Node *first = operand(p);
+    if (!first) return NULL;
+
+    Node *chain = NULL;
+    for (;;) {
+        const char *t = peek(p);
+        const char *op = type == NODE_AND ? "AND" : "OR";
+        int explicit_op = is_operator(t, op);
+        int adjacent = implicit && t && !is_operator(t, ")") && !is_operator(t, "OR");
+        if (!explicit_op && !adjacent) break;
+        if (explicit_op) p->pos++;
+
+        Node *next = operand(p);
+        if (!next) {
+            node_free(first);
+            node_free(chain);
+            return NULL;
+        }
+        if (!chain) {
+            chain = node_new(type);
+            if (!chain || node_add(chain, first) == -1) {
+                node_free(first);
+                node_free(next);
+                node_free(chain);
+                return parse_error(p, "Memory allocation failed");
+            }
+        }
+        if (node_add(chain, next) == -1) {
+            node_free(next);
+            node_free(chain);
+            return parse_error(p, "Memory allocation failed");
+        }
+    }
+    return chain ? chain : first;
+}
+
+static Node *parse_and(Parser *p) {
+    return parse_chain(p, NODE_AND, parse_unary, 1);
+}
+
+static Node *parse_or(Parser *p) {
+    return parse_chain(p, NODE_OR, parse_and, 0);
+}
+
+// Exponential then binary search for the first b[i] >= x, starting at lo
+static int gallop(const int *b, int nb, int lo, int x) {
+    int step = 1, hi = lo;
+    while (hi < nb && b[hi] < x) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > nb) hi = nb;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Set operations on ascending id lists. out may alias a; the smaller list
+// drives the galloping search so the cost follows the rarer side.
+int ids_intersect(const int *a, int na, const int *b, int nb, int *out) {
+    if (na > nb) {
+        const int *t = a; a = b; b = t;
+        int n = na; na = nb; nb = n;
+    }
+    int w = 0;
+    for (int i = 0, j = 0; i < na && j < nb; i++) {
+        j = gallop(b, nb, j, a[i]);
+        if (j < nb && b[j] == a[i]) out[w++] = a[i];
+    }
+    return w;
+}
+
+int ids_union(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, w = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) out[w++] = a[i++];
+        else if (b[j] < a[i]) out[w++] = b[j++];
+        else {
+            out[w++] = a[i++];
+            j++;
+        }
+    }
+    while (i < na) out[w++] = a[i++];
+    while (j < nb) out[w++] = b[j++];
+    return w;
+}
+
+int ids_difference(const int *a, int na, const int *b, int nb, int *out) {
+    int w = 0;
+    for (int i = 0, j = 0; i < na; i++) {
+        j = gallop(b, nb, j, a[i]);
+        if (j == nb || b[j] != a[i]) out[w++] = a[i];
+    }
+    return w;
+}
+
+typedef struct {
+    query_term_fn term;
+    query_near_fn near;
+    query_all_fn all;
+    query_filter_fn filter;
+    void *ctx;
+} Evaluator;
+
+// One operand of an AND: tested through its filter when the caller has
+// one for it, otherwise listed in set
+typedef struct {
+    const Node *node;
+    long cost;
+    QueryFilter filter;
+    IdSet set;
+} Operand;
+
+static int evaluate(const Evaluator *ev, const Node *n, IdSet *out);
+
+static int compare_cost(const void *a, const void *b) {
+    long x = ((const Operand *)a)->cost, y = ((const Operand *)b)->cost;
+    return (x > y) - (x < y);
+}
+
+static int operand_open(const Evaluator *ev, const Node *n, Operand *o) {
+    memset(o, 0, sizeof(*o));
+    o->node = n;
+    if (n->type == NODE_TERM && ev->filter && ev->filter(n->text, ev->ctx, &o->filter) == 0) {
+        o->cost = o->filter.cost;
+        return 0;
+    }
+    o->filter.filter = NULL;
+    if (evaluate(ev, n, &o->set) == -1) return -1;
+    o->cost = o->set.count;
+    return 0;
+}
+
+static void operand_close(Operand *o) {
+    if (o->filter.filter) o->filter.close(o->filter.state);
+    free(o->set.ids);
+}
+
+// Only the cheapest positive operand is listed. The others narrow that
+// list rarest first, stopping once it is empty, and NOT operands are then
+// subtracted instead of complemented: a filtered term costs a seek per
+// listed id, not the documents it holds.
+static int evaluate_and(const Evaluator *ev, const Node *n, IdSet *out) {
+    Operand *ops = calloc(n->child_count, sizeof(Operand));
+    if (!ops) return -1;
+    int positives = 0, ok = 0;
+
+    for (int i = 0; i < n->child_count; i++) {
+        if (n->children[i]->type == NODE_NOT) continue;
+        if (operand_open(ev, n->children[i], &ops[positives]) == -1) goto done;
+        positives++;
+    }
+
+    IdSet acc = { NULL, 0 };
+    if (positives == 0) {
+        if (ev->all(ev->ctx, &acc.ids, &acc.count) != 0) goto done;
+    } else {
+        qsort(ops, positives, sizeof(Operand), compare_cost);
+        if (ops[0].filter.filter) {
+            if (ev->term(ops[0].node->text, ev->ctx, &acc.ids, &acc.count) != 0) goto done;
+        } else {
+            acc = ops[0].set;
+            ops[0].set.ids = NULL;
+        }
+        for (int i = 1; i < positives && acc.count > 0; i++) {
+            Operand *o = &ops[i];
+            if (o->filter.filter) acc.count = o->filter.filter(o->filter.state, acc.ids, acc.count, 1);
+            else acc.count = ids_intersect(acc.ids, acc.count, o->set.ids, o->set.count, acc.ids);
+        }
+    }
+
+    for (int i = 0; i < n->child_count && acc.count > 0; i++) {
+        if (n->children[i]->type != NODE_NOT) continue;
+        Operand neg;
+        if (operand_open(ev, n->children[i]->children[0], &neg) == -1) {
+            free(acc.ids);
+            goto done;
+        }
+        if (neg.filter.filter) acc.count = neg.filter.filter(neg.filter.state, acc.ids, acc.count, 0);
+        else acc.count = ids_difference(acc.ids, acc.count, neg.set.ids, neg.set.count, acc.ids);
+        operand_close(&neg);
+    }
+    *out = acc;
+    ok = 1;
+
+done:
+    for (int i = 0; i < positives; i++) operand_close(&ops[i]);
+    free(ops);
+    return ok ? 0 : -1;
+}
+
+static int evaluate(const Evaluator *ev, const Node *n, IdSet *out) {
+    out->ids = NULL;
+    out->count = 0;
+
+    switch (n->type) {
+        case NODE_TERM:
+            return ev->term(n->text, ev->ctx, &out->ids, &out->count) == 0 ? 0 : -1;
+        case NODE_NEAR:
+            return ev->near(n->children[0]->text, n->children[1]->text, n->distance, ev->ctx,
+                            &out->ids, &out->count) == 0 ? 0 : -1;
+        case NODE_AND:
+            return evaluate_and(ev, n, out);
+        case NODE_NOT: {
+            // A lone NOT: everything except the operand
+            IdSet all, neg;
+            if (ev->all(ev->ctx, &all.ids, &all.count) != 0) return -1;
+            if (evaluate(ev, n->children[0], &neg) == -1) {
+                free(all.ids);
+                return -1;
+            }
+            all.count = ids_difference(all.ids, all.count, neg.ids, neg.count, all.ids);
+            free(neg.ids);
+            *out = all;
+            return 0;
+        }
+        case NODE_OR:
+            for (int i = 0; i < n->child_count; i++) {
+                IdSet next;
+                if (evaluate(ev, n->children[i], &next) == -1) {
+                    free(out->ids);
+                    return -1;
+                }
+                int *merged = malloc((out->count + next.count + 1) * sizeof(int));
+                if (!merged) {
+                    free(out->ids);
+                    free(next.ids);
+                    return -1;
+                }
+                out->count = ids_union(out->ids, out->count, next.ids, next.count, merged);
+                free(out->ids);
+                free(next.ids);
+                out->ids = merged;
+            }
+            return 0;
+    }
+    return -1;
+}
+
+// Returns 0 with a malloc'd ascending id list, or -1 with error filled in
+int query_evaluate(const char *text, query_term_fn term, query_near_fn near, query_all_fn all,
+                   query_filter_fn filter, void *ctx, int **ids, int *count, char *error, size_t error_size) {
+    *ids = NULL;
+    *count = 0;
+    error[0] = '\0';
+
+    Parser p = { .count = 0, .pos = 0, .error = error, .error_size = error_size };
+    Node *root = NULL;
+    int tokenized = tokenize(text, &p);
+    if (tokenized == -2) {
+        parse_error(&p, "Missing closing '\"' in query");
+    } else if (tokenized == -1) {
+        parse_error(&p, "Query too long");
+    } else if ((root = parse_or(&p)) != NULL && p.pos < p.count) {
+        parse_error(&p, is_operator(peek(&p), ")") ? "Unbalanced ')' in query" : "Invalid query");
+    }
+    for (int i = 0; i < p.count; i++) free(p.tokens[i]);
+
+    int rc = -1;
+    if (root && !error[0]) {
+        Evaluator ev = { term, near, all, filter, ctx };
+        IdSet result;
+        if (evaluate(&ev, root, &result) == 0) {
+            *ids = result.ids;
+            *count = result.count;
+            rc = 0;
+        } else {
+            snprintf(error, error_size, "Error: Query evaluation failed");
+        }
+    }
+    node_free(root);
+    return rc;
+}
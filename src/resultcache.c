@@ -0,0 +1,271 @@
+#include "common.h"
+#include "resultcache.h"
+#include <pthread.h>
+
+// Chained hash on the keyword plus an intrusive LRU list (head = most
+// recent), like the document cache. Mutations arrive under the index write
+// lock and lookups under the read lock, so the generation cannot move while
+// a search computes or stores its result.
+#define RESULTCACHE_BUCKETS 1024
+#define CHANGE_LOG 256          // mutations a stale result can catch up on
+
+typedef struct ResultEntry {
+    char *keyword;
+    int *ids;
+    int count;
+    unsigned long generation;
+    size_t bytes;
+    unsigned int hash;
+    struct ResultEntry *prev, *next, *hash_next;
+} ResultEntry;
+
+typedef struct {
+    unsigned long generation;
+    int id;
+    int added;                  // 1 = add, 0 = remove
+    char path[MAX_PATH + 1];
+} Change;
+
+static ResultEntry *buckets[RESULTCACHE_BUCKETS];
+static ResultEntry *lru_head = NULL, *lru_tail = NULL;
+static size_t budget = (size_t)RESULTCACHE_DEFAULT_KB << 10;
+static size_t cached_bytes = 0;
+static int cached_count = 0;
+static resultcache_match_fn match_fn = NULL;
+
+static Change changes[CHANGE_LOG];
+static unsigned long generation = 0;
+
+static long hits = 0, patched = 0, misses = 0, evictions = 0;
+
+static pthread_mutex_t resultcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void resultcache_init(size_t budget_bytes, resultcache_match_fn match) {
+    pthread_mutex_lock(&resultcache_lock);
+    budget = budget_bytes;
+    match_fn = match;
+    pthread_mutex_unlock(&resultcache_lock);
+}
+
+static unsigned int keyword_hash(const char *keyword) {
+    unsigned int h = 2166136261u;
+    for (; *keyword; keyword++) h = (h ^ (unsigned char)*keyword) * 16777619u;
+    return h;
+}
+
+static void lru_unlink(ResultEntry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_link_front(ResultEntry *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static ResultEntry *entry_find(const char *keyword, unsigned int hash) {
+    ResultEntry *e = buckets[hash & (RESULTCACHE_BUCKETS - 1)];
+    while (e && (e->hash != hash || strcmp(e->keyword, keyword) != 0)) e = e->hash_next;
+    return e;
+}
+
+static void entry_drop(ResultEntry *e) {
+    ResultEntry **p = &buckets[e->hash & (RESULTCACHE_BUCKETS - 1)];
+    while (*p != e) p = &(*p)->hash_next;
+    *p = e->hash_next;
+    lru_unlink(e);
+    cached_bytes -= e->bytes;
+    cached_count--;
+    free(e->keyword);
+    free(e->ids);
+    free(e);
+}
+
+static void note_change(int id, int added, const char *path) {
+    pthread_mutex_lock(&resultcache_lock);
+    Change *c = &changes[++generation % CHANGE_LOG];
+    c->generation = generation;
+    c->id = id;
+    c->added = added;
+    strncpy(c->path, path ? path : "", MAX_PATH);
+    c->path[MAX_PATH] = '\0';
+    pthread_mutex_unlock(&resultcache_lock);
+}
+
+void resultcache_note_add(int id, const char *path) {
+    note_change(id, 1, path);
+}
+
+void resultcache_note_remove(int id) {
+    note_change(id, 0, NULL);
+}
+
+typedef struct {
+    int id;
+    int added;
+    int matches;
+    char path[MAX_PATH + 1];
+} Replay;
+
+// Applies the replayed changes, whose matches are already known.
+// Ids are assigned in increasing order, so an added match goes at the end.
+static int entry_apply(ResultEntry *e, const Replay *replay, int n) {
+    for (int r = 0; r < n; r++) {
+        if (replay[r].added) {
+            if (!replay[r].matches) continue;
+            int *grown = realloc(e->ids, (e->count + 1) * sizeof(int));
+            if (!grown) return 0;
+            e->ids = grown;
+            e->ids[e->count++] = replay[r].id;
+            e->bytes += sizeof(int);
+            cached_bytes += sizeof(int);
+        } else {
+            for (int i = 0; i < e->count; i++) {
+                if (e->ids[i] != replay[r].id) continue;
+                memmove(&e->ids[i], &e->ids[i + 1], (e->count - i - 1) * sizeof(int));
+                e->count--;
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+// Brings a stale entry up to date with the changes after its generation;
+// called and returns with the lock held. The added documents are scanned
+// with the lock released so other searches are not held up, and the
+// replay is applied only if the entry was left alone meanwhile. Returns
+// the up-to-date entry, or NULL once dropped.
+static ResultEntry *entry_refresh(ResultEntry *e, const char *keyword, unsigned int hash) {
+    unsigned long from = e->generation, to = generation;
+    Replay *replay = to - from <= CHANGE_LOG ? malloc((to - from) * sizeof(Replay)) : NULL;
+    if (!replay) {
+        entry_drop(e);
+        return NULL;
+    }
+    int n = 0;
+    for (unsigned long g = from + 1; g <= to; g++, n++) {
+        const Change *c = &changes[g % CHANGE_LOG];
+        replay[n].id = c->id;
+        replay[n].added = c->added;
+        memcpy(replay[n].path, c->path, sizeof(c->path));
+    }
+
+    pthread_mutex_unlock(&resultcache_lock);
+    for (int r = 0; r < n; r++) {
+        replay[r].matches = replay[r].added && match_fn && match_fn(replay[r].path, keyword) == 1;
+    }
+    pthread_mutex_lock(&resultcache_lock);
+
+    e = entry_find(keyword, hash);
+    if (e && e->generation == from) {
+        if (entry_apply(e, replay, n)) {
+            e->generation = to;
+            patched++;
+        } else {
+            e->generation = 0;     // half applied: dropped below
+        }
+    }
+    free(replay);
+    // Refreshed by another search, replaced, or behind again
+    if (e && e->generation != generation) {
+        entry_drop(e);
+        return NULL;
+    }
+    return e;
+}
+
+// 1 with a malloc'd copy of the ids on a hit, 0 on a miss
+int resultcache_get(const char *keyword, int **ids, int *count) {
+    unsigned int hash = keyword_hash(keyword);
+    pthread_mutex_lock(&resultcache_lock);
+
+    ResultEntry *e = entry_find(keyword, hash);
+    if (e && e->generation != generation) {
+        e = entry_refresh(e, keyword, hash);
+        // Added matches grow the entry; make room for it again
+        while (e && cached_bytes > budget && lru_tail && lru_tail != e) {
+            evictions++;
+            entry_drop(lru_tail);
+        }
+        if (e && cached_bytes > budget) {
+            entry_drop(e);
+            e = NULL;
+        }
+    }
+    if (!e) {
+        misses++;
+        pthread_mutex_unlock(&resultcache_lock);
+        return 0;
+    }
+
+    *ids = malloc((e->count ? e->count : 1) * sizeof(int));
+    if (!*ids) {
+        pthread_mutex_unlock(&resultcache_lock);
+        return 0;
+    }
+    memcpy(*ids, e->ids, e->count * sizeof(int));
+    *count = e->count;
+    hits++;
+    lru_unlink(e);
+    lru_link_front(e);
+    pthread_mutex_unlock(&resultcache_lock);
+    return 1;
+}
+
+// Stores the result computed at the current generation
+void resultcache_put(const char *keyword, const int *ids, int count) {
+    size_t bytes = sizeof(ResultEntry) + strlen(keyword) + 1 + count * sizeof(int);
+    if (bytes > budget) return;
+
+    ResultEntry *e = calloc(1, sizeof(ResultEntry));
+    if (!e) return;
+    e->keyword = strdup(keyword);
+    e->ids = malloc((count ? count : 1) * sizeof(int));
+    if (!e->keyword || !e->ids) {
+        free(e->keyword);
+        free(e->ids);
+        free(e);
+        return;
+    }
+    if (count > 0) memcpy(e->ids, ids, count * sizeof(int));
+    e->count = count;
+    e->bytes = bytes;
+    e->hash = keyword_hash(keyword);
+
+    pthread_mutex_lock(&resultcache_lock);
+    ResultEntry *old = entry_find(keyword, e->hash);
+    if (old) entry_drop(old);
+    while (cached_bytes + bytes > budget && lru_tail) {
+        evictions++;
+        entry_drop(lru_tail);
+    }
+    e->generation = generation;
+    e->hash_next = buckets[e->hash & (RESULTCACHE_BUCKETS - 1)];
+    buckets[e->hash & (RESULTCACHE_BUCKETS - 1)] = e;
+    lru_link_front(e);
+    cached_bytes += bytes;
+    cached_count++;
+    pthread_mutex_unlock(&resultcache_lock);
+}
+
+// Patched results count as hits
+void resultcache_counts(long *hit_count, long *miss_count) {
+    pthread_mutex_lock(&resultcache_lock);
+    *hit_count = hits;
+    *miss_count = misses;
+    pthread_mutex_unlock(&resultcache_lock);
+}
+
+void resultcache_print_stats(FILE *out) {
+    pthread_mutex_lock(&resultcache_lock);
+    fprintf(out, "[RESULTCACHE] Stats → Hits: %ld (%ld patched), Misses: %ld, Evictions: %ld, Keywords: %d, Bytes: %zu/%zu, Generation: %lu\n",
+            hits, patched, misses, evictions, cached_count, cached_bytes, budget, generation);
+    pthread_mutex_unlock(&resultcache_lock);
+}
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include "common.h"
+#include "scan.h"
+#include "doccache.h"
+#include "stats.h"
+#include <regex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+int scan_is_fixed(const char *keyword) {
+    return strpbrk(keyword, ".[]*^$\\") == NULL;
+}
+
+// Counts lines matching the regex, or stops at the first one when
+// first_only is set
+static int regex_count_lines(const char *data, size_t size, const char *keyword, int first_only) {
+    regex_t re;
+    if (regcomp(&re, keyword, REG_NOSUB) != 0) return -1;
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    int count = 0;
+
+    for (size_t start = 0; start < size && !(first_only && count); ) {
+        const char *nl = memchr(data + start, '\n', size - start);
+        size_t len = nl ? (size_t)(nl - (data + start)) : size - start;
+
+        if (len + 1 > line_cap) {
+            line_cap = len + 1 > 256 ? len + 1 : 256;
+            char *grown = realloc(line, line_cap);
+            if (!grown) break;
+            line = grown;
+        }
+        memcpy(line, data + start, len);
+        line[len] = '\0';
+        if (regexec(&re, line, 0, NULL, 0) == 0) count++;
+
+        start += len + 1;
+    }
+
+    free(line);
+    regfree(&re);
+    return count;
+}
+
+// Substring search: candidates are positions where both the first and the
+// last byte of the needle match, tested a vector at a time; only those are
+// compared in full. Each returns the first occurrence or NULL.
+static const char *find_scalar(const char *s, size_t n, const char *needle, size_t k) {
+    return memmem(s, n, needle, k);
+}
+
+// First and last bytes already matched
+static inline int middle_equal(const char *s, const char *needle, size_t k) {
+    for (size_t j = 1; j + 1 < k; j++) {
+        if (s[j] != needle[j]) return 0;
+    }
+    return 1;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *s, size_t n, const char *needle, size_t k) {
+    if (n < k) return NULL;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + k - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (middle_equal(s + i + bit, needle, k)) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(s + i, n - i, needle, k);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *s, size_t n, const char *needle, size_t k) {
+    if (n < k) return NULL;
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + k - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (middle_equal(s + i + bit, needle, k)) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(s + i, n - i, needle, k);
+}
+#endif
+
+typedef const char *(*find_fn)(const char *s, size_t n, const char *needle, size_t k);
+
+static int simd_level = -1;
+
+int scan_simd_level() {
+    if (simd_level == -1) {
+        simd_level = SCAN_SIMD_SCALAR;
+#ifdef SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) simd_level = SCAN_SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse2")) simd_level = SCAN_SIMD_SSE2;
+#endif
+    }
+    return simd_level;
+}
+
+// Caps the instruction set used; levels the CPU lacks are ignored
+void scan_set_simd_level(int level) {
+    simd_level = -1;
+    if (level < scan_simd_level()) simd_level = level;
+}
+
+static find_fn simd_find() {
+#ifdef SCAN_X86
+    switch (scan_simd_level()) {
+        case SCAN_SIMD_AVX2: return find_avx2;
+        case SCAN_SIMD_SSE2: return find_sse2;
+    }
+#endif
+    return find_scalar;
+}
+
+// After a hit the rest of its line is skipped, so a line counts once
+static int fixed_count_lines(const char *data, size_t size, const char *keyword) {
+    find_fn find = simd_find();
+    size_t k = strlen(keyword);
+    const char *p = data, *end = data + size;
+    int count = 0;
+
+    while (p < end && (p = find(p, end - p, keyword, k)) != NULL) {
+        count++;
+        p = memchr(p, '\n', end - p);
+        if (!p) break;
+        p++;
+    }
+    return count;
+}
+
+static int count_all_lines(const char *data, size_t size) {
+    int count = 0;
+    for (const char *p = data, *end = data + size; (p = memchr(p, '\n', end - p)) != NULL; p++) count++;
+    return count + (data[size - 1] != '\n');    // a last line without newline counts too
+}
+
+// Same answer as "grep -q keyword fullpath": 1 match, 0 no match, -1 error
+int scan_file_contains(const char *fullpath, const char *keyword) {
+    const char *data;
+    size_t size;
+    DocCacheEntry *doc = doccache_open(fullpath, &data, &size);
+    if (!doc) return -1;
+
+    int found;
+    stats_count(STAT_BYTES_SCANNED, size);
+    if (!data) {
+        found = 0;      // an empty file has no lines to match
+    } else if (!keyword[0]) {
+        found = 1;
+    } else if (scan_is_fixed(keyword)) {
+        // A keyword without newlines can only match inside a single line
+        found = memmem(data, size, keyword, strlen(keyword)) != NULL;
+    } else {
+        found = regex_count_lines(data, size, keyword, 1);
+    }
+
+    doccache_close(doc);
+    return found;
+}
+
+// Same answer as "grep -c keyword fullpath": matching lines, or -1 on error
+int scan_count_lines(const char *fullpath, const char *keyword) {
+    const char *data;
+    size_t size;
+    DocCacheEntry *doc = doccache_open(fullpath, &data, &size);
+    if (!doc) return -1;
+
+    int count;
+    stats_count(STAT_BYTES_SCANNED, size);
+    if (!data) {
+        count = 0;
+    } else if (!keyword[0]) {
+        count = count_all_lines(data, size);
+    } else if (scan_is_fixed(keyword)) {
+        count = fixed_count_lines(data, size, keyword);
+    } else {
+        count = regex_count_lines(data, size, keyword, 0);
+    }
+
+    doccache_close(doc);
+    return count;
+}
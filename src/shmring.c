@@ -0,0 +1,275 @@
+#include "common.h"
+#include "shmring.h"
+#include <pthread.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Positions are free-running counters; SHM_RING divides 2^32, so pos %
+// SHM_RING stays continuous across their wraparound. Each side's counter
+// and waiting flag sit on their own cache line.
+// A slot is owned by the pid stored in owner (0 = free). serving counts
+// the slot's requests taken by the server and not yet answered: while it
+// is non-zero the server may still write into the ring, so the slot can be
+// neither released nor taken over from a client that died.
+#define SHM_MAGIC 0x444f4353u
+#define WAIT_MS 100
+
+struct ShmSlot {
+    pid_t owner;
+    uint32_t serving;
+    uint32_t req_tail __attribute__((aligned(64)));    // written by the client
+    uint32_t req_head __attribute__((aligned(64)));    // written by the server
+    Message request;
+    uint32_t write_pos __attribute__((aligned(64)));
+    uint32_t writer_waiting;
+    uint32_t read_pos __attribute__((aligned(64)));
+    uint32_t reader_waiting;
+    char data[SHM_RING] __attribute__((aligned(64)));
+};
+
+struct ShmSegment {
+    uint32_t magic;
+    pid_t server_pid;
+    uint32_t doorbell __attribute__((aligned(64)));   // bumped for every request
+    uint32_t server_waiting;
+    ShmSlot slots[SHM_SLOTS];
+};
+
+static ShmSegment *segment = NULL;     // server's mapping
+static void (*deliver_request)(const Message *msg);
+
+static void futex_wait(uint32_t *addr, uint32_t value, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint32_t load(const uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static void store(uint32_t *p, uint32_t value) {
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static int process_gone(pid_t pid) {
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+// Sleeps until *counter moves away from seen, unless it already has once
+// the waiting flag is visible to the other side
+static void wait_for_change(uint32_t *counter, uint32_t seen, uint32_t *waiting, int timeout_ms) {
+    store(waiting, 1);
+    if (load(counter) == seen) futex_wait(counter, seen, timeout_ms);
+    store(waiting, 0);
+}
+
+static void advance(uint32_t *counter, uint32_t value, uint32_t *waiting) {
+    store(counter, value);
+    if (load(waiting)) futex_wake(counter);
+}
+
+int shm_client_open(ShmClient *c) {
+    const char *transport = getenv("DOCINDEX_TRANSPORT");
+    if (transport && strcmp(transport, "fifo") == 0) return -1;
+
+    int fd = shm_open(SHM_NAME, O_RDWR, 0);
+    if (fd == -1) return -1;
+    struct stat st;
+    ShmSegment *seg = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(ShmSegment)) {
+        seg = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (seg == MAP_FAILED) return -1;
+    if (seg->magic != SHM_MAGIC || process_gone(seg->server_pid)) {
+        munmap(seg, sizeof(ShmSegment));
+        return -1;
+    }
+
+    pid_t self = getpid();
+    for (int i = 0; i < SHM_SLOTS; i++) {
+        ShmSlot *s = &seg->slots[i];
+        pid_t owner = __atomic_load_n(&s->owner, __ATOMIC_SEQ_CST);
+        if (owner != 0) {
+            // Taken over only once the server is done with the dead client
+            if (!process_gone(owner) || load(&s->req_head) != load(&s->req_tail) || load(&s->serving)) continue;
+        }
+        if (!__atomic_compare_exchange_n(&s->owner, &owner, self, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) continue;
+
+        s->write_pos = s->read_pos = 0;
+        s->writer_waiting = s->reader_waiting = 0;
+        c->segment = seg;
+        c->slot = s;
+        return 0;
+    }
+    munmap(seg, sizeof(ShmSegment));
+    return -1;
+}
+
+// One request in flight per slot: the client sends the next one only after
+// the END frame of the previous
+int shm_client_send(ShmClient *c, const Message *msg) {
+    ShmSlot *s = c->slot;
+    uint32_t tail = s->req_tail;
+    if (load(&s->req_head) != tail) return -1;
+    s->request = *msg;
+    store(&s->req_tail, tail + 1);
+    __atomic_add_fetch(&c->segment->doorbell, 1, __ATOMIC_SEQ_CST);
+    if (load(&c->segment->server_waiting)) futex_wake(&c->segment->doorbell);
+    return 0;
+}
+
+size_t shm_client_peek(ShmClient *c, const char **data, size_t max) {
+    ShmSlot *s = c->slot;
+    uint32_t r = s->read_pos;
+    uint32_t w;
+    while ((w = load(&s->write_pos)) == r) {
+        if (process_gone(c->segment->server_pid)) return 0;
+        wait_for_change(&s->write_pos, r, &s->reader_waiting, WAIT_MS);
+    }
+
+    size_t offset = r % SHM_RING;
+    size_t n = w - r;
+    if (n > SHM_RING - offset) n = SHM_RING - offset;
+    if (n > max) n = max;
+    *data = s->data + offset;
+    return n;
+}
+
+void shm_client_consume(ShmClient *c, size_t len) {
+    ShmSlot *s = c->slot;
+    advance(&s->read_pos, s->read_pos + len, &s->writer_waiting);
+}
+
+int shm_client_read(ShmClient *c, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        const char *data;
+        size_t n = shm_client_peek(c, &data, len);
+        if (n == 0) return -1;
+        memcpy(p, data, n);
+        shm_client_consume(c, n);
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void shm_client_close(ShmClient *c) {
+    ShmSlot *s = c->slot;
+    // The server marks the request answered just after writing its END frame
+    uint32_t serving;
+    while ((serving = load(&s->serving)) != 0 && !process_gone(c->segment->server_pid)) {
+        wait_for_change(&s->serving, serving, &s->reader_waiting, WAIT_MS);
+    }
+    s->write_pos = s->read_pos = 0;
+    __atomic_store_n(&s->owner, 0, __ATOMIC_SEQ_CST);
+    munmap(c->segment, sizeof(ShmSegment));
+    c->segment = NULL;
+    c->slot = NULL;
+}
+
+// Collects the requests of every slot whenever the doorbell rings
+static void *shm_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        uint32_t bell = load(&segment->doorbell);
+        for (int i = 0; i < SHM_SLOTS; i++) {
+            ShmSlot *s = &segment->slots[i];
+            uint32_t head = s->req_head;
+            if (load(&s->req_tail) == head) continue;
+
+            Message msg = s->request;
+            __atomic_add_fetch(&s->serving, 1, __ATOMIC_SEQ_CST);
+            store(&s->req_head, head + 1);
+
+            msg.client_fifo[sizeof(msg.client_fifo) - 1] = '\0';
+            msg.args[sizeof(msg.args) - 1] = '\0';
+            msg.session = 0;
+            msg.shm_slot = i + 1;
+            deliver_request(&msg);
+        }
+        wait_for_change(&segment->doorbell, bell, &segment->server_waiting, -1);
+    }
+    return NULL;
+}
+
+int shm_server_start(void (*deliver)(const Message *msg)) {
+    shm_unlink(SHM_NAME);
+    int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) return -1;
+    if (ftruncate(fd, sizeof(ShmSegment)) == -1) {
+        close(fd);
+        shm_unlink(SHM_NAME);
+        return -1;
+    }
+    segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        segment = NULL;
+        shm_unlink(SHM_NAME);
+        return -1;
+    }
+
+    deliver_request = deliver;
+    segment->server_pid = getpid();
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, shm_thread, NULL) != 0) {
+        shm_server_stop();
+        return -1;
+    }
+    pthread_detach(thread);
+    // Published last: clients ignore the segment until it is complete
+    store(&segment->magic, SHM_MAGIC);
+    return 0;
+}
+
+int shm_server_write(int slot, const void *data, size_t len) {
+    ShmSlot *s = &segment->slots[slot];
+    const char *p = data;
+    uint32_t w = s->write_pos;
+    while (len > 0) {
+        // Both positions live in memory the client can write: a ring that
+        // claims to hold more than it can drops the client
+        uint32_t r = load(&s->read_pos);
+        if (w - r > SHM_RING) return -1;
+        size_t space = SHM_RING - (w - r);
+        if (space == 0) {
+            pid_t owner = __atomic_load_n(&s->owner, __ATOMIC_SEQ_CST);
+            if (owner == 0 || process_gone(owner)) return -1;
+            wait_for_change(&s->read_pos, r, &s->writer_waiting, WAIT_MS);
+            continue;
+        }
+
+        size_t n = len < space ? len : space;
+        size_t offset = w % SHM_RING;
+        size_t first = n < SHM_RING - offset ? n : SHM_RING - offset;
+        memcpy(s->data + offset, p, first);
+        memcpy(s->data, p + first, n - first);
+        w += n;
+        p += n;
+        len -= n;
+        advance(&s->write_pos, w, &s->reader_waiting);
+    }
+    return 0;
+}
+
+void shm_server_done(int slot) {
+    ShmSlot *s = &segment->slots[slot];
+    // The client waits for this on the same flag it reads the ring with
+    if (__atomic_sub_fetch(&s->serving, 1, __ATOMIC_SEQ_CST) == 0 && load(&s->reader_waiting)) {
+        futex_wake(&s->serving);
+    }
+}
+
+void shm_server_stop() {
+    if (!segment) return;
+    shm_unlink(SHM_NAME);
+}
@@ -0,0 +1,115 @@
+#include "common.h"
+#include "stats.h"
+
+#define STATS_COMMANDS (CMD_STATUS + 1)
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+#define LINEAR_MAX (2 * SUB_COUNT)      // values below this get their own bucket
+#define BUCKETS (LINEAR_MAX + (40 - SUB_BITS - 1) * SUB_COUNT)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t buckets[BUCKETS];
+} Histogram;
+
+static Histogram histograms[STATS_COMMANDS];
+static uint64_t counters[STAT_COUNTERS];
+static uint64_t started_us = 0;
+
+static const char *command_names[STATS_COMMANDS] = {
+    "add", "query", "remove", "lines", "search", "shutdown", "batch", "session", "stats", "status"
+};
+
+void stats_init() {
+    started_us = stats_now_us();
+}
+
+uint64_t stats_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void stats_count(StatCounter counter, uint64_t n) {
+    __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_get(StatCounter counter) {
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+static int bucket_of(uint64_t v) {
+    if (v < LINEAR_MAX) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int b = LINEAR_MAX + (msb - SUB_BITS - 1) * SUB_COUNT + (int)((v >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+// Largest value that falls into bucket b
+static uint64_t bucket_limit(int b) {
+    if (b < LINEAR_MAX) return b;
+    int msb = (b - LINEAR_MAX) / SUB_COUNT + SUB_BITS + 1;
+    uint64_t sub = (b - LINEAR_MAX) % SUB_COUNT;
+    return ((SUB_COUNT + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+void stats_record(CommandType command, uint64_t usec) {
+    if ((unsigned)command >= STATS_COMMANDS) return;
+    Histogram *h = &histograms[command];
+    __atomic_fetch_add(&h->buckets[bucket_of(usec)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_us, usec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    while (usec > max && !__atomic_compare_exchange_n(&h->max_us, &max, usec, 1,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+// Percentiles of a copy of the buckets: the live ones keep moving while we
+// read, so the total is summed from the copy rather than taken from count
+static void percentiles(const Histogram *h, uint64_t max, uint64_t out[3]) {
+    static const double points[3] = { 0.50, 0.95, 0.99 };
+    uint64_t copy[BUCKETS], total = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        copy[b] = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        total += copy[b];
+    }
+
+    int b = 0;
+    uint64_t seen = 0;
+    for (int p = 0; p < 3; p++) {
+        uint64_t rank = (uint64_t)(points[p] * total + 0.999999);
+        if (rank == 0) rank = 1;
+        while (b < BUCKETS - 1 && seen + copy[b] < rank) seen += copy[b++];
+        uint64_t limit = bucket_limit(b);
+        out[p] = total == 0 ? 0 : limit < max ? limit : max;
+    }
+}
+
+// Uptime, one line per command with its latency percentiles in
+// milliseconds, then the counters. Returns the length written.
+int stats_format(char *buf, size_t size) {
+    int len = snprintf(buf, size, "Uptime: %.1f s (latencies in ms)\n%-9s %9s %10s %10s %10s %10s %10s\n",
+                       (stats_now_us() - started_us) / 1e6,
+                       "Command", "Count", "Mean", "p50", "p95", "p99", "Max");
+    for (int c = 0; c < STATS_COMMANDS && len < (int)size; c++) {
+        const Histogram *h = &histograms[c];
+        uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        uint64_t total = __atomic_load_n(&h->total_us, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+        uint64_t p[3];
+        percentiles(h, max, p);
+        len += snprintf(buf + len, size - len, "%-9s %9lu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                        command_names[c], (unsigned long)count,
+                        count ? total / 1e3 / count : 0.0,
+                        p[0] / 1e3, p[1] / 1e3, p[2] / 1e3, max / 1e3);
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, "Bytes scanned: %lu\nForks spawned: %lu",
+                        (unsigned long)stats_get(STAT_BYTES_SCANNED),
+                        (unsigned long)stats_get(STAT_FORKS));
+    }
+    return len < (int)size ? len : (int)size - 1;
+}
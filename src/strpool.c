@@ -0,0 +1,148 @@
+#include "common.h"
+#include "strpool.h"
+
+// A handle is chunk << CHUNK_BITS | offset of the entry in that chunk.
+// Entries are a header followed by the string and its NUL, padded to 8.
+#define CHUNK_BITS 20
+#define CHUNK_SIZE (1u << CHUNK_BITS)
+#define MAX_CHUNKS (1u << (32 - CHUNK_BITS))
+#define ENTRY_SIZE(len) (sizeof(Entry) + (((len) + 1 + 7) & ~(size_t)7))
+#define CLASSES (ENTRY_SIZE(STRPOOL_MAX_LEN) / 8 + 1)
+
+typedef struct {
+    uint32_t refs;
+    uint32_t next;      // next entry in the hash chain, or in the free list
+    char text[];
+} Entry;
+
+static char **chunks = NULL;
+static uint32_t chunk_count = 0, chunk_cap = 0;
+static uint32_t chunk_used = CHUNK_SIZE;    // bytes used in the last chunk
+
+static uint32_t *buckets = NULL;            // chain heads, 0 = empty
+static uint32_t bucket_count = 0;
+static uint32_t string_count = 0;
+static size_t string_bytes = 0;
+
+static uint32_t free_lists[CLASSES];        // released entries by size / 8
+static long reused = 0;
+
+static Entry *entry_at(uint32_t handle) {
+    return (Entry *)(chunks[handle >> CHUNK_BITS] + (handle & (CHUNK_SIZE - 1)));
+}
+
+static unsigned int hash_string(const char *s, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int buckets_grow() {
+    uint32_t new_count = bucket_count ? bucket_count * 2 : 4096;
+    uint32_t *new_buckets = calloc(new_count, sizeof(uint32_t));
+    if (!new_buckets) return -1;
+
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        uint32_t h = buckets[b];
+        while (h) {
+            Entry *e = entry_at(h);
+            uint32_t next = e->next;
+            uint32_t nb = hash_string(e->text, strlen(e->text)) & (new_count - 1);
+            e->next = new_buckets[nb];
+            new_buckets[nb] = h;
+            h = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+// Room for an entry of size bytes: a released one of the same class, or
+// the end of the last chunk
+static uint32_t entry_alloc(size_t size) {
+    uint32_t *list = &free_lists[size / 8];
+    if (*list) {
+        uint32_t h = *list;
+        *list = entry_at(h)->next;
+        reused++;
+        return h;
+    }
+
+    if (chunk_used + size > CHUNK_SIZE) {
+        if (chunk_count == MAX_CHUNKS) return 0;
+        if (chunk_count == chunk_cap) {
+            uint32_t new_cap = chunk_cap ? chunk_cap * 2 : 16;
+            char **grown = realloc(chunks, new_cap * sizeof(char *));
+            if (!grown) return 0;
+            chunks = grown;
+            chunk_cap = new_cap;
+        }
+        chunks[chunk_count] = malloc(CHUNK_SIZE);
+        if (!chunks[chunk_count]) return 0;
+        chunk_count++;
+        // Offset 0 of the first chunk would be handle 0
+        chunk_used = chunk_count == 1 ? 8 : 0;
+    }
+    uint32_t h = (chunk_count - 1) << CHUNK_BITS | chunk_used;
+    chunk_used += size;
+    return h;
+}
+
+// Handle of s (len bytes, no NUL needed) with one more reference, or 0
+uint32_t strpool_intern(const char *s, size_t len) {
+    if (len > STRPOOL_MAX_LEN) return 0;
+    // A failed grow only leaves the chains longer
+    if (string_count >= bucket_count && buckets_grow() == -1 && bucket_count == 0) return 0;
+
+    uint32_t *head = &buckets[hash_string(s, len) & (bucket_count - 1)];
+    for (uint32_t h = *head; h; h = entry_at(h)->next) {
+        Entry *e = entry_at(h);
+        if (strncmp(e->text, s, len) == 0 && e->text[len] == '\0') {
+            e->refs++;
+            return h;
+        }
+    }
+
+    uint32_t h = entry_alloc(ENTRY_SIZE(len));
+    if (!h) return 0;
+    Entry *e = entry_at(h);
+    e->refs = 1;
+    memcpy(e->text, s, len);
+    e->text[len] = '\0';
+    e->next = *head;
+    *head = h;
+    string_count++;
+    string_bytes += len + 1;
+    return h;
+}
+
+void strpool_release(uint32_t handle) {
+    if (!handle) return;
+    Entry *e = entry_at(handle);
+    if (--e->refs > 0) return;
+
+    size_t len = strlen(e->text);
+    uint32_t *link = &buckets[hash_string(e->text, len) & (bucket_count - 1)];
+    while (*link != handle) link = &entry_at(*link)->next;
+    *link = e->next;
+
+    uint32_t *list = &free_lists[ENTRY_SIZE(len) / 8];
+    e->next = *list;
+    *list = handle;
+    string_count--;
+    string_bytes -= len + 1;
+}
+
+const char *strpool_get(uint32_t handle) {
+    return entry_at(handle)->text;
+}
+
+void strpool_print_stats(FILE *out) {
+    fprintf(out, "[STRPOOL] Stats → Strings: %u, Bytes: %zu, Chunks: %u (%u KB), Reused: %ld\n",
+            string_count, string_bytes, chunk_count, chunk_count * (CHUNK_SIZE >> 10), reused);
+}
@@ -0,0 +1,284 @@
+#include "common.h"
+#include "workers.h"
+#include "scan.h"
+#include "doccache.h"
+#include "stats.h"
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct {
+    pid_t pid;
+    int to_worker;      // requests: keyword + (id, path) items
+    int from_worker;    // replies: matching ids
+} Worker;
+
+static Worker *pool = NULL;
+static int pool_size = 0;
+
+// Concurrent searches check workers out of the pool; a worker serves one
+// search at a time
+static int *busy = NULL;
+static int idle_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+extern int debug_mode;
+
+// Request: uint32 keyword_len, uint32 item_count, keyword bytes, then per
+// item int32 id, uint16 path_len, path bytes.
+// Reply: uint32 match_count, uint64 bytes scanned, then int32 ids in
+// request order. The worker's own counters are not visible to the server,
+// so the bytes it scans travel back with each reply.
+static void worker_exit() {
+    // Each worker keeps its own document cache; stderr is unbuffered, so
+    // nothing inherited from the server's stdout is printed twice
+    if (debug_mode) {
+        char scope[32];
+        snprintf(scope, sizeof(scope), "Worker %d", getpid());
+        doccache_print_stats(stderr, scope);
+    }
+    _exit(0);
+}
+
+static void worker_main(int in, int out) {
+    for (;;) {
+        uint32_t header[2];
+        if (read_all(in, header, sizeof(header)) == -1) worker_exit();
+
+        char *keyword = malloc(header[0] + 1);
+        int32_t *ids = malloc((header[1] ? header[1] : 1) * sizeof(int32_t));
+        char **paths = calloc(header[1] ? header[1] : 1, sizeof(char *));
+        if (!keyword || !ids || !paths) _exit(1);
+        if (read_all(in, keyword, header[0]) == -1) _exit(0);
+        keyword[header[0]] = '\0';
+
+        // Drain the whole request first so the server is never blocked
+        // writing to us while we scan
+        for (uint32_t i = 0; i < header[1]; i++) {
+            uint16_t len;
+            if (read_all(in, &ids[i], sizeof(int32_t)) == -1 ||
+                read_all(in, &len, sizeof(len)) == -1) _exit(0);
+            paths[i] = malloc(len + 1);
+            if (!paths[i] || read_all(in, paths[i], len) == -1) _exit(0);
+            paths[i][len] = '\0';
+        }
+
+        uint32_t found = 0;
+        uint64_t scanned = stats_get(STAT_BYTES_SCANNED);
+        for (uint32_t i = 0; i < header[1]; i++) {
+            if (scan_file_contains(paths[i], keyword) == 1) ids[found++] = ids[i];
+            free(paths[i]);
+        }
+
+        scanned = stats_get(STAT_BYTES_SCANNED) - scanned;
+
+        if (write_all(out, &found, sizeof(found)) == -1 ||
+            write_all(out, &scanned, sizeof(scanned)) == -1 ||
+            write_all(out, ids, found * sizeof(int32_t)) == -1) _exit(0);
+
+        free(keyword);
+        free(ids);
+        free(paths);
+    }
+}
+
+static int worker_spawn(int i) {
+    int request[2], reply[2];
+    if (pipe(request) == -1) return -1;
+    if (pipe(reply) == -1) {
+        close(request[0]);
+        close(request[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(request[0]); close(request[1]);
+        close(reply[0]); close(reply[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Keep only our own pipe ends: the server FIFO, other workers'
+        // pipes and any open client FIFO must not be held open by us
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        if (max_fd < 0 || max_fd > 4096) max_fd = 4096;
+        for (int fd = 3; fd < max_fd; fd++) {
+            if (fd != request[0] && fd != reply[1]) close(fd);
+        }
+        worker_main(request[0], reply[1]);
+        _exit(0);
+    }
+
+    stats_count(STAT_FORKS, 1);
+    close(request[0]);
+    close(reply[1]);
+    pool[i].pid = pid;
+    pool[i].to_worker = request[1];
+    pool[i].from_worker = reply[0];
+    return 0;
+}
+
+static void worker_reap(int i) {
+    if (pool[i].pid <= 0) return;
+    close(pool[i].to_worker);
+    close(pool[i].from_worker);
+    waitpid(pool[i].pid, NULL, 0);
+    pool[i].pid = -1;
+}
+
+static int worker_respawn(int i) {
+    if (debug_mode) fprintf(stderr, "[WORKERS] Worker %d (pid %d) terminou, a reiniciar\n", i, pool[i].pid);
+    worker_reap(i);
+    return worker_spawn(i);
+}
+
+int workers_start(int count) {
+    // A worker that dies mid-request must not kill the server with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    pool = calloc(count > 0 ? count : 1, sizeof(Worker));
+    busy = calloc(count > 0 ? count : 1, sizeof(int));
+    if (!pool || !busy) return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (worker_spawn(i) == -1) {
+            pool_size = idle_count = i;
+            return -1;
+        }
+    }
+    pool_size = idle_count = count;
+    return 0;
+}
+
+void workers_stop() {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < pool_size; i++) worker_reap(i);
+    free(pool);
+    free(busy);
+    pool = NULL;
+    busy = NULL;
+    pool_size = idle_count = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int workers_count() {
+    return pool_size;
+}
+
+static int send_batch(int w, const char *keyword, const SearchItem *items, int n) {
+    size_t size = 2 * sizeof(uint32_t) + strlen(keyword);
+    for (int i = 0; i < n; i++) size += sizeof(int32_t) + sizeof(uint16_t) + strlen(items[i].fullpath);
+
+    char *buf = malloc(size);
+    if (!buf) return -1;
+
+    char *p = buf;
+    uint32_t header[2] = { strlen(keyword), n };
+    memcpy(p, header, sizeof(header)); p += sizeof(header);
+    memcpy(p, keyword, header[0]); p += header[0];
+    for (int i = 0; i < n; i++) {
+        int32_t id = items[i].id;
+        uint16_t len = strlen(items[i].fullpath);
+        memcpy(p, &id, sizeof(id)); p += sizeof(id);
+        memcpy(p, &len, sizeof(len)); p += sizeof(len);
+        memcpy(p, items[i].fullpath, len); p += len;
+    }
+
+    int rc = write_all(pool[w].to_worker, buf, size);
+    free(buf);
+    return rc;
+}
+
+static int receive_batch(int w, int *ids, int *found) {
+    uint32_t count;
+    uint64_t scanned;
+    if (read_all(pool[w].from_worker, &count, sizeof(count)) == -1 ||
+        read_all(pool[w].from_worker, &scanned, sizeof(scanned)) == -1) return -1;
+    stats_count(STAT_BYTES_SCANNED, scanned);
+    if (read_all(pool[w].from_worker, ids, count * sizeof(int32_t)) == -1) return -1;
+    *found = count;
+    return 0;
+}
+
+static int scan_inline(const char *keyword, const SearchItem *items, int n, int *ids) {
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        if (scan_file_contains(items[i].fullpath, keyword) == 1) ids[found++] = items[i].id;
+    }
+    return found;
+}
+
+// Splits items into contiguous batches, one per worker. Matching ids are
+// handed to emit batch by batch in item order, as soon as each batch and
+// all batches before it are done.
+int workers_search(const char *keyword, const SearchItem *items, int n, int batches,
+                   workers_emit_fn emit, void *ctx) {
+    if (n == 0) return 0;
+    int *ids = malloc(n * sizeof(int));
+    if (!ids) return -1;
+
+    if (pool_size == 0) {
+        emit(ids, scan_inline(keyword, items, n, ids), ctx);
+        free(ids);
+        return 0;
+    }
+
+    if (batches < 1) batches = 1;
+    if (batches > pool_size) batches = pool_size;
+    if (batches > n) batches = n;
+
+    // Take up to `batches` idle workers, waiting only if none is free
+    int mine[batches];
+    pthread_mutex_lock(&pool_lock);
+    while (idle_count == 0) pthread_cond_wait(&pool_idle, &pool_lock);
+    int taken = 0;
+    for (int i = 0; i < pool_size && taken < batches; i++) {
+        if (!busy[i]) {
+            busy[i] = 1;
+            mine[taken++] = i;
+        }
+    }
+    idle_count -= taken;
+    pthread_mutex_unlock(&pool_lock);
+    batches = taken;
+
+    int start[batches], size[batches], sent[batches];
+    for (int b = 0, offset = 0; b < batches; b++) {
+        int w = mine[b];
+        start[b] = offset;
+        size[b] = n / batches + (b < n % batches ? 1 : 0);
+        offset += size[b];
+
+        sent[b] = send_batch(w, keyword, &items[start[b]], size[b]) == 0;
+        if (!sent[b] && worker_respawn(w) == 0) {
+            sent[b] = send_batch(w, keyword, &items[start[b]], size[b]) == 0;
+        }
+    }
+
+    // Batches are contiguous and gathered in order, so ids stay in item order
+    for (int b = 0; b < batches; b++) {
+        int w = mine[b];
+        int found = 0;
+        int *out = ids + start[b];
+
+        if (!(sent[b] && receive_batch(w, out, &found) == 0)) {
+            // The worker died: replace it and retry the batch once, then give
+            // up on the pool for this batch and scan it here
+            if (!(worker_respawn(w) == 0 &&
+                  send_batch(w, keyword, &items[start[b]], size[b]) == 0 &&
+                  receive_batch(w, out, &found) == 0)) {
+                found = scan_inline(keyword, &items[start[b]], size[b], out);
+            }
+        }
+        emit(out, found, ctx);
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    for (int b = 0; b < batches; b++) busy[mine[b]] = 0;
+    idle_count += batches;
+    pthread_cond_broadcast(&pool_idle);
+    pthread_mutex_unlock(&pool_lock);
+    free(ids);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+// Assertions for the unit tests: a failed check prints its location and
+// the program goes on, then exits non-zero from check_report()
+
+static int check_failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            fprintf(stderr, "%s:%d: falhou: %s\n", __FILE__, __LINE__, #cond);   \
+            check_failures++;                                                    \
+        }                                                                        \
+    } while (0)
+
+static int check_report(const char *name) {
+    printf("%-10s %s\n", name, check_failures ? "FALHOU" : "ok");
+    return check_failures != 0;
+}
+
+#endif
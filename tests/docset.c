@@ -0,0 +1,113 @@
+#include "common.h"
+#include "docset.h"
+#include "check.h"
+#include <limits.h>
+
+// Random inserts and removals against a plain sorted array, in sparse
+// (delta) and dense (bitmap) ranges, checking every operation's result
+
+#define MAX_IDS 20000
+
+static int ref[MAX_IDS];
+static int ref_count;
+
+static int ref_find(int id) {
+    for (int i = 0; i < ref_count; i++) {
+        if (ref[i] == id) return i;
+    }
+    return -1;
+}
+
+static int ref_rank(int id) {
+    int i = 0;
+    while (i < ref_count && ref[i] < id) i++;
+    return i;
+}
+
+static void check_set(const DocSet *s, int span) {
+    static int out[MAX_IDS];
+    int n = docset_decode(s, out);
+    CHECK(n == ref_count && s->count == ref_count);
+    CHECK(n != ref_count || memcmp(out, ref, n * sizeof(int)) == 0);
+    CHECK(ref_count == 0 || s->last == ref[ref_count - 1]);
+
+    DocSetCursor c;
+    int i = 0;
+    for (docset_cursor(&c, s); c.id != INT_MAX && i < ref_count; docset_next(&c), i++) {
+        CHECK(c.id == ref[i] && c.index == i);
+    }
+    CHECK(c.id == INT_MAX && i == ref_count);
+
+    // Seeks only move forward: one cursor through ascending targets
+    docset_cursor(&c, s);
+    for (int id = 1; id < span; id += 1 + rand() % (span / 50 + 1)) {
+        docset_seek(&c, id);
+        int j = ref_rank(id);
+        CHECK(c.id == (j < ref_count ? ref[j] : INT_MAX));
+        CHECK(j == ref_count || c.index == j);
+        CHECK(docset_find(s, id) == ref_find(id));
+    }
+}
+
+static void check_filters(const DocSet *s, int span) {
+    int ids[1000], out[1000], n = 0;
+    for (int id = 1; id < span && n < 1000; id += 1 + rand() % (span / 500 + 1)) ids[n++] = id;
+
+    int want = 0;
+    for (int i = 0; i < n; i++) want += ref_find(ids[i]) != -1;
+    int kept = docset_intersect(s, ids, n, out);
+    CHECK(kept == want);
+    for (int i = 0; i < kept; i++) CHECK(ref_find(out[i]) != -1);
+    int dropped = docset_difference(s, ids, n, out);
+    CHECK(dropped == n - want);
+    for (int i = 0; i < dropped; i++) CHECK(ref_find(out[i]) == -1);
+
+    // out may alias ids
+    CHECK(docset_intersect(s, ids, n, ids) == want);
+}
+
+static void run(int span, int dense) {
+    DocSet s;
+    docset_init(&s);
+    ref_count = 0;
+    if (dense) {
+        for (int id = 2000; id < 4000; id += 1 + rand() % 2) {
+            CHECK(docset_insert(&s, id) == ref_count);
+            ref[ref_count++] = id;
+        }
+        CHECK(s.type == DOCSET_BITMAP);
+    }
+
+    for (int op = 0; op < 6000; op++) {
+        int id = 1 + rand() % span;
+        int at = ref_find(id);
+        if (rand() % 10 < 6 && ref_count < MAX_IDS) {
+            int got = docset_insert(&s, id);
+            if (at != -1) {
+                CHECK(got == -1);
+            } else {
+                int j = ref_rank(id);
+                CHECK(got == j);
+                memmove(&ref[j + 1], &ref[j], (ref_count - j) * sizeof(int));
+                ref[j] = id;
+                ref_count++;
+            }
+        } else {
+            CHECK(docset_remove(&s, id) == at);
+            if (at != -1) {
+                memmove(&ref[at], &ref[at + 1], (ref_count - at - 1) * sizeof(int));
+                ref_count--;
+            }
+        }
+        if (op % 1000 == 0) check_set(&s, span);
+    }
+    check_set(&s, span);
+    check_filters(&s, span);
+    docset_free(&s);
+}
+
+int main() {
+    srand(1);
+    for (int round = 0; round < 8; round++) run(round % 2 ? 5000 : 300000, round % 4 == 1);
+    return check_report("docset");
+}
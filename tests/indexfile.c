@@ -0,0 +1,97 @@
+#include "common.h"
+#include "indexfile.h"
+#include "check.h"
+#include <stddef.h>
+
+// Binary index round trip, then one damaged copy per header or record
+// field that indexfile_open() validates: each must be refused
+
+#define INDEXFILE_TEST_FILE "tmp/test_index.bin"
+
+static DocumentMeta table[] = {
+    { 1, "Romeo and Juliet", "William Shakespeare", "1597", "romeo.txt" },
+    { 0, NULL, NULL, NULL, NULL },      // removed slot
+    { 3, "Hamlet", "William Shakespeare", "1603", "hamlet.txt" },
+    { 7, "Hamlet", "Anonymous", "2001", "hamlet_copy.txt" },
+};
+
+static DocumentMeta *get(int i, DocumentMeta *out) {
+    if (!table[i].id) return NULL;
+    *out = table[i];
+    return out;
+}
+
+static char *image;
+static size_t image_size;
+
+static int load_image() {
+    FILE *fp = fopen(INDEXFILE_TEST_FILE, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    image_size = ftell(fp);
+    rewind(fp);
+    image = malloc(image_size);
+    int ok = image && fread(image, 1, image_size, fp) == image_size;
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+// Writes the image with len bytes at offset replaced by bytes, truncated
+// to size, and tries to open it
+static int open_damaged(size_t offset, const void *bytes, size_t len, size_t size) {
+    char *copy = malloc(image_size);
+    if (!copy) return -1;
+    memcpy(copy, image, image_size);
+    memcpy(copy + offset, bytes, len);
+    FILE *fp = fopen(INDEXFILE_TEST_FILE, "wb");
+    if (fp) {
+        fwrite(copy, 1, size, fp);
+        fclose(fp);
+    }
+    free(copy);
+
+    IndexFile file;
+    int rc = indexfile_open(INDEXFILE_TEST_FILE, &file);
+    if (rc == 0) indexfile_close(&file);
+    return rc;
+}
+
+static size_t record_field(int i, size_t field) {
+    return sizeof(IndexFileHeader) + i * sizeof(IndexRecord) + field;
+}
+
+int main() {
+    CHECK(indexfile_write(INDEXFILE_TEST_FILE, get, 4, 8) == 0);
+
+    IndexFile file;
+    CHECK(indexfile_open(INDEXFILE_TEST_FILE, &file) == 0);
+    CHECK(file.header->record_count == 3 && file.header->next_id == 8);
+    const IndexRecord *r = file.records;
+    CHECK(r[0].id == 1 && strcmp(file.heap + r[0].title, "Romeo and Juliet") == 0);
+    CHECK(r[1].id == 3 && strcmp(file.heap + r[1].path, "hamlet.txt") == 0);
+    CHECK(r[2].id == 7 && strcmp(r[2].year, "2001") == 0);
+    // Equal strings are stored once
+    CHECK(r[1].title == r[2].title && r[0].authors == r[1].authors);
+    indexfile_close(&file);
+
+    CHECK(load_image() == 0);
+    uint32_t heap_size = ((const IndexFileHeader *)image)->heap_size;
+    uint32_t huge = 0x10000000u, version = INDEXFILE_VERSION + 1;
+    uint32_t shorter = heap_size - 1, beyond = heap_size + 1;
+
+    CHECK(open_damaged(0, "XIDX", 4, image_size) == -1);
+    CHECK(open_damaged(offsetof(IndexFileHeader, version), &version, 4, image_size) == -1);
+    CHECK(open_damaged(offsetof(IndexFileHeader, record_count), &huge, 4, image_size) == -1);
+    CHECK(open_damaged(offsetof(IndexFileHeader, heap_size), &beyond, 4, image_size) == -1);
+    CHECK(open_damaged(offsetof(IndexFileHeader, heap_size), &shorter, 4, image_size) == -1);
+    CHECK(open_damaged(0, "DIDX", 4, image_size - 1) == -1);
+    CHECK(open_damaged(0, "DIDX", 4, sizeof(IndexFileHeader) - 1) == -1);
+    CHECK(open_damaged(record_field(2, offsetof(IndexRecord, path)), &heap_size, 4, image_size) == -1);
+    CHECK(open_damaged(record_field(1, offsetof(IndexRecord, year) + 7), "x", 1, image_size) == -1);
+    // The undamaged image still opens
+    CHECK(open_damaged(0, "DIDX", 4, image_size) == 0);
+
+    free(image);
+    unlink(INDEXFILE_TEST_FILE);
+    return check_report("indexfile");
+}
@@ -0,0 +1,225 @@
+#include "common.h"
+#include "postings.h"
+#include "check.h"
+#include <math.h>
+
+// A random corpus written to tmp/, indexed through postings_add_document()
+// and checked against the same documents held here as word lists:
+// substring search, WAND top-k against brute-force BM25, the AND filters,
+// duplicate contents fanned out to every ID, removals and a save/load
+// round trip
+
+#define DOCS 300
+#define VOCABULARY 400
+#define MAX_WORDS 120
+#define DUPLICATES 20
+
+static char vocabulary[VOCABULARY][12];
+static int doc_words[DOCS + DUPLICATES + 1][MAX_WORDS];
+static int doc_length[DOCS + DUPLICATES + 1];
+static int live[DOCS + DUPLICATES + 1];
+static int doc_count;
+
+// Word i spells i + 14 in base 14, one syllable per digit: all distinct
+static void make_vocabulary() {
+    static const char *syllables[] = { "ba", "be", "ca", "co", "da", "di", "fa", "lo", "ma", "ne", "ri", "su", "ta", "vo" };
+    for (int i = 0; i < VOCABULARY; i++) {
+        char reversed[12] = "";
+        for (int value = i + 14; value; value /= 14) strcat(reversed, syllables[value % 14]);
+        int len = strlen(reversed);
+        for (int j = 0; j < len; j += 2) memcpy(vocabulary[i] + j, reversed + len - j - 2, 2);
+        vocabulary[i][len] = '\0';
+    }
+}
+
+static void path_of(int id, char *path, size_t size) {
+    snprintf(path, size, "tmp/test_postings_%d.txt", id);
+}
+
+// Skewed word choice so some terms are in most documents (bitmaps) and
+// others in a few
+static void write_document(int id, int copy_of) {
+    if (copy_of) {
+        memcpy(doc_words[id], doc_words[copy_of], sizeof(doc_words[0]));
+        doc_length[id] = doc_length[copy_of];
+    } else {
+        doc_length[id] = 1 + rand() % MAX_WORDS;
+        for (int i = 0; i < doc_length[id]; i++) {
+            int r = rand() % VOCABULARY;
+            doc_words[id][i] = rand() % 2 ? r % 20 : r;
+        }
+    }
+
+    char path[64];
+    path_of(id, path, sizeof(path));
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    for (int i = 0; i < doc_length[id]; i++) {
+        fprintf(fp, "%s%s", vocabulary[doc_words[id][i]], i % 9 == 8 ? ".\n" : ", ");
+    }
+    fclose(fp);
+    live[id] = 1;
+}
+
+static int contains_keyword(int id, const char *keyword) {
+    for (int i = 0; i < doc_length[id]; i++) {
+        if (strstr(vocabulary[doc_words[id][i]], keyword)) return 1;
+    }
+    return 0;
+}
+
+static void check_search(const char *keyword) {
+    int *ids, count;
+    CHECK(postings_search(keyword, &ids, &count) == 0);
+    int want = 0, match = 1;
+    for (int id = 1; id <= doc_count; id++) {
+        if (!live[id] || !contains_keyword(id, keyword)) continue;
+        if (want >= count || ids[want] != id) match = 0;
+        want++;
+    }
+    if (!match || count != want) fprintf(stderr, "search '%s': %d ids, %d expected\n", keyword, count, want);
+    CHECK(match && count == want);
+
+    // The AND filter agrees with the list, on twins as well
+    long cost;
+    PostingsMatch *m = postings_match_open(keyword, &cost);
+    CHECK(m != NULL);
+    if (m) {
+        int all[DOCS + DUPLICATES], n = 0;
+        for (int id = 1; id <= doc_count; id++) {
+            if (live[id]) all[n++] = id;
+        }
+        int kept = postings_match_filter(m, all, n, 1);
+        CHECK(kept == count && (count == 0 || memcmp(all, ids, count * sizeof(int)) == 0));
+        postings_match_close(m);
+    }
+    free(ids);
+}
+
+static const char *keywords[] = { "b", "ba", "ta", "bab", "sub", "lobe", "cobe", "ribasu", "zz", "davo" };
+
+static void check_searches() {
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) check_search(keywords[i]);
+    for (int i = 0; i < VOCABULARY; i += 37) check_search(vocabulary[i]);
+}
+
+// Score of every live document for the words of a keyword, as BM25 with
+// the parameters postings_rank() uses
+static void brute_force_rank(const char **words, int word_count, double *scores) {
+    int total = 0, n = 0;
+    for (int id = 1; id <= doc_count; id++) {
+        scores[id] = 0;
+        if (!live[id]) continue;
+        total += doc_length[id];
+        n++;
+    }
+    double avg = (double)total / n;
+    for (int t = 0; t < VOCABULARY; t++) {
+        int matches = 0;
+        for (int w = 0; w < word_count; w++) matches |= strstr(vocabulary[t], words[w]) != NULL;
+        if (!matches) continue;
+
+        int df = 0;
+        for (int id = 1; id <= doc_count; id++) {
+            int freq = 0;
+            for (int i = 0; i < doc_length[id]; i++) freq += doc_words[id][i] == t;
+            df += live[id] && freq > 0;
+        }
+        double idf = log(1 + (n - df + 0.5) / (df + 0.5));
+        for (int id = 1; id <= doc_count; id++) {
+            if (!live[id]) continue;
+            int freq = 0;
+            for (int i = 0; i < doc_length[id]; i++) freq += doc_words[id][i] == t;
+            if (freq) scores[id] += idf * freq * 2.2 / (freq + 1.2 * (0.25 + 0.75 * doc_length[id] / avg));
+        }
+    }
+}
+
+static int compare_desc(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x < y) - (x > y);
+}
+
+static void check_rank(const char *keyword, const char **words, int word_count, int k) {
+    static double scores[DOCS + 1], sorted[DOCS + 1];
+    PostingsHit hits[DOCS];
+    brute_force_rank(words, word_count, scores);
+    int found = postings_rank(keyword, k, hits);
+
+    int n = 0;
+    for (int id = 1; id <= doc_count; id++) {
+        if (live[id] && scores[id] > 0) sorted[n++] = scores[id];
+    }
+    qsort(sorted, n, sizeof(double), compare_desc);
+    CHECK(found == (n < k ? n : k));
+    for (int i = 0; i < found && i < n; i++) {
+        CHECK(fabs(hits[i].score - sorted[i]) < 1e-9 * sorted[i]);
+        CHECK(fabs(hits[i].score - scores[hits[i].id]) < 1e-9 * sorted[i]);
+    }
+}
+
+int main() {
+    srand(7);
+    make_vocabulary();
+    for (int id = 1; id <= DOCS; id++) {
+        write_document(id, 0);
+        char path[64];
+        path_of(id, path, sizeof(path));
+        CHECK(postings_add_document(id, path) == 0);
+    }
+    doc_count = DOCS;
+
+    check_searches();
+    const char *one[] = { "ba" }, *two[] = { "sub", "cobe" }, *common[] = { vocabulary[3] };
+    check_rank("ba", one, 1, 10);
+    check_rank("sub cobe", two, 2, 25);
+    check_rank(vocabulary[3], common, 1, 5);
+    check_rank("ba", one, 1, DOCS);
+
+    // Copies of existing documents
+    for (int i = 0; i < DUPLICATES; i++) {
+        int id = DOCS + 1 + i;
+        write_document(id, 1 + i * 7);
+        char path[64];
+        path_of(id, path, sizeof(path));
+        CHECK(postings_add_document(id, path) == 0);
+    }
+    doc_count = DOCS + DUPLICATES;
+    CHECK(postings_twin_count() == DUPLICATES);
+    CHECK(postings_is_twin(DOCS + 1) && !postings_is_twin(1));
+    check_searches();
+
+    // Removing an original hands its postings to the copy
+    for (int i = 0; i < DUPLICATES; i += 2) {
+        postings_remove_document(1 + i * 7);
+        live[1 + i * 7] = 0;
+    }
+    for (int id = 2; id <= DOCS; id += 11) {
+        postings_remove_document(id);
+        live[id] = 0;
+    }
+    CHECK(!postings_is_twin(DOCS + 1));
+    check_searches();
+
+    CHECK(postings_save("tmp/test_postings.txt", 0, doc_count + 1) == 1);
+    postings_clear();
+    CHECK(postings_load("tmp/test_postings.txt", 0, doc_count + 1) == 1);
+    check_searches();
+
+    // The term lists of each document are rebuilt by the load
+    for (int id = 3; id <= doc_count; id += 5) {
+        if (!live[id]) continue;
+        postings_remove_document(id);
+        live[id] = 0;
+    }
+    check_searches();
+
+    for (int id = 1; id <= DOCS + DUPLICATES; id++) {
+        char path[64];
+        path_of(id, path, sizeof(path));
+        unlink(path);
+    }
+    unlink("tmp/test_postings.txt");
+    postings_clear();
+    return check_report("postings");
+}
@@ -0,0 +1,147 @@
+#include "common.h"
+#include "query.h"
+#include "check.h"
+
+// The parser and evaluator over a fake index of documents 1..DOCS where
+// term "mK" holds the multiples of K. Every query is evaluated with and
+// without term filters and checked against a predicate on the id.
+
+#define DOCS 60
+
+static int listed;          // terms materialized through query_term_fn
+static int filtered;        // filter calls
+
+static int term_divisor(const char *term) {
+    return term[0] == 'm' ? atoi(term + 1) : 0;
+}
+
+static int list_multiples(int k, int **ids, int *count) {
+    *ids = malloc(DOCS * sizeof(int));
+    *count = 0;
+    if (!*ids) return -1;
+    for (int id = 1; id <= DOCS; id++) {
+        if (k > 0 && id % k == 0) (*ids)[(*count)++] = id;
+    }
+    return 0;
+}
+
+static int fake_term(const char *term, void *ctx, int **ids, int *count) {
+    (void)ctx;
+    listed++;
+    return list_multiples(term_divisor(term), ids, count);
+}
+
+// Stands in for positions: both sides in the document
+static int fake_near(const char *left, const char *right, int distance, void *ctx, int **ids, int *count) {
+    (void)ctx;
+    (void)distance;
+    int a = term_divisor(left), b = term_divisor(right);
+    return list_multiples(a && b ? a * b : 0, ids, count);
+}
+
+static int fake_all(void *ctx, int **ids, int *count) {
+    (void)ctx;
+    return list_multiples(1, ids, count);
+}
+
+static int fake_filter_ids(void *state, int *ids, int n, int keep) {
+    int k = (int)(intptr_t)state, w = 0;
+    filtered++;
+    for (int i = 0; i < n; i++) {
+        if ((k > 0 && ids[i] % k == 0) == keep) ids[w++] = ids[i];
+    }
+    return w;
+}
+
+static void fake_filter_close(void *state) {
+    (void)state;
+}
+
+static int fake_filter(const char *term, void *ctx, QueryFilter *f) {
+    (void)ctx;
+    int k = term_divisor(term);
+    f->cost = k > 0 ? DOCS / k : 0;
+    f->state = (void *)(intptr_t)k;
+    f->filter = fake_filter_ids;
+    f->close = fake_filter_close;
+    return 0;
+}
+
+static int m2_and_m3(int id) { return id % 6 == 0; }
+static int m2_not_m3(int id) { return id % 2 == 0 && id % 3 != 0; }
+static int m2_or_m5_not_m3(int id) { return (id % 2 == 0 || id % 5 == 0) && id % 3 != 0; }
+static int not_m7(int id) { return id % 7 != 0; }
+static int nested(int id) { return id % 2 == 0 && (id % 3 == 0 || id % 5 == 0) && id % 14 != 0; }
+static int nothing(int id) { (void)id; return 0; }
+static int near_m3_m5(int id) { return id % 15 == 0; }
+static int rare_first(int id) { return id % 42 == 0; }
+
+static const struct {
+    const char *text;
+    int (*expected)(int id);
+} queries[] = {
+    { "m2 AND m3", m2_and_m3 },
+    { "m2 m3", m2_and_m3 },
+    { "m2 AND NOT m3", m2_not_m3 },
+    { "(m2 OR m5) AND NOT m3", m2_or_m5_not_m3 },
+    { "NOT m7", not_m7 },
+    { "m2 AND (m3 OR m5) AND NOT (m7 AND m2)", nested },
+    { "m2 AND missing", nothing },
+    { "m3 NEAR/2 m5", near_m3_m5 },
+    { "m2 AND m3 AND m7", rare_first },
+};
+
+static void check_query(const char *text, int (*expected)(int), query_filter_fn filter) {
+    int *ids = NULL, count = 0;
+    char error[256];
+    int rc = query_evaluate(text, fake_term, fake_near, fake_all, filter, NULL, &ids, &count, error, sizeof(error));
+    CHECK(rc == 0);
+
+    int want = 0, match = rc == 0;
+    for (int id = 1; id <= DOCS; id++) {
+        if (!expected(id)) continue;
+        if (want >= count || ids[want] != id) match = 0;
+        want++;
+    }
+    if (!match || count != want) fprintf(stderr, "query '%s': %d ids, %d expected\n", text, count, want);
+    CHECK(match && count == want);
+    free(ids);
+}
+
+static void check_error(const char *text, const char *message) {
+    int *ids = NULL, count = 0;
+    char error[256];
+    CHECK(query_evaluate(text, fake_term, fake_near, fake_all, fake_filter, NULL, &ids, &count, error, sizeof(error)) == -1);
+    CHECK(strstr(error, message) != NULL);
+    CHECK(ids == NULL);
+}
+
+int main() {
+    CHECK(query_is_boolean("m2 AND m3"));
+    CHECK(query_is_boolean("(m2)"));
+    CHECK(query_is_boolean("\"m2 m3\""));
+    CHECK(query_is_boolean("m2 NEAR/3 m3"));
+    CHECK(!query_is_boolean("m2 m3"));
+    CHECK(!query_is_boolean("and or not"));
+
+    int n = sizeof(queries) / sizeof(queries[0]);
+    for (int i = 0; i < n; i++) {
+        check_query(queries[i].text, queries[i].expected, NULL);
+        check_query(queries[i].text, queries[i].expected, fake_filter);
+    }
+
+    // Only the rarest term of a conjunction is listed
+    listed = filtered = 0;
+    check_query("m2 AND m3 AND m7", rare_first, fake_filter);
+    CHECK(listed == 1 && filtered == 2);
+    listed = filtered = 0;
+    check_query("m2 AND NOT m3", m2_not_m3, fake_filter);
+    CHECK(listed == 1 && filtered == 1);
+
+    check_error("(m2 AND m3", "Missing ')'");
+    check_error("m2 AND m3)", "Unbalanced ')'");
+    check_error("m2 AND", "Incomplete query");
+    check_error("\"m2 m3", "Missing closing '\"'");
+
+    return check_report("query");
+}
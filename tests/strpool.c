@@ -0,0 +1,55 @@
+#include "common.h"
+#include "strpool.h"
+#include "check.h"
+
+// Interning, reference counting and reuse of released space, across enough
+// strings to grow the hash table and fill more than one chunk
+
+#define STRINGS 20000
+
+static uint32_t handles[STRINGS];
+
+int main() {
+    // Equal strings share a handle; len bounds the string, no NUL needed
+    uint32_t a = strpool_intern("Romeo and Juliet", 16);
+    uint32_t b = strpool_intern("Romeo and Juliet, Act I", 16);
+    CHECK(a != 0 && a == b);
+    CHECK(strcmp(strpool_get(a), "Romeo and Juliet") == 0);
+    uint32_t c = strpool_intern("Romeo", 5);
+    CHECK(c != 0 && c != a && strcmp(strpool_get(c), "Romeo") == 0);
+    uint32_t empty = strpool_intern("", 0);
+    CHECK(empty != 0 && strpool_get(empty)[0] == '\0');
+
+    char too_long[STRPOOL_MAX_LEN + 2];
+    memset(too_long, 'x', sizeof(too_long));
+    CHECK(strpool_intern(too_long, STRPOOL_MAX_LEN + 1) == 0);
+    CHECK(strpool_intern(too_long, STRPOOL_MAX_LEN) != 0);
+
+    // Still held once after one release
+    strpool_release(a);
+    CHECK(strcmp(strpool_get(b), "Romeo and Juliet") == 0);
+    CHECK(strpool_intern("Romeo and Juliet", 16) == a);
+
+    char text[128];
+    for (int i = 0; i < STRINGS; i++) {
+        int len = snprintf(text, sizeof(text), "string %d of the pool, padded %*s", i, i % 40, "");
+        handles[i] = strpool_intern(text, len);
+        CHECK(handles[i] != 0);
+    }
+    for (int i = 0; i < STRINGS; i++) {
+        int len = snprintf(text, sizeof(text), "string %d of the pool, padded %*s", i, i % 40, "");
+        CHECK(strcmp(strpool_get(handles[i]), text) == 0);
+        CHECK(strpool_intern(text, len) == handles[i]);
+        strpool_release(handles[i]);
+    }
+
+    // Fully released: a string of the same size class takes its place
+    uint32_t freed = handles[STRINGS - 1];
+    strpool_release(freed);
+    int len = snprintf(text, sizeof(text), "string %d of the pool, padded %*s", STRINGS - 1, (STRINGS - 1) % 40, "");
+    text[0] = 'S';
+    CHECK(strpool_intern(text, len) == freed);
+    CHECK(strcmp(strpool_get(freed), text) == 0);
+
+    return check_report("strpool");
+}